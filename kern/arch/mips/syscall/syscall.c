@@ -110,6 +110,16 @@ syscall(struct trapframe *tf)
             err = sys___time((userptr_t)tf->tf_a0,
                              (userptr_t)tf->tf_a1);
             break;
+
+	    case SYS___settime:
+            err = sys___settime((userptr_t)tf->tf_a0,
+                                (userptr_t)tf->tf_a1);
+            break;
+
+	    case SYS_nanosleep:
+            err = sys_nanosleep((userptr_t)tf->tf_a0,
+                                (userptr_t)tf->tf_a1);
+            break;
 #ifdef UW
         case SYS_write:
             err = sys_write((int)tf->tf_a0,
@@ -141,6 +151,34 @@ syscall(struct trapframe *tf)
             break;
 #endif //OPT_A2
 #endif // UW
+
+	    case SYS_sched_setaffinity:
+            err = sys_sched_setaffinity((pid_t)tf->tf_a0,
+                                        (uint32_t)tf->tf_a1);
+            break;
+
+	    case SYS_sched_settickets:
+            err = sys_sched_settickets((pid_t)tf->tf_a0,
+                                       (int)tf->tf_a1);
+            break;
+
+	    case SYS_sched_setedf:
+            err = sys_sched_setedf((int)tf->tf_a0, (int)tf->tf_a1);
+            break;
+
+	    case SYS_sched_setgang:
+            err = sys_sched_setgang((pid_t)tf->tf_a0, (int)tf->tf_a1);
+            break;
+
+	    case SYS_futex_wait:
+            err = sys_futex_wait((userptr_t)tf->tf_a0, (int)tf->tf_a1,
+                                 (userptr_t)tf->tf_a2);
+            break;
+
+	    case SYS_futex_wake:
+            err = sys_futex_wake((userptr_t)tf->tf_a0, (int)tf->tf_a1,
+                                 (int *)(&retval));
+            break;
             
             /* Add stuff here */
             
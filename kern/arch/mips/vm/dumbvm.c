@@ -37,6 +37,7 @@
 #include <mips/tlb.h>
 #include <addrspace.h>
 #include <vm.h>
+#include <uw-vmstats.h>
 
 /*
  * Dumb MIPS-only "VM system" that is intended to only be just barely
@@ -199,6 +200,10 @@ vm_fault(int faulttype, vaddr_t faultaddress)
 		DEBUG(DB_VM, "dumbvm: 0x%x -> 0x%x\n", faultaddress, paddr);
 		tlb_write(ehi, elo, i);
 		splx(spl);
+		/* dumbvm pages are always in memory, so it's a reload */
+		vmstats_inc(VMSTAT_TLB_FAULT);
+		vmstats_inc(VMSTAT_TLB_FAULT_FREE);
+		vmstats_inc(VMSTAT_TLB_RELOAD);
 		return 0;
 	}
 
@@ -254,6 +259,7 @@ as_activate(void)
 	}
 
 	splx(spl);
+	vmstats_inc(VMSTAT_TLB_INVALIDATE);
 }
 
 void
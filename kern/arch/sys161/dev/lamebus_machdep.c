@@ -50,12 +50,29 @@
  */
 #define CPU_FREQUENCY 25000000 /* 25 MHz */
 
+/*
+ * Timer period for HZ hardclocks a second, and the timeout used while
+ * a cpu is tickless (one minute, rounded to whole periods).
+ */
+#define TIMER_PERIOD	(CPU_FREQUENCY / HZ)
+#define TIMER_IDLE	(TIMER_PERIOD * HZ * 60)
+
+/*
+ * If a restarted timer would be due within this many cycles, skip to
+ * the following period so we don't set compare behind count.
+ */
+#define TIMER_SLOP	1000
+
 /*
  * Access to the on-chip timer.
  *
  * The c0_count register increments on every cycle; when the value
  * matches the c0_compare register, the timer interrupt line is
  * asserted. Writing to c0_compare again clears the interrupt.
+ *
+ * On System/161, c0_count also goes back to zero when it matches, so
+ * it always holds the number of cycles since the last timer
+ * interrupt.
  */
 static
 void
@@ -73,6 +90,38 @@ mips_timer_set(uint32_t count)
 		:: "r" (count));
 }
 
+static
+uint32_t
+mips_timer_get(void)
+{
+	uint32_t count;
+
+	/* $9 == c0_count */
+	__asm volatile(
+		".set push;"		/* save assembler mode */
+		".set mips32;"		/* allow MIPS32 registers */
+		"mfc0 %0, $9;"		/* do it */
+		".set pop"		/* restore assembler mode */
+		: "=r" (count));
+	return count;
+}
+
+static
+uint32_t
+mips_timer_getcompare(void)
+{
+	uint32_t compare;
+
+	/* $11 == c0_compare */
+	__asm volatile(
+		".set push;"		/* save assembler mode */
+		".set mips32;"		/* allow MIPS32 registers */
+		"mfc0 %0, $11;"		/* do it */
+		".set pop"		/* restore assembler mode */
+		: "=r" (compare));
+	return compare;
+}
+
 /*
  * LAMEbus data for the system. (We have only one LAMEbus per system.)
  * This does not need to be locked, because it's constant once
@@ -113,7 +162,62 @@ mainbus_bootstrap(void)
 	/*
 	 * Configure the MIPS on-chip timer to interrupt HZ times a second.
 	 */
-	mips_timer_set(CPU_FREQUENCY / HZ);
+	mips_timer_set(TIMER_PERIOD);
+}
+
+/*
+ * Stop the hardclock timer. We can't turn it off entirely, so push
+ * the next interrupt out to TICKS periods after the last one, or to
+ * TIMER_IDLE cycles if TICKS is 0 or further away than that. If it
+ * expires (see mainbus_interrupt) we account for the periods and go
+ * again.
+ */
+void
+mainbus_timer_stop(unsigned ticks)
+{
+	uint32_t count, next;
+
+	if (ticks == 0 || ticks > TIMER_IDLE / TIMER_PERIOD) {
+		ticks = TIMER_IDLE / TIMER_PERIOD;
+	}
+	next = ticks * TIMER_PERIOD;
+
+	count = mips_timer_get();
+	if (next < count + TIMER_SLOP) {
+		/* Already due; make it the next period boundary. */
+		next = (count / TIMER_PERIOD + 1) * TIMER_PERIOD;
+		if (next - count < TIMER_SLOP) {
+			next += TIMER_PERIOD;
+		}
+	}
+	mips_timer_set(next);
+}
+
+/*
+ * Restart the hardclock timer. Since count is the number of cycles
+ * since the last interrupt, which was on a period boundary, it tells
+ * us both how many periods were skipped and where the next one ends.
+ */
+unsigned
+mainbus_timer_restart(void)
+{
+	uint32_t count, next;
+	unsigned skipped;
+
+	count = mips_timer_get();
+	skipped = count / TIMER_PERIOD;
+	next = (skipped + 1) * TIMER_PERIOD;
+	if (next - count < TIMER_SLOP) {
+		/* Too close to call; take this one as skipped too. */
+		skipped++;
+		next += TIMER_PERIOD;
+	}
+	/*
+	 * When this fires, count resets and mainbus_interrupt goes
+	 * back to the normal period.
+	 */
+	mips_timer_set(next);
+	return skipped;
 }
 
 /*
@@ -255,6 +359,7 @@ void
 mainbus_interrupt(struct trapframe *tf)
 {
 	uint32_t cause;
+	unsigned ticks;
 
 	/* interrupts should be off */
 	KASSERT(curthread->t_curspl > 0);
@@ -268,10 +373,23 @@ mainbus_interrupt(struct trapframe *tf)
 		lamebus_clear_ipi(lamebus, curcpu);
 	}
 	else if (cause & MIPS_TIMER_BIT) {
-		/* Reset the timer (this clears the interrupt) */
-		mips_timer_set(CPU_FREQUENCY / HZ);
-		/* and call hardclock */
-		hardclock();
+		if (curcpu->c_tickless) {
+			/*
+			 * The idle timeout expired. Stay stopped and
+			 * account for the whole interval, which runs
+			 * any callouts that came due; the idle loop
+			 * will set the next timeout.
+			 */
+			ticks = mips_timer_getcompare() / TIMER_PERIOD;
+			mips_timer_set(TIMER_IDLE);
+			hardclock_skip(ticks);
+		}
+		else {
+			/* Reset the timer (this clears the interrupt) */
+			mips_timer_set(TIMER_PERIOD);
+			/* and call hardclock */
+			hardclock();
+		}
 	}
 	else {
 		panic("Unknown interrupt; cause register is %08x\n", cause);
@@ -38,17 +38,32 @@
  * of the available clocks to use, if more than one is available.
  *
  * The system will panic if gettime() is called and there is no clock.
+ *
+ * gettime() returns the hardware clock as is, so intervals measured
+ * with it are never disturbed by settime(). The time of day is the
+ * hardware clock plus an offset that settime() adjusts; see
+ * getwalltime(). The offset is two words (more, with 64-bit time_t),
+ * so it's kept under a seqlock: readers copy it and retry if an
+ * update slipped in, and never contend with each other.
  */
 
 #include <types.h>
 #include <kern/errno.h>
 #include <lib.h>
+#include <spinlock.h>
+#include <seqlock.h>
 #include <clock.h>
 #include <generic/rtclock.h>
 #include "autoconf.h"
 
 static struct rtclock_softc *the_clock = NULL;
 
+/* Time of day minus hardware clock; nsecs is always < 1000000000 */
+static struct spinlock rtc_offset_lock = SPINLOCK_INITIALIZER;
+static struct seqlock rtc_offset_seq = SEQLOCK_INITIALIZER;
+static time_t rtc_offset_secs;
+static uint32_t rtc_offset_nsecs;
+
 int
 config_rtclock(struct rtclock_softc *rtc, int unit)
 {
@@ -68,3 +83,52 @@ gettime(time_t *secs, uint32_t *nsecs)
 	KASSERT(the_clock!=NULL);
 	the_clock->rtc_gettime(the_clock->rtc_devdata, secs, nsecs);
 }
+
+void
+getwalltime(time_t *secs, uint32_t *nsecs)
+{
+	time_t osecs;
+	uint32_t onsecs;
+	unsigned seq;
+
+	gettime(secs, nsecs);
+
+	do {
+		seq = seqlock_read_begin(&rtc_offset_seq);
+		osecs = rtc_offset_secs;
+		onsecs = rtc_offset_nsecs;
+	} while (seqlock_read_retry(&rtc_offset_seq, seq));
+
+	*secs += osecs;
+	*nsecs += onsecs;
+	if (*nsecs >= 1000000000) {
+		*nsecs -= 1000000000;
+		(*secs)++;
+	}
+}
+
+void
+settime(time_t secs, uint32_t nsecs)
+{
+	time_t nowsecs, osecs;
+	uint32_t nownsecs, onsecs;
+
+	KASSERT(nsecs < 1000000000);
+
+	gettime(&nowsecs, &nownsecs);
+	osecs = secs - nowsecs;
+	if (nsecs >= nownsecs) {
+		onsecs = nsecs - nownsecs;
+	}
+	else {
+		onsecs = nsecs + 1000000000 - nownsecs;
+		osecs--;
+	}
+
+	spinlock_acquire(&rtc_offset_lock);
+	seqlock_write_begin(&rtc_offset_seq);
+	rtc_offset_secs = osecs;
+	rtc_offset_nsecs = onsecs;
+	seqlock_write_end(&rtc_offset_seq);
+	spinlock_release(&rtc_offset_lock);
+}
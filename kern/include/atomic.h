@@ -0,0 +1,126 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _ATOMIC_H_
+#define _ATOMIC_H_
+
+/*
+ * Atomic operations on an unsigned word, for counters and flags that
+ * would otherwise need a spinlock just to be updated.
+ *
+ *    atomic_cas(p, old, new)   if *P is OLD, set it to NEW. Returns
+ *                              the value *P had; the swap happened
+ *                              if that is OLD.
+ *    atomic_fetchadd(p, d)     add D to *P, returning the old value.
+ *                              (D is unsigned, but adding (unsigned)-1
+ *                              subtracts one as you'd expect.)
+ *    atomic_exchange(p, v)     set *P to V, returning the old value.
+ *    atomic_inc(p)             add one to *P.
+ *    atomic_dec(p)             subtract one from *P, returning the new
+ *                              value, so callers can tell when it
+ *                              reaches zero.
+ *
+ *    membar_sync()             no memory access moves across this.
+ *    membar_producer()         stores before this are seen before
+ *                              stores after it.
+ *    membar_consumer()         loads before this happen before loads
+ *                              after it.
+ *
+ * None of these imply a barrier themselves. Publishing data with a
+ * flag takes membar_producer between filling in the data and setting
+ * the flag, and membar_consumer between seeing the flag and reading
+ * the data.
+ *
+ * The machine-dependent header must provide atomic_cas and the
+ * barriers. If it doesn't also define ATOMIC_HAVE_FETCHADD or
+ * ATOMIC_HAVE_EXCHANGE, the missing operation is built here out of
+ * a CAS loop.
+ */
+
+#include <cdefs.h>
+
+/* Inlining support - for making sure an out-of-line copy gets built */
+#ifndef ATOMIC_INLINE
+#define ATOMIC_INLINE INLINE
+#endif
+
+/* Get the machine-dependent bits. */
+#include <machine/atomic.h>
+
+#ifndef ATOMIC_HAVE_FETCHADD
+unsigned atomic_fetchadd(volatile unsigned *p, unsigned delta);
+
+ATOMIC_INLINE
+unsigned
+atomic_fetchadd(volatile unsigned *p, unsigned delta)
+{
+	unsigned old;
+
+	do {
+		old = *p;
+	} while (atomic_cas(p, old, old + delta) != old);
+	return old;
+}
+#endif
+
+#ifndef ATOMIC_HAVE_EXCHANGE
+unsigned atomic_exchange(volatile unsigned *p, unsigned val);
+
+ATOMIC_INLINE
+unsigned
+atomic_exchange(volatile unsigned *p, unsigned val)
+{
+	unsigned old;
+
+	do {
+		old = *p;
+	} while (atomic_cas(p, old, val) != old);
+	return old;
+}
+#endif
+
+void atomic_inc(volatile unsigned *p);
+unsigned atomic_dec(volatile unsigned *p);
+
+ATOMIC_INLINE
+void
+atomic_inc(volatile unsigned *p)
+{
+	atomic_fetchadd(p, 1);
+}
+
+ATOMIC_INLINE
+unsigned
+atomic_dec(volatile unsigned *p)
+{
+	return atomic_fetchadd(p, (unsigned)-1) - 1;
+}
+
+
+#endif /* _ATOMIC_H_ */
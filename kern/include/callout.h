@@ -0,0 +1,92 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _CALLOUT_H_
+#define _CALLOUT_H_
+
+/*
+ * Callouts: functions to be called after a given number of
+ * hardclocks.
+ *
+ * Each cpu keeps its pending callouts in a hierarchical timing wheel
+ * (see callout.c), so scheduling and cancelling are O(1) and each
+ * hardclock only looks at the callouts due on it. Time here is the
+ * cpu's own c_hardclocks count, which keeps advancing across tickless
+ * idle; an idle cpu with callouts pending arranges to wake up for the
+ * first one.
+ *
+ * A callout runs on the cpu that scheduled it, from the hardclock
+ * interrupt (or from the idle loop with interrupts off), so it must
+ * not sleep. The struct callout belongs to the caller; callers that
+ * might schedule or stop the same callout from two threads at once
+ * must serialize among themselves.
+ *
+ *    callout_init        set up a callout to call FUNC(DATA1, DATA2).
+ *    callout_schedule    arrange for it to run TICKS hardclocks from
+ *                        now on the current cpu, replacing any earlier
+ *                        schedule. TICKS of 0 means the next hardclock.
+ *    callout_stop        cancel it. Returns true if it was pending and
+ *                        now won't run. If it is running on another
+ *                        cpu, waits for it to finish first, so once
+ *                        callout_stop returns the callout is unused
+ *                        and may be freed.
+ *    callout_pending     true if scheduled and not yet run.
+ *
+ *    callwheel_create    per-cpu setup, called from cpu_create.
+ *    callout_hardclock   run everything due by curcpu->c_hardclocks.
+ *    callout_nextdue     hardclocks until the next callout on this
+ *                        cpu may be due (0 if none), for tickless idle.
+ *                        May be early, never late.
+ */
+
+struct cpu;
+struct callwheel;
+
+struct callout {
+	struct callout *co_next;	/* Link in wheel slot */
+	struct callout **co_prevp;	/* Back link; NULL if not pending */
+	struct cpu *co_cpu;		/* Cpu whose wheel we're on */
+	unsigned co_expire;		/* Due at this c_hardclocks value */
+	void (*co_func)(void *data1, unsigned long data2);
+	void *co_data1;
+	unsigned long co_data2;
+};
+
+void callout_init(struct callout *co,
+		  void (*func)(void *data1, unsigned long data2),
+		  void *data1, unsigned long data2);
+void callout_schedule(struct callout *co, unsigned ticks);
+bool callout_stop(struct callout *co);
+bool callout_pending(struct callout *co);
+
+struct callwheel *callwheel_create(void);
+void callout_hardclock(void);
+unsigned callout_nextdue(void);
+
+#endif /* _CALLOUT_H_ */
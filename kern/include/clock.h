@@ -38,10 +38,19 @@
  * hardclock() is called on every CPU HZ times a second, possibly only
  * when the CPU is not idle, for scheduling.
  *
+ * hardclock_stop() and hardclock_restart() bracket idling in the idle
+ * loop. In between, the cpu gets no hardclocks; the ones that would
+ * have happened are added to c_hardclocks (and counted as skipped)
+ * when the timer is restarted. An interrupt or IPI is what wakes an
+ * idle cpu, so it doesn't need a periodic tick.
+ * hardclock_skip() is for the timer code to account skipped ticks.
+ *
  * timerclock() is called on one CPU once a second to allow simple
  * timed operations. (This is a fairly simpleminded interface.)
  *
- * gettime() may be used to fetch the current time of day.
+ * gettime() fetches the hardware clock; use it for timing intervals.
+ * getwalltime() fetches the current time of day, which is the
+ * hardware clock adjusted by the last settime().
  * getinterval() computes the time from time1 to time2.
  *
  * XXX we have struct timespec now, let's use it.
@@ -59,9 +68,14 @@
 void hardclock_bootstrap(void);
 
 void hardclock(void);
+void hardclock_stop(void);
+void hardclock_restart(void);
+void hardclock_skip(unsigned ticks);
 void timerclock(void);
 
 void gettime(time_t *seconds, uint32_t *nanoseconds);
+void getwalltime(time_t *seconds, uint32_t *nanoseconds);
+void settime(time_t seconds, uint32_t nanoseconds);
 
 void getinterval(time_t secs1, uint32_t nsecs,
                  time_t secs2, uint32_t nsecs2,
@@ -70,8 +84,13 @@ void getinterval(time_t secs1, uint32_t nsecs,
 /*
  * clocksleep() suspends execution for the requested number of seconds,
  * like userlevel sleep(3). (Don't confuse it with wchan_sleep.)
+ * clocksleep_ms() does the same in milliseconds; the actual sleep is
+ * rounded up to whole hardclocks. mstohardclocks() converts for
+ * callers using callouts or wchan_timedsleep directly.
  */
 void clocksleep(int seconds);
+void clocksleep_ms(unsigned ms);
+unsigned mstohardclocks(unsigned ms);
 
 
 #endif /* _CLOCK_H_ */
@@ -32,8 +32,11 @@
 
 
 #include <spinlock.h>
+#include <seqlock.h>
 #include <threadlist.h>
+#include <thread.h>	/* for MLFQ_LEVELS */
 #include <machine/vm.h>  /* for TLBSHOOTDOWN_MAX */
+#include <cpucounter.h>	/* for CPUCOUNTER_COUNT */
 
 
 /*
@@ -53,6 +56,7 @@ struct cpu {
 	struct cpu *c_self;		/* Canonical address of this struct */
 	unsigned c_number;		/* This cpu's cpu number */
 	unsigned c_hardware_number;	/* Hardware-defined cpu number */
+	struct thread *c_idlethread;	/* Idles when nothing can run */
 
 	/*
 	 * Accessed only by this cpu.
@@ -60,13 +64,53 @@ struct cpu {
 	struct thread *c_curthread;	/* Current thread on cpu */
 	struct threadlist c_zombies;	/* List of exited threads */
 	unsigned c_hardclocks;		/* Counter of hardclock() calls */
+	struct thread *c_migrating;	/* Thread to requeue elsewhere */
+	struct threadlist c_threadcache; /* Dead threads kept for reuse */
+	unsigned c_cachehits;		/* thread_fork reused a thread */
+	unsigned c_cachemisses;		/* thread_fork had to allocate */
+	bool c_tickless;		/* Hardclock timer stopped */
+	unsigned c_ticksskipped;	/* Hardclocks not taken while idle */
+	unsigned c_counters[CPUCOUNTER_COUNT]; /* See cpucounter.h */
+
+	/*
+	 * Set once at boot; these have their own locks.
+	 */
+	struct workqueue *c_workqueue;	/* Deferred work for this cpu */
+	struct callwheel *c_callwheel;	/* Pending callouts */
+
+	/*
+	 * RCU quiescent states (see rcu.c). c_rcuqs is only written by
+	 * this cpu, in thread_switch; c_rcusnap is protected by the
+	 * RCU lock.
+	 */
+	volatile unsigned c_rcuqs;	/* Quiescent states passed */
+	unsigned c_rcusnap;		/* c_rcuqs at grace period start */
 
 	/*
 	 * Accessed by other cpus.
 	 * Protected by the runqueue lock.
+	 *
+	 * There is one run queue per MLFQ level, plus one for stride
+	 * threads kept sorted by pass, one for EDF threads sorted by
+	 * deadline, and one for gang threads; c_runcount is the total
+	 * number of threads across all of them. For stride scheduling,
+	 * all the MLFQ threads together count as one client with pass
+	 * c_tspass.
+	 * Changes to the queue counts are also covered by c_loadseq, so
+	 * other cpus can read them without the lock (see cpu_getload).
 	 */
 	bool c_isidle;			/* True if this cpu is idle */
-	struct threadlist c_runqueue;	/* Run queue for this cpu */
+	struct threadlist c_runqueue[MLFQ_LEVELS]; /* Run queues */
+	struct threadlist c_stridequeue; /* Stride threads, by pass */
+	struct threadlist c_edfqueue;	/* EDF threads, by deadline */
+	struct threadlist c_gangqueue;	/* Gang threads placed here */
+	unsigned c_edfutil;		/* EDF share reserved here */
+	unsigned c_edfmisses;		/* EDF deadlines missed */
+	unsigned c_runcount;		/* Threads on all run queues */
+	uint32_t c_tspass;		/* Stride pass of the MLFQ class */
+	uint32_t c_vpass;		/* Pass of the last dispatch */
+	unsigned c_steals;		/* Threads stolen from other cpus */
+	struct seqlock c_loadseq;	/* Queue counts, for cpu_getload */
 	struct spinlock c_runqueue_lock;
 
 	/*
@@ -82,10 +126,21 @@ struct cpu {
 	 * struct tlbshootdown is machine-dependent and might
 	 * reasonably be either an address space and vaddr pair, or a
 	 * paddr, or something else.
+	 *
+	 * Shootdowns are queued in c_shootdown and the whole batch is
+	 * handled by one IPI; c_shootdownsent is set while that IPI is
+	 * outstanding so further queueing doesn't send another.
+	 * c_shootdownseq counts mappings queued and c_shootdowndone is
+	 * the value it had when the cpu last emptied its queue; senders
+	 * that want to wait for their mappings to be gone spin on it.
 	 */
 	uint32_t c_ipi_pending;		/* One bit for each IPI number */
 	struct tlbshootdown c_shootdown[TLBSHOOTDOWN_MAX];
 	int c_numshootdown;
+	bool c_shootdownsent;		/* IPI sent for current batch */
+	unsigned c_shootdownseq;	/* Mappings queued, ever */
+	volatile unsigned c_shootdowndone; /* Seq at last batch flushed */
+	unsigned c_shootdownipis;	/* Shootdown IPIs sent here */
 	struct spinlock c_ipi_lock;
 };
 
@@ -109,6 +164,13 @@ void cpu_machdep_init(struct cpu *);
 /*ASMLINKAGE*/ void cpu_start_secondary(void);
 void cpu_hatch(unsigned software_number);
 
+/*
+ * Number of cpus, and the cpu with software number NUM, for code
+ * outside the thread system that needs to visit every cpu.
+ */
+unsigned cpu_count(void);
+struct cpu *cpu_get(unsigned num);
+
 /*
  * Return a string describing the CPU type.
  */
@@ -153,6 +215,16 @@ void cpu_halt(void);
  * ipi_broadcast sends an IPI to all CPUs except the current one.
  * ipi_tlbshootdown is like ipi_send but carries TLB shootdown data.
  *
+ * ipi_tlbshootdown_queue adds a mapping to the target's shootdown
+ * queue without interrupting it; past TLBSHOOTDOWN_MAX queued
+ * mappings the target flushes its whole TLB instead. Unmapping
+ * several pages should queue them all and then call
+ * ipi_tlbshootdown_flush once, which sends each cpu with queued
+ * mappings a single IPI. If WAIT is true it also spins until every
+ * one of those cpus has invalidated the mappings queued so far;
+ * otherwise it returns at once and they are invalidated whenever
+ * the IPIs land. ipi_tlbshootdown is queue followed by a lazy flush.
+ *
  * interprocessor_interrupt is called on the target CPU when an IPI is
  * received.
  */
@@ -162,10 +234,14 @@ void cpu_halt(void);
 #define IPI_OFFLINE		1	/* CPU is requested to go offline */
 #define IPI_UNIDLE		2	/* Runnable threads are available */
 #define IPI_TLBSHOOTDOWN	3	/* MMU mapping(s) need invalidation */
+#define IPI_GANG		4	/* A gang's turn has started or ended */
 
 void ipi_send(struct cpu *target, int code);
 void ipi_broadcast(int code);
 void ipi_tlbshootdown(struct cpu *target, const struct tlbshootdown *mapping);
+void ipi_tlbshootdown_queue(struct cpu *target,
+			    const struct tlbshootdown *mapping);
+void ipi_tlbshootdown_flush(bool wait);
 
 void interprocessor_interrupt(void);
 
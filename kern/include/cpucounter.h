@@ -0,0 +1,65 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _CPUCOUNTER_H_
+#define _CPUCOUNTER_H_
+
+/*
+ * Per-cpu counters, for statistics bumped on hot paths.
+ *
+ * Each counter has a slot in every struct cpu. Bumping one touches
+ * only the current cpu's slot, with interrupts off for the moment it
+ * takes so we can't be moved to another cpu halfway through, and so
+ * takes no lock and shares no cache line with the other cpus.
+ * Reading one adds up the slots of all cpus; the answer is exact
+ * only if nobody is bumping the counter at the same time, which is
+ * fine for statistics.
+ *
+ *    cpucounter_inc(which)      add one to counter WHICH.
+ *    cpucounter_add(which, n)   add N.
+ *    cpucounter_read(which)     total across cpus.
+ *    cpucounter_reset(which)    set back to zero on all cpus. An
+ *                               increment racing with this may be
+ *                               lost or may survive it.
+ *
+ * Counters are numbered statically, below.
+ */
+
+#include <uw-vmstats.h>		/* for VMSTAT_COUNT */
+
+#define CPUCOUNTER_VMSTATS	0	/* VMSTAT_COUNT of them, in order */
+#define CPUCOUNTER_COUNT	(CPUCOUNTER_VMSTATS + VMSTAT_COUNT)
+
+void cpucounter_inc(unsigned which);
+void cpucounter_add(unsigned which, unsigned n);
+unsigned cpucounter_read(unsigned which);
+void cpucounter_reset(unsigned which);
+
+
+#endif /* _CPUCOUNTER_H_ */
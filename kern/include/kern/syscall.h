@@ -197,6 +197,16 @@
 #define SYS_reboot       119
 //#define SYS___sysctl   120
 
+//                              -- Scheduling --
+#define SYS_sched_setaffinity 121
+#define SYS_sched_settickets 122
+#define SYS_sched_setedf 123
+#define SYS_sched_setgang 124
+
+//                              -- Futexes --
+#define SYS_futex_wait   125
+#define SYS_futex_wake   126
+
 /*CALLEND*/
 
 
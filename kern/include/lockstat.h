@@ -0,0 +1,106 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _LOCKSTAT_H_
+#define _LOCKSTAT_H_
+
+/*
+ * Lock contention statistics.
+ *
+ * With "options lockstat" in the kernel config, locks, semaphores and
+ * spinlocks keep count of how often they are taken, how often the
+ * taker had to wait, how many turns it spent spinning and how long
+ * it waited altogether. Locks and semaphores are recorded by name,
+ * so all the locks called "vnode lock" add up in one record; counts
+ * for same-named locks used at once on different cpus are
+ * approximate. Spinlocks have no names, so each one gets a record of
+ * its own, keyed by address, the first time it is contended, and
+ * the record shows who that first caller was.
+ *
+ * The "lockstat" menu command prints the locks with the most total
+ * wait time; "lockstat reset" zeroes the counts.
+ *
+ * Without the option none of this is compiled: the fields aren't in
+ * the lock structures and the LOCKSTAT_* macros expand to nothing.
+ */
+
+#include "opt-lockstat.h"
+
+#if OPT_LOCKSTAT
+
+#define LOCKSTAT_NAMELEN	24	/* Longest name kept, with NUL */
+#define LOCKSTAT_MAX		256	/* Records in the table */
+
+struct lockstat {
+	char ls_name[LOCKSTAT_NAMELEN];	/* Name, maybe truncated */
+	const char *ls_kind;		/* "lock", "sem" or "spinlock" */
+	const void *ls_addr;		/* Spinlock address, else NULL */
+	unsigned ls_acquires;		/* Times taken */
+	unsigned ls_contended;		/* Times the taker had to wait */
+	uint64_t ls_spins;		/* Spin loop turns while waiting */
+	uint64_t ls_waitns;		/* Time spent waiting */
+};
+
+/* When a wait started */
+struct lockstat_wait {
+	bool lw_valid;
+	time_t lw_secs;
+	uint32_t lw_nsecs;
+};
+
+void lockstat_bootstrap(void);
+struct lockstat *lockstat_lookup(const char *kind, const char *name);
+struct lockstat *lockstat_spinlock(const void *addr, const void *caller);
+void lockstat_waitbegin(struct lockstat_wait *lw);
+void lockstat_waitend(struct lockstat *ls, const struct lockstat_wait *lw,
+		      unsigned spins);
+void lockstat_reset(void);
+void lockstat_print(unsigned topn);
+
+/*
+ * Hooks for the lock code. LS is a record pointer, which may be NULL
+ * if the table filled up; LW is a struct lockstat_wait declared with
+ * LOCKSTAT_WAITVAR.
+ */
+#define LOCKSTAT_WAITVAR(lw)		struct lockstat_wait lw
+#define LOCKSTAT_ACQUIRED(ls) \
+	((ls) != NULL ? (void)(ls)->ls_acquires++ : (void)0)
+#define LOCKSTAT_WAITBEGIN(lw)		lockstat_waitbegin(&(lw))
+#define LOCKSTAT_WAITEND(ls, lw, spins)	lockstat_waitend(ls, &(lw), spins)
+
+#else
+
+#define LOCKSTAT_WAITVAR(lw)		int lw __attribute__((__unused__))
+#define LOCKSTAT_ACQUIRED(ls)		((void)0)
+#define LOCKSTAT_WAITBEGIN(lw)		((void)0)
+#define LOCKSTAT_WAITEND(ls, lw, spins)	((void)(spins))
+
+#endif /* OPT_LOCKSTAT */
+
+#endif /* _LOCKSTAT_H_ */
@@ -55,6 +55,18 @@ size_t mainbus_ramsize(void);
 /* Switch on an inter-processor interrupt. (Low-level.) */
 void mainbus_send_ipi(struct cpu *target);
 
+/*
+ * Stop and restart the current cpu's hardclock timer, for tickless
+ * idle. mainbus_timer_stop is given the number of hardclock periods
+ * until the cpu next needs to wake up (0 for no limit).
+ * mainbus_timer_restart returns the number of hardclock periods
+ * that passed while the timer was stopped and not already reported
+ * through hardclock_skip(), and arranges for the next hardclock to
+ * come when it would have anyway.
+ */
+void mainbus_timer_stop(unsigned ticks);
+unsigned mainbus_timer_restart(void);
+
 /*
  * The various ways to shut down the system. (These are very low-level
  * and should generally not be called directly - md_poweroff, for
@@ -39,6 +39,7 @@
 #include <spinlock.h>
 #include <thread.h> /* required for struct threadarray */
 #include <array.h>
+#include <rcu.h>
 #include "opt-A2.h"
 
 struct addrspace;
@@ -55,9 +56,12 @@ struct proc **proctable;
  * Process structure.
  */
 struct proc {
+	struct rcu_head p_rcu;		/* Deferred free (must be first) */
 	char *p_name;			/* Name of this process */
 	struct spinlock p_lock;		/* Lock for this structure */
 	struct threadarray p_threads;	/* Threads in this process */
+	bool p_gang;			/* Gang scheduled */
+	unsigned p_gangnext;		/* Where to place next gang thread */
     
 	/* VM */
 	struct addrspace *p_addrspace;	/* virtual address space */
@@ -93,6 +97,11 @@ struct proc **get_proctable(void);
 
 int get_array_size(void);
 
+#if OPT_A2
+/* Remove a destroyed proc from proctable and free it after a grace period. */
+void proc_free(struct proc *proc);
+#endif
+
 /* This is the process structure for the kernel and for kernel-only threads. */
 extern struct proc *kproc;
 
@@ -116,6 +125,15 @@ int proc_addthread(struct proc *proc, struct thread *t);
 /* Detach a thread from its process. */
 void proc_remthread(struct thread *t);
 
+/* Set the cpu affinity mask of all threads in a process. */
+int proc_setaffinity(struct proc *proc, uint32_t mask);
+
+/* Set the stride tickets of all threads in a process (0 for none). */
+int proc_settickets(struct proc *proc, unsigned tickets);
+
+/* Turn gang scheduling of a process's threads on or off. */
+int proc_setgang(struct proc *proc, bool on);
+
 /* Fetch the address space of the current process. */
 struct addrspace *curproc_getas(void);
 
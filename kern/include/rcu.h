@@ -0,0 +1,91 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _RCU_H_
+#define _RCU_H_
+
+/*
+ * Read-copy-update, for read-mostly tables.
+ *
+ * Readers bracket their lookups with rcu_read_lock and
+ * rcu_read_unlock and take no locks at all. In between they must not
+ * sleep, and they are not preempted. Writers serialize among
+ * themselves however they like, publish a changed version of the
+ * data with rcu_assign, and pass anything readers might still be
+ * looking at to call_rcu, which calls FUNC on it once every reader
+ * that could have seen it is done.
+ *
+ * "Done" is detected through quiescent states: a cpu that has been
+ * through thread_switch, or sat in the idle loop, can't still be in
+ * a read section it was in before. Once every cpu has been
+ * quiescent since an item was handed to call_rcu, its grace period
+ * is over. This is checked once per hardclock while anything is
+ * waiting, by a callout, and FUNC is called from that callout, so
+ * it must not sleep; kfree is fine.
+ *
+ *    rcu_read_lock       start a read section. May be nested.
+ *    rcu_read_unlock     end it.
+ *    rcu_deref(p)        fetch a pointer that is published with
+ *                        rcu_assign, inside a read section.
+ *    rcu_assign(p, v)    publish V in P, after V is filled in.
+ *    call_rcu            call FUNC(RH) after a grace period. RH is
+ *                        normally embedded in the object to be freed.
+ *    rcu_synchronize     sleep until a grace period has gone by.
+ *                        Must not be called in a read section.
+ */
+
+struct rcu_head {
+	struct rcu_head *rh_next;
+	void (*rh_func)(struct rcu_head *rh);
+};
+
+void rcu_bootstrap(void);
+
+void rcu_read_lock(void);
+void rcu_read_unlock(void);
+
+/*
+ * System/161 keeps stores in order as seen by the other cpus, so all
+ * these need is to stop the compiler caching the pointer or moving
+ * the stores that fill in V past the one that publishes it.
+ */
+#define rcu_deref(p)		(*(__typeof__(p) volatile *)&(p))
+#define rcu_assign(p, v) \
+	do { \
+		__asm volatile("" ::: "memory"); \
+		*(__typeof__(p) volatile *)&(p) = (v); \
+	} while (0)
+
+void call_rcu(struct rcu_head *rh, void (*func)(struct rcu_head *rh));
+void rcu_synchronize(void);
+
+void rcu_printstats(void);
+
+
+#endif /* _RCU_H_ */
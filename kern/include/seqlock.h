@@ -0,0 +1,140 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _SEQLOCK_H_
+#define _SEQLOCK_H_
+
+/*
+ * Sequence locks, for small multi-word data that is read far more
+ * often than it's written and must be read consistently.
+ *
+ * The writer makes the sequence number odd while it updates the
+ * data and even again when it's done. A reader notes the number
+ * (waiting for it to be even), copies the data, and starts over if
+ * the number changed meanwhile. Readers never write to the lock, so
+ * they don't bounce its cache line between cpus or hold up the
+ * writer; only the writer is ever delayed, and not by readers.
+ *
+ * Writers must be serialized among themselves, normally by holding a
+ * spinlock that also protects the data; struct seqlock doesn't have
+ * one of its own, since the data usually already does. Because that
+ * spinlock keeps interrupts off, a reader can't spin forever waiting
+ * on a writer it interrupted on its own cpu.
+ *
+ *    seqlock_write_begin    start an update.
+ *    seqlock_write_end      finish it.
+ *
+ *    seqlock_read_begin     returns the sequence number to pass to
+ *                           seqlock_read_retry.
+ *    seqlock_read_retry     true if the data copied since
+ *                           seqlock_read_begin may be inconsistent and
+ *                           must be read again.
+ *
+ * Typical reader:
+ *
+ *        do {
+ *                seq = seqlock_read_begin(&sl);
+ *                copy = data;
+ *        } while (seqlock_read_retry(&sl, seq));
+ *
+ * Readers must copy the data out and not act on it, or follow
+ * pointers in it, until seqlock_read_retry says it's good.
+ */
+
+#include <cdefs.h>
+#include <atomic.h>
+
+/* Inlining support - for making sure an out-of-line copy gets built */
+#ifndef SEQLOCK_INLINE
+#define SEQLOCK_INLINE INLINE
+#endif
+
+struct seqlock {
+	volatile unsigned sl_seq;
+};
+
+#define SEQLOCK_INITIALIZER	{ 0 }
+
+void seqlock_init(struct seqlock *sl);
+void seqlock_write_begin(struct seqlock *sl);
+void seqlock_write_end(struct seqlock *sl);
+unsigned seqlock_read_begin(const struct seqlock *sl);
+bool seqlock_read_retry(const struct seqlock *sl, unsigned seq);
+
+////////////////////////////////////////////////////////////
+
+SEQLOCK_INLINE
+void
+seqlock_init(struct seqlock *sl)
+{
+	sl->sl_seq = 0;
+}
+
+SEQLOCK_INLINE
+void
+seqlock_write_begin(struct seqlock *sl)
+{
+	sl->sl_seq++;
+	membar_producer();
+}
+
+SEQLOCK_INLINE
+void
+seqlock_write_end(struct seqlock *sl)
+{
+	membar_producer();
+	sl->sl_seq++;
+}
+
+SEQLOCK_INLINE
+unsigned
+seqlock_read_begin(const struct seqlock *sl)
+{
+	unsigned seq;
+
+	while (1) {
+		seq = sl->sl_seq;
+		if ((seq & 1) == 0) {
+			break;
+		}
+	}
+	membar_consumer();
+	return seq;
+}
+
+SEQLOCK_INLINE
+bool
+seqlock_read_retry(const struct seqlock *sl, unsigned seq)
+{
+	membar_consumer();
+	return sl->sl_seq != seq;
+}
+
+
+#endif /* _SEQLOCK_H_ */
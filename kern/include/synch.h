@@ -36,18 +36,28 @@
 
 
 #include <spinlock.h>
+#include <lockstat.h>
+#include <thread.h>		/* for MLFQ_LEVELS */
 
 /*
- * Dijkstra-style semaphore.
+ * Synchronization objects don't have wait channels of their own;
+ * threads wait for them on the sleep queue for their address (see
+ * wchan.h), so creating one allocates nothing but the object.
  *
- * The name field is for easier debugging. A copy of the name is made
- * internally.
+ * The name fields are for easier debugging. NAME should be a string
+ * constant; it is not copied.
+ */
+
+/*
+ * Dijkstra-style semaphore.
  */
 struct semaphore {
-        char *sem_name;
-	struct wchan *sem_wchan;
+        const char *sem_name;
 	struct spinlock sem_lock;
         volatile int sem_count;
+#if OPT_LOCKSTAT
+	struct lockstat *sem_stat;
+#endif
 };
 
 struct semaphore *sem_create(const char *name, int initial_count);
@@ -58,8 +68,13 @@ void sem_destroy(struct semaphore *);
  *     P (proberen): decrement count. If the count is 0, block until
  *                   the count is 1 again before decrementing.
  *     V (verhogen): increment count.
+ *
+ * P_timed is P that gives up after MS milliseconds (rounded up to
+ * whole hardclocks) and returns ETIMEDOUT, or 0 if it got the count.
+ * With MS 0 it only takes the count if it is there already.
  */
 void P(struct semaphore *);
+int P_timed(struct semaphore *, unsigned ms);
 void V(struct semaphore *);
 
 
@@ -68,21 +83,35 @@ void V(struct semaphore *);
  *
  * When the lock is created, no thread should be holding it. Likewise,
  * when the lock is destroyed, no thread should be holding it.
- *
- * The name field is for easier debugging. A copy of the name is
- * (should be) made internally.
  */
 struct lock {
-        char *lk_name;
+        const char *lk_name;
         // add what you need here
          volatile struct thread *lk_holder;
-         struct wchan *lk_wchan;
          struct spinlock lk_spinlock;
         // (don't forget to mark things volatile as needed)
+
+	/*
+	 * Priority inheritance. lk_waiters counts the threads waiting
+	 * for the lock at each priority level, so the holder can be
+	 * given the best of them. See synch.c.
+	 */
+	struct lock *lk_nextheld;	/* Next lock held by lk_holder */
+	unsigned lk_nwaiters;		/* Total threads waiting */
+	unsigned lk_waiters[MLFQ_LEVELS]; /* Threads waiting, by level */
+
+	bool lk_adaptive;		/* Spin before sleeping */
+	bool lk_handoff;		/* Pass straight to next waiter */
+	bool lk_granted;		/* Passed; waiter not yet running */
+#if OPT_LOCKSTAT
+	struct lockstat *lk_stat;
+#endif
 };
 
 struct lock *lock_create(const char *name);
 void lock_acquire(struct lock *);
+void lock_setadaptive(struct lock *, bool adaptive);
+void lock_sethandoff(struct lock *, bool handoff);
 
 /*
  * Operations:
@@ -93,6 +122,26 @@ void lock_acquire(struct lock *);
  *    lock_do_i_hold - Return true if the current thread holds the lock; 
  *                   false otherwise.
  *
+ * While a thread waits for a lock, the holder runs with the waiter's
+ * priority if that is better than its own. This carries through
+ * chains of locks: if the holder is itself waiting for another lock,
+ * that lock's holder gets the priority too.
+ *
+ * Locks are adaptive: if the holder is running on another cpu it is
+ * likely to let go soon, so lock_acquire spins for a while before
+ * going to sleep. It sleeps straight away if the holder isn't
+ * running. lock_setadaptive(lock, false) turns the spinning off for
+ * locks that are held across sleeps or for long stretches.
+ *
+ * By default a released lock is up for grabs: the waiter that gets
+ * woken has to compete for it with any thread that comes along before
+ * it runs, and under heavy contention it usually loses and sleeps
+ * again. lock_sethandoff(lock, true) makes lock_release give the lock
+ * to the longest waiter instead, and makes other threads queue behind
+ * it, so the lock goes round its waiters in FIFO order. That costs
+ * throughput (the lock sits unused until the waiter runs) but no
+ * waiter can be starved.
+ *
  * These operations must be atomic. You get to write them.
  */
 void lock_release(struct lock *);
@@ -110,14 +159,14 @@ void lock_destroy(struct lock *);
  * These CVs are expected to support Mesa semantics, that is, no
  * guarantees are made about scheduling.
  *
- * The name field is for easier debugging. A copy of the name is
- * (should be) made internally.
+ * cv_seq counts signals and broadcasts, and is protected by the lock
+ * used with the CV; see cv_wait.
  */
 
 struct cv {
-        char *cv_name;
+        const char *cv_name;
         // add what you need here
-        struct wchan *cv_wchan;
+        volatile unsigned cv_seq;
         // (don't forget to mark things volatile as needed)
 };
 
@@ -130,18 +179,76 @@ void cv_destroy(struct cv *);
  *                   waking up again, re-acquire the lock.
  *    cv_signal    - Wake up one thread that's sleeping on this CV.
  *    cv_broadcast - Wake up all threads sleeping on this CV.
+ *    cv_timedwait - Like cv_wait, but stop waiting after MS milliseconds
+ *                   and return ETIMEDOUT; returns 0 if woken first.
+ *                   The lock is held again on return either way. A
+ *                   signal that comes as the time runs out goes to
+ *                   another waiter, if any, so callers should recheck
+ *                   their condition whatever this returns.
  *
- * For all three operations, the current thread must hold the lock passed 
+ * For all four operations, the current thread must hold the lock passed 
  * in. Note that under normal circumstances the same lock should be used
  * on all operations with any particular CV.
  *
  * These operations must be atomic. You get to write them. No thank you
  */
 void cv_wait(struct cv *cv, struct lock *lock);
+int cv_timedwait(struct cv *cv, struct lock *lock, unsigned ms);
 void cv_signal(struct cv *cv, struct lock *lock);
 void cv_broadcast(struct cv *cv, struct lock *lock);
 
 
+/*
+ * Reader-writer lock.
+ *
+ * Any number of readers can hold the lock at once, or one writer.
+ * Writers are preferred: once a writer is waiting, new readers wait
+ * too, so a steady stream of readers can't starve writers. It
+ * follows that a thread must not take a read lock it already holds,
+ * since a writer may have come along in between.
+ *
+ * Waiting readers sleep on the address of rw_readers, writers on
+ * that of rw_writer, and an upgrading reader on that of
+ * rw_upgrading.
+ */
+struct rwlock {
+	const char *rw_name;
+	struct spinlock rw_lock;
+	volatile unsigned rw_readers;	/* Readers holding the lock */
+	volatile struct thread *rw_writer; /* Writer holding the lock */
+	unsigned rw_wwaiting;		/* Writers waiting */
+	bool rw_upgrading;		/* A reader is waiting to upgrade */
+};
+
+struct rwlock *rwlock_create(const char *name);
+void rwlock_destroy(struct rwlock *);
+
+/*
+ * Operations:
+ *    rwlock_acquire_read   - Get the lock shared.
+ *    rwlock_release_read   - Give up a shared hold.
+ *    rwlock_acquire_write  - Get the lock exclusive.
+ *    rwlock_release_write  - Give up an exclusive hold.
+ *    rwlock_upgrade        - Turn a shared hold into an exclusive one,
+ *                            waiting for the other readers to leave.
+ *                            Only one reader can be upgrading at a
+ *                            time; if another one is, this returns
+ *                            false at once and the caller still holds
+ *                            the lock shared. Returns true once the
+ *                            caller holds the lock exclusive.
+ *    rwlock_downgrade      - Turn an exclusive hold into a shared one
+ *                            without letting a writer in between.
+ *    rwlock_do_i_hold_write - True if the current thread is the writer.
+ */
+void rwlock_acquire_read(struct rwlock *);
+void rwlock_release_read(struct rwlock *);
+void rwlock_acquire_write(struct rwlock *);
+void rwlock_release_write(struct rwlock *);
+bool rwlock_upgrade(struct rwlock *);
+void rwlock_downgrade(struct rwlock *);
+bool rwlock_do_i_hold_write(struct rwlock *);
+
+
 #endif /* _SYNCH_H_ */
 
 
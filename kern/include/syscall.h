@@ -50,6 +50,9 @@ void enter_forked_process(void *tf, unsigned long dummy);
 void enter_new_process(int argc, userptr_t argv, vaddr_t stackptr,
                        vaddr_t entrypoint);
 
+/* Set up the futex wait table. */
+void futex_bootstrap(void);
+
 
 /*
  * Prototypes for IN-KERNEL entry points for system call implementations.
@@ -57,6 +60,8 @@ void enter_new_process(int argc, userptr_t argv, vaddr_t stackptr,
 
 int sys_reboot(int code);
 int sys___time(userptr_t user_seconds, userptr_t user_nanoseconds);
+int sys___settime(userptr_t user_seconds, userptr_t user_nanoseconds);
+int sys_nanosleep(userptr_t user_req, userptr_t user_rem);
 
 #ifdef UW
 int sys_write(int fdesc,userptr_t ubuf,unsigned int nbytes,int *retval);
@@ -70,4 +75,12 @@ int sys_fork(struct trapframe *tf, pid_t *retval);
 #endif //OPT_A2
 #endif // UW
 
+int sys_sched_setaffinity(pid_t pid, uint32_t mask);
+int sys_sched_settickets(pid_t pid, int tickets);
+int sys_sched_setedf(int period_ms, int budget_ms);
+int sys_sched_setgang(pid_t pid, int on);
+
+int sys_futex_wait(userptr_t uaddr, int val, userptr_t utimeout);
+int sys_futex_wake(userptr_t uaddr, int count, int *retval);
+
 #endif /* _SYSCALL_H_ */
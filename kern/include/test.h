@@ -59,6 +59,37 @@ int threadtest3(int, char **);
 int semtest(int, char **);
 int locktest(int, char **);
 int cvtest(int, char **);
+int timedsemtest(int, char **);
+int timedcvtest(int, char **);
+int rwtest(int, char **);
+int rwbench(int, char **);
+int spinbench(int, char **);
+int lockbench(int, char **);
+int atomicbench(int, char **);
+int seqlocktest(int, char **);
+int workqueuetest(int, char **);
+int callouttest(int, char **);
+int gangbench(int, char **);
+
+/*
+ * Harness for the contention benchmarks (test/bench.c). Forks NTHREADS
+ * threads, starts them together, and stops them after MS milliseconds.
+ * Each runs BODY with its number (0..NTHREADS-1); BODY loops until
+ * *STOP goes true and returns how many iterations it did. If PIN is
+ * set, thread N runs on cpu N throughout. Fills in RES with the total
+ * and the fewest and most iterations any one thread did.
+ */
+#define BENCH_MAXTHREADS	32
+
+struct bench_result {
+	unsigned br_total;
+	unsigned br_min;
+	unsigned br_max;
+};
+
+void bench_run(const char *name, unsigned nthreads, bool pin, unsigned ms,
+	       unsigned (*body)(unsigned long num, volatile bool *stop),
+	       struct bench_result *res);
 
 #ifdef UW
 /* Another thread and synchronization test */
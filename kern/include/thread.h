@@ -39,6 +39,7 @@
 #include <array.h>
 #include <spinlock.h>
 #include <threadlist.h>
+#include <callout.h>
 
 struct cpu;
 
@@ -56,6 +57,43 @@ struct cpu;
 #define SAME_STACK(p1, p2)     (((p1) & STACK_MASK) == ((p2) & STACK_MASK))
 
 
+/*
+ * Scheduler priority levels. The scheduler is a multi-level feedback
+ * queue: level 0 is the highest priority. New threads start at the
+ * top; a thread that uses up its whole quantum is demoted one level,
+ * and a thread that wakes up from a wait channel is promoted one
+ * level. See schedule() in thread.c.
+ */
+#define MLFQ_LEVELS	4
+#define MLFQ_TOPLEVEL	0
+#define MLFQ_BOTTOMLEVEL (MLFQ_LEVELS-1)
+
+/* Value of t_inherited when a thread has inherited no priority. */
+#define PRIO_NONE	MLFQ_LEVELS
+
+/*
+ * Threads with tickets (t_tickets > 0) are scheduled by stride
+ * scheduling instead of the MLFQ, getting cpu time in proportion to
+ * their tickets. See thread.c.
+ */
+#define STRIDE_MAXTICKETS	1000
+
+/*
+ * Earliest-deadline-first threads (t_edfperiod > 0) are guaranteed
+ * t_edfbudget hardclocks of cpu in every period of t_edfperiod
+ * hardclocks, ahead of all other threads. Each EDF thread is bound to
+ * one cpu, and admission control keeps the total reserved on a cpu
+ * to EDF_MAXUTIL parts in EDF_UTILSCALE.
+ */
+#define EDF_UTILSCALE	1000
+#define EDF_MAXUTIL	900
+
+/*
+ * CPU affinity mask meaning "any cpu". Affinity masks have one bit per
+ * cpu, indexed by cpu number (c_number, not the hardware number).
+ */
+#define CPU_AFFINITY_ALL	0xffffffff
+
 /* States a thread can be in. */
 typedef enum {
 	S_RUN,		/* running */
@@ -71,6 +109,7 @@ struct thread {
 	 * debugger is messed up.
 	 */
 	char *t_name;			/* Name of this thread */
+	size_t t_namesize;		/* Size of t_name's buffer */
 	const char *t_wchan_name;	/* Name of wait channel, if sleeping */
 	threadstate_t t_state;		/* State this thread is in */
 
@@ -83,6 +122,53 @@ struct thread {
 	struct switchframe *t_context;	/* Saved register context (on stack) */
 	struct cpu *t_cpu;		/* CPU thread runs on */
 	struct proc *t_proc;		/* Process thread belongs to */
+	unsigned t_priority;		/* MLFQ level (0 is highest) */
+	unsigned t_ticksleft;		/* Hardclocks left in quantum */
+	unsigned t_runlevel;		/* Run queue level, if queued */
+	unsigned t_tickets;		/* Stride tickets; 0 for MLFQ */
+	uint32_t t_pass;		/* Stride pass value */
+	unsigned t_edfperiod;		/* EDF period; 0 if not EDF */
+	unsigned t_edfbudget;		/* EDF budget per period */
+	unsigned t_edfleft;		/* Budget left this period */
+	unsigned t_edfdeadline;		/* End of period, in cpu hardclocks */
+	unsigned t_edfutil;		/* Share reserved, in EDF_UTILSCALE */
+	struct cpu *t_edfcpu;		/* CPU reserved on */
+	uint32_t t_affinity;		/* CPUs thread may run on */
+	struct cpu *t_gangcpu;		/* CPU placed on as a gang thread */
+	struct cpu *t_lastcpu;		/* CPU thread last ran on */
+	unsigned t_lastran;		/* t_lastcpu's c_hardclocks then */
+
+	/*
+	 * Priority inheritance (see synch.c). t_inherited is the best
+	 * priority of any thread waiting, directly or through a chain
+	 * of locks, for a lock this thread holds. All but t_heldlocks
+	 * are protected by the priority inheritance lock; t_heldlocks
+	 * is only used by the thread itself.
+	 */
+	unsigned t_inherited;		/* Inherited MLFQ level */
+	struct lock *t_heldlocks;	/* Locks held, linked by lk_nextheld */
+	struct lock *t_blockedon;	/* Lock being waited for */
+	unsigned t_waitlevel;		/* Level counted in t_blockedon */
+
+	/*
+	 * Sleeping (see wchan.h). t_wchan says which wait channel we
+	 * were last put to sleep on; whoever takes us off it either
+	 * clears it or, for wchan_wakeall, bumps the channel's
+	 * generation past t_wchangen. t_wchankey says what we're
+	 * waiting for there, since a sleep queue is shared by many
+	 * objects. All are protected by that channel's lock.
+	 */
+	struct wchan *t_wchan;		/* Channel slept on */
+	const void *t_wchankey;		/* Object waited for on it */
+	unsigned t_wchangen;		/* Its wc_gen when we slept */
+	struct callout t_timeout;	/* Wakes us if the time runs out */
+	bool t_timedout;		/* Woken by t_timeout */
+
+	/*
+	 * RCU read sections (see rcu.h) entered and not yet left. A
+	 * thread inside one is not preempted and must not sleep.
+	 */
+	unsigned t_rcudepth;
 
 	/*
 	 * Interrupt state fields.
@@ -162,11 +248,77 @@ void thread_yield(void);
  */
 void schedule(void);
 
+/*
+ * Charge the current thread for one hardclock. Returns true if it
+ * should yield, either because its quantum ran out or because a
+ * higher-priority thread is waiting. Called from the timer interrupt.
+ */
+bool thread_quantum_tick(void);
+
 /*
  * Potentially migrate ready threads to other CPUs. Called from the
  * timer interrupt.
  */
 void thread_consider_migration(void);
 
+/*
+ * Priority of thread T for scheduling: its own MLFQ level or the one
+ * it has inherited, whichever is better (lower).
+ *
+ * thread_set_inherited changes T's inherited priority, moving T to
+ * the right run queue if it's waiting to run. Call only with the
+ * priority inheritance lock held; that is, from synch.c.
+ */
+unsigned thread_priority(const struct thread *t);
+void thread_set_inherited(struct thread *t, unsigned level);
+
+/*
+ * Restrict thread T to the cpus in MASK (see CPU_AFFINITY_ALL). Fails
+ * with EINVAL if MASK doesn't name any cpu that exists. Takes effect
+ * the next time T is queued; if T is the current thread and its own
+ * cpu is excluded, it moves at its next context switch, so callers
+ * will usually want to thread_yield() afterwards.
+ */
+int thread_setaffinity(struct thread *t, uint32_t mask);
+
+/*
+ * Put thread T in the stride scheduling class with TICKETS tickets, or
+ * back in the ordinary MLFQ class if TICKETS is 0. Fails with EINVAL
+ * if TICKETS is more than STRIDE_MAXTICKETS. Like thread_setaffinity,
+ * this takes effect the next time T is queued.
+ */
+int thread_settickets(struct thread *t, unsigned tickets);
+
+/*
+ * Make the current thread an EDF thread that needs BUDGET hardclocks
+ * of cpu every PERIOD hardclocks, or an ordinary thread again if
+ * PERIOD is 0. The thread is bound to the first cpu in its affinity
+ * mask (starting from the current one) with enough unreserved
+ * capacity; EBUSY if there isn't one, EINVAL for a bad budget. The
+ * first period starts now. New threads never start out as EDF.
+ *
+ * A period in which an EDF thread wanted to run but didn't get its
+ * budget by the deadline counts as a deadline miss.
+ */
+int thread_setedf(unsigned period, unsigned budget);
+
+/*
+ * Gang scheduling (see thread.c). A process registered with
+ * thread_gang_register takes turns with the other gangs, and with
+ * everything that isn't a gang, at having its threads run together
+ * across the cpus; its threads are placed one per cpu with
+ * thread_setgang. These are called from proc.c; see proc_setgang.
+ * thread_gang_tick passes the turn on and is called from hardclock.
+ */
+void thread_setgang(struct thread *t, struct cpu *c);
+int thread_gang_register(struct proc *p);
+void thread_gang_unregister(struct proc *p);
+void thread_gang_tick(void);
+
+/*
+ * Print scheduler statistics for each CPU. Called from the menu.
+ */
+void thread_printstats(void);
+
 
 #endif /* _THREAD_H_ */
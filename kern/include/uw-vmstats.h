@@ -49,7 +49,7 @@ void _vmstats_init(void);                    /* atomicity must be ensured elsewh
  *   vmstats_inc(VMSTAT_TLB_FAULT);
  *   vmstats_inc(VMSTAT_PAGE_FAULT_ZERO);
  */
-void vmstats_inc(unsigned int index);    /* uses locking */
+void vmstats_inc(unsigned int index);    /* per-cpu, takes no lock */
 void _vmstats_inc(unsigned int index);   /* atomicity must be ensured elsewhere */
 
 /* Print the statistics: assumes that at least vmstats_init has been called */
@@ -71,15 +71,49 @@ void wchan_unlock(struct wchan *wc);
  */
 void wchan_sleep(struct wchan *wc);
 
+/*
+ * Like wchan_sleep, but give up after TICKS hardclocks. Returns 0 if
+ * woken, ETIMEDOUT if the time ran out first.
+ */
+int wchan_timedsleep(struct wchan *wc, unsigned ticks);
+
 /*
  * Wake up one thread, or all threads, sleeping on a wait channel.
- * The queue should not already be locked.
+ * The queue should not already be locked. wchan_wakeone returns
+ * whether there was a thread to wake.
  *
  * The current implementation is FIFO but this is not promised by the
  * interface.
  */
-void wchan_wakeone(struct wchan *wc);
+bool wchan_wakeone(struct wchan *wc);
 void wchan_wakeall(struct wchan *wc);
 
+/*
+ * Sleep queues.
+ *
+ * These work like wait channels, but nothing needs to be created or
+ * destroyed: the channel is named by an address KEY, normally that
+ * of the object being waited for (or of a field in it, if the object
+ * has more than one thing to wait for). The channels live in a fixed
+ * hashed table, so one queue and its lock may be shared by several
+ * objects. Hence, a thread must not hold one sleep queue locked
+ * while it locks another, or while it takes anything else that
+ * might lock one (such as a sleep lock's spinlock).
+ *
+ * NAME is shown as the sleeping thread's wait channel, like the
+ * name given to wchan_create.
+ *
+ * Otherwise the operations are the same as for wait channels:
+ * sleepq_sleep and sleepq_timedsleep must be called with the queue
+ * locked, and unlock it; the wakeups must be called with it
+ * unlocked, and only wake threads waiting for KEY.
+ */
+void sleepq_lock(const void *key);
+void sleepq_unlock(const void *key);
+void sleepq_sleep(const void *key, const char *name);
+int sleepq_timedsleep(const void *key, const char *name, unsigned ticks);
+bool sleepq_wakeone(const void *key);
+void sleepq_wakeall(const void *key);
+
 
 #endif /* _WCHAN_H_ */
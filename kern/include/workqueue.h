@@ -0,0 +1,108 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _WORKQUEUE_H_
+#define _WORKQUEUE_H_
+
+/*
+ * Deferred work.
+ *
+ * Each cpu has a kernel worker thread that runs callbacks queued to
+ * it. This lets interrupt handlers and exit paths push expensive
+ * cleanup out of line instead of doing it on the spot.
+ *
+ * A struct work is normally embedded in whatever object the work is
+ * about, so queueing never needs to allocate and is safe to do from
+ * an interrupt handler. A work item may be queued again once its
+ * function has started running, but not before; queueing an item
+ * that is already pending does nothing and returns false. The
+ * pending check is made under the target cpu's queue lock, so
+ * callers that might queue the same item on two different cpus at
+ * once must serialize among themselves.
+ *
+ * The worker takes everything queued on its cpu in one go and runs
+ * the whole batch before looking again, and it is only woken when
+ * its queue goes from empty to nonempty, so work queued in bursts
+ * costs one wakeup per burst rather than one per item.
+ *
+ * Work functions run in thread context on the cpu they were queued
+ * on and may sleep, but a sleeping item holds up the rest of that
+ * cpu's queue.
+ */
+
+struct cpu;
+
+struct work {
+	void (*w_func)(void *data1, unsigned long data2);
+	void *w_data1;
+	unsigned long w_data2;
+	struct work *w_next;		/* Link on the pending list */
+	bool w_pending;			/* On a pending list */
+	bool w_kmalloced;		/* Free after running */
+};
+
+/*
+ * Call once during boot, after all cpus are running, to start the
+ * workers. Work queued before then is run immediately by the caller.
+ */
+void workqueue_bootstrap(void);
+
+/*
+ * Set up a work item to call FUNC(DATA1, DATA2).
+ */
+void work_init(struct work *w,
+	       void (*func)(void *data1, unsigned long data2),
+	       void *data1, unsigned long data2);
+
+/*
+ * Queue a work item on the current cpu, or on cpu C.
+ */
+bool work_queue(struct work *w);
+bool work_queue_on(struct cpu *c, struct work *w);
+
+/*
+ * Allocate a one-shot work item, queue it on the current cpu, and
+ * free it after it runs. Not for use in interrupt handlers. If
+ * memory is short, FUNC is simply called directly.
+ */
+void work_defer(void (*func)(void *data1, unsigned long data2),
+		void *data1, unsigned long data2);
+
+/*
+ * Wait until everything queued on any cpu before the call has run.
+ * Must not be called from a work function.
+ */
+void workqueue_flush(void);
+
+/*
+ * Print per-cpu counts of work items and batches run.
+ */
+void workqueue_printstats(void);
+
+#endif /* _WORKQUEUE_H_ */
@@ -43,8 +43,10 @@
  */
 
 #include <types.h>
+#include <kern/errno.h>
 #include <proc.h>
 #include <current.h>
+#include <cpu.h>
 #include <addrspace.h>
 #include <vnode.h>
 #include <vfs.h>
@@ -53,6 +55,8 @@
 #include "opt-A2.h"
 #include <array.h>
 #include <limits.h>
+#include <rcu.h>
+#include <atomic.h>
 
 bool procdebug=true;
 
@@ -66,17 +70,21 @@ struct proc *kproc;
  */
 #ifdef UW
 /* count of the number of processes, excluding kproc */
-static unsigned int proc_count;
-/* provides mutual exclusion for proc_count */
-/* it would be better to use a lock here, but we use a semaphore because locks are not implemented in the base kernel */
-static struct semaphore *proc_count_mutex;
+/* updated with atomic operations, so it needs no lock */
+static volatile unsigned int proc_count;
 /* used to signal the kernel menu thread when there are no processes */
 struct semaphore *no_proc_sem;
 #endif  // UW
 
 #if OPT_A2
+/*
+ * proctable is searched locklessly inside RCU read sections; slots
+ * are only added under proctable_lock and procs are freed after a
+ * grace period (see proc_free).
+ */
 static int proctable_size;
 static int proctable_cap;
+static struct spinlock proctable_lock = SPINLOCK_INITIALIZER;
 
 /* Getters and Setters to proc_count */
 unsigned int proc_count_get(void)
@@ -91,7 +99,7 @@ struct proc **get_proctable(void)
 }
 
 int get_array_size(void){
-    return proctable_size;
+    return rcu_deref(proctable_size);
 }
 
 #endif //OPT_A2
@@ -118,6 +126,8 @@ proc_create(const char *name)
     
 	threadarray_init(&proc->p_threads);
 	spinlock_init(&proc->p_lock);
+	proc->p_gang = false;
+	proc->p_gangnext = 0;
     
 	/* VM fields */
 	proc->p_addrspace = NULL;
@@ -130,12 +140,6 @@ proc_create(const char *name)
 #if OPT_A2
     proc->alive=true;
     proc->exit_status = 0;
-    
-    proctable[proctable_size] = proc;
-    
-    //asign pid to proc, pid = index+1, pid starts at 1
-    proctable_size++;
-    proc->currpid =proctable_size;
     //set parpid =0 as default
     proc->parpid =0;
     
@@ -144,6 +148,18 @@ proc_create(const char *name)
     KASSERT(proc->waitpid_cv != NULL);
     KASSERT(proc->waitpid_lk != NULL);
     
+    /*
+     * Publish the proc only once it's fully set up, since lookups
+     * don't take any lock.
+     */
+    spinlock_acquire(&proctable_lock);
+    KASSERT(proctable_size < proctable_cap);
+    //asign pid to proc, pid = index+1, pid starts at 1
+    proc->currpid = proctable_size + 1;
+    rcu_assign(proctable[proctable_size], proc);
+    rcu_assign(proctable_size, proctable_size + 1);
+    spinlock_release(&proctable_lock);
+    
     
 #endif //OPT_A2
 #endif // UW
@@ -157,6 +173,10 @@ proc_create(const char *name)
 void
 proc_destroy(struct proc *proc)
 {
+#ifdef UW
+	unsigned count;
+#endif
+
 	/*
      * note: some parts of the process structure, such as the address space,
      *  are destroyed in sys_exit, before we get here
@@ -168,6 +188,10 @@ proc_destroy(struct proc *proc)
     
 	KASSERT(proc != NULL);
 	KASSERT(proc != kproc);
+
+	if (proc->p_gang) {
+		thread_gang_unregister(proc);
+	}
     
 	/*
 	 * We don't take p_lock in here because we must have the only
@@ -220,19 +244,44 @@ proc_destroy(struct proc *proc)
     /* note: kproc is not included in the process count, but proc_destroy
      is never called on kproc (see KASSERT above), so we're OK to decrement
      the proc_count unconditionally here */
-	P(proc_count_mutex);
-	KASSERT(proc_count > 0);
-	proc_count--;
+	count = atomic_dec(&proc_count);
+	KASSERT(count != (unsigned)-1);
 	/* signal the kernel menu thread if the process count has reached zero */
-	if (proc_count == 0) {
+	if (count == 0) {
         V(no_proc_sem);
 	}
-	V(proc_count_mutex);
 #endif // UW
 	
     
 }
 
+#if OPT_A2
+static
+void
+proc_free_rcu(struct rcu_head *rh)
+{
+	/* p_rcu is the first member of struct proc */
+	kfree((struct proc *)rh);
+}
+
+/*
+ * Take a destroyed proc out of proctable and free it. Lockless
+ * lookups may still be looking at it, so the memory is only given
+ * back once they've all finished.
+ */
+void
+proc_free(struct proc *proc)
+{
+	int slot = proc->currpid - 1;
+
+	KASSERT(slot >= 0 && slot < proctable_size);
+	KASSERT(proctable[slot] == proc);
+
+	rcu_assign(proctable[slot], NULL);
+	call_rcu(&proc->p_rcu, proc_free_rcu);
+}
+#endif //OPT_A2
+
 /*
  * Create the process structure for the kernel.
  */
@@ -250,10 +299,6 @@ proc_bootstrap(void)
         panic("proc_create for kproc failed\n");
     }
 #ifdef UW
-    proc_count_mutex = sem_create("proc_count_mutex",1);
-    if (proc_count_mutex == NULL) {
-        panic("could not create proc_count_mutex semaphore\n");
-    }
     no_proc_sem = sem_create("no_proc_sem",0);
     if (no_proc_sem == NULL) {
         panic("could not create no_proc_sem semaphore\n");
@@ -317,14 +362,24 @@ proc_create_runprogram(const char *name)
 	/* increment the count of processes */
     /* we are assuming that all procs, including those created by fork(),
      are created using a call to proc_create_runprogram  */
-	P(proc_count_mutex);
-	proc_count++;
-	V(proc_count_mutex);
+	atomic_inc(&proc_count);
 #endif // UW
     
 	return proc;
 }
 
+/*
+ * Place a thread of a gang process on the next cpu in turn, so the
+ * gang's threads are spread one per cpu. Call with p_lock held.
+ */
+static
+void
+proc_gangplace(struct proc *proc, struct thread *t)
+{
+	thread_setgang(t, cpu_get(proc->p_gangnext));
+	proc->p_gangnext = (proc->p_gangnext + 1) % cpu_count();
+}
+
 /*
  * Add a thread to a process. Either the thread or the process might
  * or might not be current.
@@ -338,6 +393,9 @@ proc_addthread(struct proc *proc, struct thread *t)
     
 	spinlock_acquire(&proc->p_lock);
 	result = threadarray_add(&proc->p_threads, t, NULL);
+	if (result == 0 && proc->p_gang) {
+		proc_gangplace(proc, t);
+	}
 	spinlock_release(&proc->p_lock);
 	if (result) {
 		return result;
@@ -375,6 +433,106 @@ proc_remthread(struct thread *t)
 	panic("Thread (%p) has escaped from its process (%p)\n", t, proc);
 }
 
+/*
+ * Set the cpu affinity of every thread in a process. Either the
+ * process or the threads might or might not be current.
+ */
+int
+proc_setaffinity(struct proc *proc, uint32_t mask)
+{
+	unsigned i, num;
+	int result;
+
+	spinlock_acquire(&proc->p_lock);
+	num = threadarray_num(&proc->p_threads);
+	if (num == 0) {
+		spinlock_release(&proc->p_lock);
+		return ESRCH;
+	}
+	for (i=0; i<num; i++) {
+		result = thread_setaffinity(threadarray_get(&proc->p_threads, i),
+					    mask);
+		if (result) {
+			/* Same mask for all threads, so fails on the first */
+			KASSERT(i == 0);
+			spinlock_release(&proc->p_lock);
+			return result;
+		}
+	}
+	spinlock_release(&proc->p_lock);
+	return 0;
+}
+
+/*
+ * Set the stride tickets of every thread in a process.
+ */
+int
+proc_settickets(struct proc *proc, unsigned tickets)
+{
+	unsigned i, num;
+	int result;
+
+	spinlock_acquire(&proc->p_lock);
+	num = threadarray_num(&proc->p_threads);
+	if (num == 0) {
+		spinlock_release(&proc->p_lock);
+		return ESRCH;
+	}
+	for (i=0; i<num; i++) {
+		result = thread_settickets(threadarray_get(&proc->p_threads, i),
+					   tickets);
+		if (result) {
+			/* Same for all threads, so fails on the first */
+			KASSERT(i == 0);
+			spinlock_release(&proc->p_lock);
+			return result;
+		}
+	}
+	spinlock_release(&proc->p_lock);
+	return 0;
+}
+
+/*
+ * Turn gang scheduling on or off for a process. Either the process or
+ * its threads might or might not be current.
+ */
+int
+proc_setgang(struct proc *proc, bool on)
+{
+	unsigned i, num;
+	int result;
+
+	KASSERT(proc != kproc);
+
+	if (on) {
+		result = thread_gang_register(proc);
+		if (result) {
+			return result;
+		}
+	}
+
+	spinlock_acquire(&proc->p_lock);
+	proc->p_gang = on;
+	proc->p_gangnext = 0;
+	num = threadarray_num(&proc->p_threads);
+	for (i=0; i<num; i++) {
+		if (on) {
+			proc_gangplace(proc,
+				       threadarray_get(&proc->p_threads, i));
+		}
+		else {
+			thread_setgang(threadarray_get(&proc->p_threads, i),
+				       NULL);
+		}
+	}
+	spinlock_release(&proc->p_lock);
+
+	if (!on) {
+		thread_gang_unregister(proc);
+	}
+	return 0;
+}
+
 /*
  * Fetch the address space of the current process. Caution: it isn't
  * refcounted. If you implement multithreaded processes, make sure to
@@ -48,6 +48,9 @@
 #include <device.h>
 #include <syscall.h>
 #include <test.h>
+#include <workqueue.h>
+#include <lockstat.h>
+#include <rcu.h>
 #include <version.h>
 #include "autoconf.h"  // for pseudoconfig
 
@@ -109,6 +112,7 @@ boot(void)
 	ram_bootstrap();
 	proc_bootstrap();
 	thread_bootstrap();
+	rcu_bootstrap();
 	hardclock_bootstrap();
 	vfs_bootstrap();
 
@@ -117,6 +121,10 @@ boot(void)
 	KASSERT(curthread->t_curspl > 0);
 	mainbus_bootstrap();
 	KASSERT(curthread->t_curspl == 0);
+#if OPT_LOCKSTAT
+	/* The clock is there now, so waits can be timed */
+	lockstat_bootstrap();
+#endif
 	/* Now do pseudo-devices. */
 	pseudoconfig();
 	kprintf("\n");
@@ -125,6 +133,8 @@ boot(void)
 	vm_bootstrap();
 	kprintf_bootstrap();
 	thread_start_cpus();
+	workqueue_bootstrap();
+	futex_bootstrap();
 
 	/* Default bootfs - but ignore failure, in case emu0 doesn't exist */
 	vfs_setbootfs("emu0");
@@ -42,6 +42,9 @@
 #include <sfs.h>
 #include <syscall.h>
 #include <test.h>
+#include <workqueue.h>
+#include <lockstat.h>
+#include <rcu.h>
 #include "opt-synchprobs.h"
 #include "opt-sfs.h"
 #include "opt-net.h"
@@ -412,6 +415,54 @@ cmd_kheapstats(int nargs, char **args)
 	return 0;
 }
 
+static
+int
+cmd_threadstats(int nargs, char **args)
+{
+	(void)nargs;
+	(void)args;
+
+	thread_printstats();
+	workqueue_printstats();
+	rcu_printstats();
+
+	return 0;
+}
+
+#if OPT_LOCKSTAT
+/*
+ * Command for printing lock contention stats: "lockstat [n]" prints
+ * the n most waited-for locks, "lockstat reset" zeroes the counts.
+ */
+static
+int
+cmd_lockstat(int nargs, char **args)
+{
+	int topn;
+
+	if (nargs > 2) {
+		kprintf("Usage: lockstat [count | reset]\n");
+		return EINVAL;
+	}
+	if (nargs == 2 && !strcmp(args[1], "reset")) {
+		lockstat_reset();
+		return 0;
+	}
+
+	topn = 10;
+	if (nargs == 2) {
+		topn = atoi(args[1]);
+		if (topn <= 0) {
+			kprintf("Usage: lockstat [count | reset]\n");
+			return EINVAL;
+		}
+	}
+	lockstat_print(topn);
+
+	return 0;
+}
+#endif
+
 ////////////////////////////////////////
 //
 // Menus.
@@ -476,12 +527,23 @@ static const char *testmenu[] = {
 	"[tt1] Thread test 1                 ",
 	"[tt2] Thread test 2                 ",
 	"[tt3] Thread test 3                 ",
+	"[wq1] Workqueue test                ",
+	"[co1] Callout test                  ",
+	"[gang] Gang scheduling benchmark    ",
 #if OPT_NET
 	"[net] Network test                  ",
 #endif
 	"[sy1] Semaphore test                ",
 	"[sy2] Lock test             (1)     ",
 	"[sy3] CV test               (1)     ",
+	"[sy4] Timed semaphore test          ",
+	"[sy5] Timed CV test                 ",
+	"[rw1] Rwlock test                   ",
+	"[rw2] Rwlock benchmark              ",
+	"[spb] Spinlock benchmark            ",
+	"[lkb] Lock handoff benchmark        ",
+	"[atb] Atomic counter benchmark      ",
+	"[sq1] Seqlock test                  ",
 #ifdef UW
 	"[uw1] UW lock test          (1)     ",
 	"[uw2] UW vmstats test       (3)     ",
@@ -521,6 +583,10 @@ static const char *mainmenu[] = {
 #endif /* UW */
 #endif
 	"[kh] Kernel heap stats              ",
+	"[ts] Thread system stats            ",
+#if OPT_LOCKSTAT
+	"[lockstat] Lock contention stats    ",
+#endif
 	"[q] Quit and shut down              ",
 	NULL
 };
@@ -577,6 +643,10 @@ static struct {
 
 	/* stats */
 	{ "kh",         cmd_kheapstats },
+	{ "ts",		cmd_threadstats },
+#if OPT_LOCKSTAT
+	{ "lockstat",	cmd_lockstat },
+#endif
 
 	/* base system tests */
 	{ "at",		arraytest },
@@ -589,11 +659,22 @@ static struct {
 	{ "tt1",	threadtest },
 	{ "tt2",	threadtest2 },
 	{ "tt3",	threadtest3 },
+	{ "wq1",	workqueuetest },
+	{ "co1",	callouttest },
+	{ "gang",	gangbench },
 	{ "sy1",	semtest },
 
 	/* synchronization assignment tests */
 	{ "sy2",	locktest },
 	{ "sy3",	cvtest },
+	{ "sy4",	timedsemtest },
+	{ "sy5",	timedcvtest },
+	{ "rw1",	rwtest },
+	{ "rw2",	rwbench },
+	{ "spb",	spinbench },
+	{ "lkb",	lockbench },
+	{ "atb",	atomicbench },
+	{ "sq1",	seqlocktest },
 #ifdef UW
 	{ "uw1",	uwlocktest1 },
 	{ "uw2",	uwvmstatstest },
@@ -0,0 +1,322 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Futexes: sleeping and waking on a word of user memory.
+ *
+ * A user-level lock or condition variable keeps its state in an int
+ * and only calls in here when it has to block or has somebody to
+ * wake, so the uncontended cases never trap.
+ *
+ * futex_wait(addr, val, timeout) sleeps until woken by futex_wake on
+ * the same address, but only if *addr still holds VAL once we're
+ * ready to sleep; otherwise it fails with EAGAIN at once. Anybody
+ * about to wake waiters changes the word before calling futex_wake,
+ * and the check and the going to sleep are atomic with respect to
+ * futex_wake, so a wakeup can't fall between them. futex_wake(addr,
+ * count) wakes up to COUNT waiters and returns how many it woke.
+ *
+ * Waiters are keyed by address space and user virtual address. Keys
+ * hash into a fixed table of buckets. Each bucket has a sleep lock,
+ * held across the check of the user word (which may fault), and a
+ * list of queues, one per key that has waiters, each with its own
+ * wait channel so that waking one waiter wakes the right one. Queues
+ * that fall idle stay on the bucket and are reused for the next key
+ * that needs one.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/time.h>
+#include <lib.h>
+#include <clock.h>
+#include <copyinout.h>
+#include <proc.h>
+#include <synch.h>
+#include <wchan.h>
+#include <syscall.h>
+
+#define FUTEX_NBUCKETS	32	/* must be a power of 2 */
+
+/* Longest timeout honored, in milliseconds; longer ones are cut to it. */
+#define FUTEX_MAXTIMEOUT_MS	(1000 * 1000 * 1000)
+
+struct futex_queue {
+	struct futex_queue *fq_next;	/* Link on bucket */
+	struct addrspace *fq_as;	/* Key: address space */
+	vaddr_t fq_addr;		/* Key: user address */
+	unsigned fq_refs;		/* Threads waiting or about to */
+	struct wchan *fq_wchan;		/* Where they wait */
+};
+
+struct futex_bucket {
+	struct lock *fb_lock;
+	struct futex_queue *fb_queues;
+};
+
+static struct futex_bucket futex_table[FUTEX_NBUCKETS];
+
+/*
+ * Set up the bucket locks.
+ */
+void
+futex_bootstrap(void)
+{
+	unsigned i;
+
+	for (i=0; i<FUTEX_NBUCKETS; i++) {
+		futex_table[i].fb_lock = lock_create("futex");
+		if (futex_table[i].fb_lock == NULL) {
+			panic("futex_bootstrap: Out of memory\n");
+		}
+		futex_table[i].fb_queues = NULL;
+	}
+}
+
+/*
+ * Pick the bucket for a key. Words are aligned, so the low two bits
+ * of the address say nothing.
+ */
+static
+struct futex_bucket *
+futex_hash(struct addrspace *as, vaddr_t addr)
+{
+	unsigned h;
+
+	h = (addr >> 2) ^ ((uintptr_t)as >> 4);
+	h ^= h >> 11;
+	return &futex_table[h & (FUTEX_NBUCKETS - 1)];
+}
+
+/*
+ * Find the queue for a key in a bucket, whose lock must be held.
+ * If CREATE is set and there isn't one, take over an idle queue or
+ * make a new one; this can fail for lack of memory. The caller gets
+ * a reference to the queue if it asked to create one.
+ */
+static
+struct futex_queue *
+futex_getqueue(struct futex_bucket *fb, struct addrspace *as,
+	       vaddr_t addr, bool create)
+{
+	struct futex_queue *fq, *idle;
+
+	KASSERT(lock_do_i_hold(fb->fb_lock));
+
+	idle = NULL;
+	for (fq = fb->fb_queues; fq != NULL; fq = fq->fq_next) {
+		if (fq->fq_refs == 0) {
+			idle = fq;
+		}
+		else if (fq->fq_as == as && fq->fq_addr == addr) {
+			break;
+		}
+	}
+	if (!create) {
+		return fq;
+	}
+
+	if (fq == NULL) {
+		fq = idle;
+	}
+	if (fq == NULL) {
+		fq = kmalloc(sizeof(*fq));
+		if (fq == NULL) {
+			return NULL;
+		}
+		fq->fq_wchan = wchan_create("futex");
+		if (fq->fq_wchan == NULL) {
+			kfree(fq);
+			return NULL;
+		}
+		fq->fq_refs = 0;
+		fq->fq_next = fb->fb_queues;
+		fb->fb_queues = fq;
+	}
+	if (fq->fq_refs == 0) {
+		fq->fq_as = as;
+		fq->fq_addr = addr;
+	}
+	fq->fq_refs++;
+	return fq;
+}
+
+/*
+ * Check a user address and get the bucket for it.
+ */
+static
+int
+futex_lookup(userptr_t uaddr, struct addrspace **as_ret,
+	     struct futex_bucket **fb_ret)
+{
+	vaddr_t addr = (vaddr_t)uaddr;
+	struct addrspace *as;
+
+	if (addr % sizeof(int) != 0) {
+		return EINVAL;
+	}
+	as = curproc_getas();
+	if (as == NULL) {
+		return EFAULT;
+	}
+	*as_ret = as;
+	*fb_ret = futex_hash(as, addr);
+	return 0;
+}
+
+/*
+ * Convert a user timeout to hardclocks, rounding up like nanosleep
+ * and counting the partial current hardclock as nothing.
+ */
+static
+int
+futex_getticks(userptr_t utimeout, unsigned *ticks)
+{
+	struct timespec ts;
+	unsigned ms;
+	int result;
+
+	result = copyin(utimeout, &ts, sizeof(ts));
+	if (result) {
+		return result;
+	}
+	if (ts.tv_sec < 0 || ts.tv_nsec < 0 || ts.tv_nsec >= 1000000000) {
+		return EINVAL;
+	}
+	if (ts.tv_sec >= FUTEX_MAXTIMEOUT_MS / 1000) {
+		ms = FUTEX_MAXTIMEOUT_MS;
+	}
+	else {
+		ms = (unsigned)ts.tv_sec * 1000 +
+			DIVROUNDUP((unsigned)ts.tv_nsec, 1000000);
+	}
+	*ticks = (ms == 0) ? 0 : mstohardclocks(ms) + 1;
+	return 0;
+}
+
+/*
+ * futex_wait: sleep on UADDR if it holds VAL, for at most the time
+ * in UTIMEOUT if that isn't NULL.
+ */
+int
+sys_futex_wait(userptr_t uaddr, int val, userptr_t utimeout)
+{
+	struct addrspace *as;
+	struct futex_bucket *fb;
+	struct futex_queue *fq;
+	unsigned ticks = 0;
+	int cur;
+	int result;
+
+	result = futex_lookup(uaddr, &as, &fb);
+	if (result) {
+		return result;
+	}
+	if (utimeout != NULL) {
+		result = futex_getticks(utimeout, &ticks);
+		if (result) {
+			return result;
+		}
+	}
+
+	lock_acquire(fb->fb_lock);
+
+	result = copyin(uaddr, &cur, sizeof(cur));
+	if (result) {
+		lock_release(fb->fb_lock);
+		return result;
+	}
+	if (cur != val) {
+		lock_release(fb->fb_lock);
+		return EAGAIN;
+	}
+	if (utimeout != NULL && ticks == 0) {
+		lock_release(fb->fb_lock);
+		return ETIMEDOUT;
+	}
+
+	fq = futex_getqueue(fb, as, (vaddr_t)uaddr, true);
+	if (fq == NULL) {
+		lock_release(fb->fb_lock);
+		return ENOMEM;
+	}
+
+	/* Get on the channel before futex_wake can get the bucket. */
+	wchan_lock(fq->fq_wchan);
+	lock_release(fb->fb_lock);
+	if (utimeout != NULL) {
+		result = wchan_timedsleep(fq->fq_wchan, ticks);
+	}
+	else {
+		wchan_sleep(fq->fq_wchan);
+		result = 0;
+	}
+
+	lock_acquire(fb->fb_lock);
+	KASSERT(fq->fq_refs > 0);
+	fq->fq_refs--;
+	lock_release(fb->fb_lock);
+
+	return result;
+}
+
+/*
+ * futex_wake: wake up to COUNT threads waiting on UADDR, and return
+ * how many there were.
+ */
+int
+sys_futex_wake(userptr_t uaddr, int count, int *retval)
+{
+	struct addrspace *as;
+	struct futex_bucket *fb;
+	struct futex_queue *fq;
+	int woken;
+	int result;
+
+	result = futex_lookup(uaddr, &as, &fb);
+	if (result) {
+		return result;
+	}
+	if (count < 0) {
+		return EINVAL;
+	}
+
+	woken = 0;
+	lock_acquire(fb->fb_lock);
+	fq = futex_getqueue(fb, as, (vaddr_t)uaddr, false);
+	if (fq != NULL) {
+		while (woken < count && wchan_wakeone(fq->fq_wchan)) {
+			woken++;
+		}
+	}
+	lock_release(fb->fb_lock);
+
+	*retval = woken;
+	return 0;
+}
@@ -16,6 +16,20 @@
 #include <synch.h>
 #include <vfs.h>
 #include <kern/fcntl.h>
+#include <workqueue.h>
+#include <rcu.h>
+
+/*
+ * Tearing down an address space can take a while; the exiting
+ * process doesn't need to wait for it, so hand it to a worker.
+ */
+static
+void
+exit_as_destroy(void *as, unsigned long unused)
+{
+    (void)unused;
+    as_destroy(as);
+}
 
 /* this implementation of sys__exit does not do anything with the exit code */
 /* this needs to be fixed to get exit() and waitpid() working properly */
@@ -39,7 +53,16 @@ void sys__exit(int exitcode) {
     
     DEBUG(DB_SYSCALL,"Syscall: _exit(%d)\n",exitcode);
     
-    if (p->parpid == 0 || !(proctable[p->parpid-1]->alive)) {
+    //a parent that has already been freed counts as dead
+    rcu_read_lock();
+    struct proc *parent = NULL;
+    if (p->parpid != 0) {
+        parent = rcu_deref(proctable[p->parpid-1]);
+    }
+    bool orphan = (parent == NULL || !parent->alive);
+    rcu_read_unlock();
+    
+    if (orphan) {
         KASSERT(curproc->p_addrspace != NULL);
         as_deactivate();
         /*
@@ -50,7 +73,7 @@ void sys__exit(int exitcode) {
          * messily fatal.
          */
         as = curproc_setas(NULL);
-        as_destroy(as);
+        work_defer(exit_as_destroy, as, 0);
         
         /* detach this thread from its process */
         /* note: curproc cannot be used after this call */
@@ -58,19 +81,21 @@ void sys__exit(int exitcode) {
         
         
         //set all the childrean of this poc to dead
+        rcu_read_lock();
         for (int i=0; i<get_array_size(); i++) {
             //find child with the dead parent
-            struct proc *tmpchild = proctable[i];
-            if (tmpchild->parpid == p->currpid) {
+            struct proc *tmpchild = rcu_deref(proctable[i]);
+            if (tmpchild != NULL && tmpchild->parpid == p->currpid) {
                 tmpchild->parpid=0;
             }
         }
+        rcu_read_unlock();
         
         /* if this is the last user process in the system, proc_destroy()
          will wake up the kernel menu thread */
         proc_destroy(p);
         
-        kfree(p);
+        proc_free(p);
     }
     else{
         KASSERT(curproc->p_addrspace != NULL);
@@ -84,7 +109,7 @@ void sys__exit(int exitcode) {
          * messily fatal.
          */
         as = curproc_setas(NULL);
-        as_destroy(as);
+        work_defer(exit_as_destroy, as, 0);
         
         /* detach this thread from its process */
         /* note: curproc cannot be used after this call */
@@ -379,15 +404,26 @@ sys_waitpid(pid_t pid,
     else if (status == NULL){
         return(EFAULT);
     }
-    else if (pid > proctable_size){
+    else if (pid < 1 || pid > proctable_size){
         *retval = 0;
         return(ESRCH);
     }
     
+    /*
+     * The slot may be emptied and the proc freed under us unless it's
+     * our own child, so look at it only inside a read section.
+     */
+    rcu_read_lock();
+    struct proc *child = rcu_deref(proctable[pid-1]);
+    if (child == NULL) {
+        rcu_read_unlock();
+        *retval = 0;
+        return(ESRCH);
+    }
     //check for proc that already exited
-    struct proc *child = proctable[pid-1];
     if (!(child->alive) || child->parpid ==0){ //YOLO
         exitstatus = child->exit_status;
+        rcu_read_unlock();
         exitstatus = _MKWAIT_EXIT(exitstatus);
         copyout((void *)&exitstatus,status,sizeof(int));
         *retval = pid;
@@ -399,6 +435,7 @@ sys_waitpid(pid_t pid,
     }
     // make sure caller is parent
     else if (p->currpid != child->parpid) {
+        rcu_read_unlock();
         // caller is not parent
         *retval = 0;
         //kprintf("caller is not parent currpid: %d, child parent: %d\n", p->currpid ,child->parpid);
@@ -409,6 +446,8 @@ sys_waitpid(pid_t pid,
     }
     // assumptions correct, proceed
     else {
+        //our child is only freed by us, so it stays put from here on
+        rcu_read_unlock();
         //kprintf("waitpid tries to acq lock\n");
         lock_acquire(child->waitpid_lk);
         //kprintf("waitpid : acquired\n");
@@ -423,18 +462,20 @@ sys_waitpid(pid_t pid,
         lock_release(child->waitpid_lk);
         
         //do it here as well before kfree
+        rcu_read_lock();
         for (int i=0; i<get_array_size(); i++) {
             //find child with the dead parent
-            struct proc *tmpchild = proctable[i];
-            if (tmpchild->parpid == p->currpid) {
+            struct proc *tmpchild = rcu_deref(proctable[i]);
+            if (tmpchild != NULL && tmpchild->parpid == p->currpid) {
                 tmpchild->parpid=0;
             }
         }
+        rcu_read_unlock();
         
         //try thread deatch??
         
         
-        kfree(child);
+        proc_free(child);
         return(0);
     }
     
@@ -0,0 +1,182 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <current.h>
+#include <proc.h>
+#include <thread.h>
+#include <clock.h>
+#include <rcu.h>
+#include <syscall.h>
+#include "opt-A2.h"
+
+/*
+ * Scheduling-related system calls.
+ */
+
+/* Longest EDF period accepted, in milliseconds. */
+#define EDF_MAXPERIOD_MS	100000
+
+/*
+ * Look up a process by pid for the calls below. Pid 0 means the
+ * calling process. Must be called in an RCU read section, and the
+ * result is only good until the end of it.
+ */
+static
+int
+sched_getproc(pid_t pid, struct proc **ret)
+{
+	if (pid == 0) {
+		*ret = curproc;
+		return 0;
+	}
+#if OPT_A2
+	if (pid < 0 || pid > get_array_size()) {
+		return ESRCH;
+	}
+	*ret = rcu_deref(proctable[pid-1]);
+	if (*ret == NULL || !(*ret)->alive) {
+		return ESRCH;
+	}
+	return 0;
+#else
+	/* No process table; only the caller can be named. */
+	return ESRCH;
+#endif
+}
+
+/*
+ * sched_setaffinity: restrict the threads of process PID to the cpus
+ * whose bits are set in MASK.
+ */
+int
+sys_sched_setaffinity(pid_t pid, uint32_t mask)
+{
+	struct proc *p;
+	int result;
+
+	rcu_read_lock();
+	result = sched_getproc(pid, &p);
+	if (result == 0) {
+		result = proc_setaffinity(p, mask);
+	}
+	rcu_read_unlock();
+	if (result) {
+		return result;
+	}
+
+	/* Move off this cpu right away if we're no longer allowed on it. */
+	thread_yield();
+	return 0;
+}
+
+/*
+ * sched_settickets: put process PID in the stride scheduling class
+ * with TICKETS tickets, or back in the default class if TICKETS is 0.
+ */
+int
+sys_sched_settickets(pid_t pid, int tickets)
+{
+	struct proc *p;
+	int result;
+
+	if (tickets < 0) {
+		return EINVAL;
+	}
+
+	rcu_read_lock();
+	result = sched_getproc(pid, &p);
+	if (result == 0) {
+		result = proc_settickets(p, tickets);
+	}
+	rcu_read_unlock();
+	if (result) {
+		return result;
+	}
+
+	/* Requeue ourselves under the new class. */
+	thread_yield();
+	return 0;
+}
+
+/*
+ * sched_setedf: make the calling thread an EDF thread that needs
+ * BUDGET_MS milliseconds of cpu every PERIOD_MS milliseconds, or an
+ * ordinary thread again if PERIOD_MS is 0. Times are rounded up to
+ * whole hardclocks.
+ */
+int
+sys_sched_setedf(int period_ms, int budget_ms)
+{
+	unsigned period, budget;
+	int result;
+
+	if (period_ms < 0 || budget_ms < 0 ||
+	    period_ms > EDF_MAXPERIOD_MS || budget_ms > period_ms) {
+		return EINVAL;
+	}
+	period = DIVROUNDUP((unsigned)period_ms * HZ, 1000);
+	budget = DIVROUNDUP((unsigned)budget_ms * HZ, 1000);
+
+	result = thread_setedf(period, budget);
+	if (result) {
+		return result;
+	}
+
+	/* Get onto our reserved cpu, under the new class. */
+	thread_yield();
+	return 0;
+}
+
+/*
+ * sched_setgang: turn gang scheduling of process PID's threads on
+ * (ON nonzero) or off.
+ */
+int
+sys_sched_setgang(pid_t pid, int on)
+{
+	struct proc *p;
+	int result;
+
+	rcu_read_lock();
+	result = sched_getproc(pid, &p);
+	if (result == 0) {
+		result = proc_setgang(p, on != 0);
+	}
+	rcu_read_unlock();
+	if (result) {
+		return result;
+	}
+
+	/* Get over to our assigned cpu. */
+	thread_yield();
+	return 0;
+}
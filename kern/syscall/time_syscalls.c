@@ -28,6 +28,9 @@
  */
 
 #include <types.h>
+#include <kern/errno.h>
+#include <kern/time.h>
+#include <lib.h>
 #include <clock.h>
 #include <copyinout.h>
 #include <syscall.h>
@@ -42,7 +45,7 @@ sys___time(userptr_t user_seconds_ptr, userptr_t user_nanoseconds_ptr)
 	uint32_t nanoseconds;
 	int result;
 
-	gettime(&seconds, &nanoseconds);
+	getwalltime(&seconds, &nanoseconds);
 
 	result = copyout(&seconds, user_seconds_ptr, sizeof(time_t));
 	if (result) {
@@ -56,3 +59,73 @@ sys___time(userptr_t user_seconds_ptr, userptr_t user_nanoseconds_ptr)
 
 	return 0;
 }
+
+/*
+ * Set the time of day. The hardware clock itself is left alone, so
+ * this doesn't disturb anything timing intervals with gettime().
+ */
+int
+sys___settime(userptr_t user_seconds_ptr, userptr_t user_nanoseconds_ptr)
+{
+	time_t seconds;
+	uint32_t nanoseconds;
+	int result;
+
+	result = copyin(user_seconds_ptr, &seconds, sizeof(time_t));
+	if (result) {
+		return result;
+	}
+
+	result = copyin(user_nanoseconds_ptr, &nanoseconds, sizeof(uint32_t));
+	if (result) {
+		return result;
+	}
+
+	if (seconds < 0 || nanoseconds >= 1000000000) {
+		return EINVAL;
+	}
+
+	settime(seconds, nanoseconds);
+	return 0;
+}
+
+/*
+ * Sleep for the time given by a struct timespec, rounded up to whole
+ * milliseconds (and then to hardclocks). There are no signals, so a
+ * sleep is never cut short and the remaining time is always zero.
+ */
+int
+sys_nanosleep(userptr_t user_req, userptr_t user_rem)
+{
+	struct timespec ts;
+	unsigned ms;
+	int result;
+
+	result = copyin(user_req, &ts, sizeof(ts));
+	if (result) {
+		return result;
+	}
+	if (ts.tv_sec < 0 || ts.tv_nsec < 0 || ts.tv_nsec >= 1000000000) {
+		return EINVAL;
+	}
+
+	/* Clamp to what fits in an unsigned count of milliseconds. */
+	if (ts.tv_sec >= (time_t)(((unsigned)-1 - 1000) / 1000)) {
+		ms = (unsigned)-1;
+	}
+	else {
+		ms = (unsigned)ts.tv_sec * 1000 +
+			DIVROUNDUP((unsigned)ts.tv_nsec, 1000000);
+	}
+	clocksleep_ms(ms);
+
+	if (user_rem != NULL) {
+		ts.tv_sec = 0;
+		ts.tv_nsec = 0;
+		result = copyout(&ts, user_rem, sizeof(ts));
+		if (result) {
+			return result;
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,139 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Atomic counter benchmark.
+ *
+ * One thread per cpu bumps a shared counter for a fixed time, first
+ * under a spinlock the way counters like vmstats and proc_count used
+ * to be kept, then with atomic_inc, then with a hand-rolled
+ * atomic_cas loop. Each run reports how many increments got done and
+ * checks that the counter agrees with the sum of what each thread
+ * thinks it did. The atomic runs take no spinlocks at all.
+ */
+#include <types.h>
+#include <lib.h>
+#include <cpu.h>
+#include <spinlock.h>
+#include <atomic.h>
+#include <test.h>
+
+#define AB_RUNMS	2000	/* length of each run */
+
+enum ab_mode {
+	AB_SPINLOCK,
+	AB_ATOMIC,
+	AB_CAS,
+};
+
+static const char *const ab_names[] = {
+	"spinlock:",
+	"atomic_inc:",
+	"atomic_cas:",
+};
+
+static enum ab_mode ab_mode;
+
+static struct spinlock ab_lock = SPINLOCK_INITIALIZER;
+static volatile unsigned ab_counter;
+
+static
+unsigned
+ab_body(unsigned long num, volatile bool *stop)
+{
+	unsigned count, old;
+
+	(void)num;
+
+	count = 0;
+	while (!*stop) {
+		switch (ab_mode) {
+		    case AB_SPINLOCK:
+			spinlock_acquire(&ab_lock);
+			ab_counter++;
+			spinlock_release(&ab_lock);
+			break;
+		    case AB_ATOMIC:
+			atomic_inc(&ab_counter);
+			break;
+		    case AB_CAS:
+			do {
+				old = ab_counter;
+			} while (atomic_cas(&ab_counter, old, old + 1) != old);
+			break;
+		}
+		count++;
+	}
+	return count;
+}
+
+/*
+ * Returns true if the counter came out right.
+ */
+static
+bool
+ab_run(unsigned numcpus, enum ab_mode mode)
+{
+	struct bench_result res;
+
+	ab_mode = mode;
+	ab_counter = 0;
+	bench_run("atomicbench", numcpus, true, AB_RUNMS, ab_body, &res);
+
+	kprintf("%-12s %9u increments", ab_names[mode], res.br_total);
+	if (ab_counter != res.br_total) {
+		kprintf(", but the counter says %u\n", ab_counter);
+		return false;
+	}
+	kprintf("\n");
+	return true;
+}
+
+int
+atomicbench(int nargs, char **args)
+{
+	unsigned numcpus;
+	bool ok;
+
+	(void)nargs;
+	(void)args;
+
+	numcpus = cpu_count();
+	if (numcpus > BENCH_MAXTHREADS) {
+		numcpus = BENCH_MAXTHREADS;
+	}
+
+	kprintf("%u cpus, %u ms each\n", numcpus, AB_RUNMS);
+	ok = ab_run(numcpus, AB_SPINLOCK);
+	ok = ab_run(numcpus, AB_ATOMIC) && ok;
+	ok = ab_run(numcpus, AB_CAS) && ok;
+
+	kprintf(ok ? "atomicbench: passed\n" : "atomicbench: FAILED\n");
+	return 0;
+}
@@ -0,0 +1,144 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Harness shared by the contention benchmarks (spinbench, atomicbench,
+ * lockbench): fork a set of workers, optionally pin each one to its
+ * own cpu, let them all go at once, stop them after a fixed time, and
+ * tally what they got done.
+ */
+#include <types.h>
+#include <lib.h>
+#include <cpu.h>
+#include <clock.h>
+#include <thread.h>
+#include <current.h>
+#include <synch.h>
+#include <test.h>
+
+static struct semaphore *bench_ready;
+static struct semaphore *bench_done;
+static volatile bool bench_go;
+static volatile bool bench_stop;
+static bool bench_pin;
+static unsigned (*bench_body)(unsigned long num, volatile bool *stop);
+static unsigned bench_counts[BENCH_MAXTHREADS];
+
+/*
+ * Move the current thread onto cpu CPUNUM and keep it there. The
+ * affinity change only takes effect at a context switch, and the
+ * scheduler is free to pick us again before migrating us, so keep
+ * yielding until we have actually arrived.
+ */
+static
+void
+bench_pincpu(unsigned cpunum)
+{
+	int result;
+
+	result = thread_setaffinity(curthread, (uint32_t)1 << cpunum);
+	KASSERT(result == 0);
+	while (curcpu->c_number != cpunum) {
+		thread_yield();
+	}
+}
+
+static
+void
+bench_worker(void *junk, unsigned long num)
+{
+	(void)junk;
+
+	if (bench_pin) {
+		bench_pincpu(num);
+	}
+	V(bench_ready);
+	while (!bench_go) {
+		/* nothing */
+	}
+
+	bench_counts[num] = bench_body(num, &bench_stop);
+	V(bench_done);
+}
+
+void
+bench_run(const char *name, unsigned nthreads, bool pin, unsigned ms,
+	  unsigned (*body)(unsigned long num, volatile bool *stop),
+	  struct bench_result *res)
+{
+	unsigned i;
+	int result;
+
+	KASSERT(nthreads > 0 && nthreads <= BENCH_MAXTHREADS);
+	KASSERT(!pin || nthreads <= cpu_count());
+
+	bench_ready = sem_create(name, 0);
+	bench_done = sem_create(name, 0);
+	if (bench_ready == NULL || bench_done == NULL) {
+		panic("%s: sem_create failed\n", name);
+	}
+
+	bench_pin = pin;
+	bench_body = body;
+	bench_go = false;
+	bench_stop = false;
+	for (i=0; i<nthreads; i++) {
+		bench_counts[i] = 0;
+		result = thread_fork(name, NULL, bench_worker, NULL, i);
+		if (result) {
+			panic("%s: thread_fork: %s\n", name,
+			      strerror(result));
+		}
+	}
+
+	/* Wait until every worker is in place, then start them together. */
+	for (i=0; i<nthreads; i++) {
+		P(bench_ready);
+	}
+	bench_go = true;
+	clocksleep_ms(ms);
+	bench_stop = true;
+	for (i=0; i<nthreads; i++) {
+		P(bench_done);
+	}
+	sem_destroy(bench_ready);
+	sem_destroy(bench_done);
+
+	res->br_total = 0;
+	res->br_min = res->br_max = bench_counts[0];
+	for (i=0; i<nthreads; i++) {
+		res->br_total += bench_counts[i];
+		if (bench_counts[i] < res->br_min) {
+			res->br_min = bench_counts[i];
+		}
+		if (bench_counts[i] > res->br_max) {
+			res->br_max = bench_counts[i];
+		}
+	}
+}
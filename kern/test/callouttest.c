@@ -0,0 +1,193 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Callout and timed sleep tests.
+ */
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <spl.h>
+#include <cpu.h>
+#include <clock.h>
+#include <thread.h>
+#include <current.h>
+#include <wchan.h>
+#include <callout.h>
+#include <test.h>
+
+#define NCALLOUTS 16
+
+static struct callout tcallouts[NCALLOUTS];
+static unsigned tcallout_due[NCALLOUTS];
+static volatile unsigned tcallout_fired[NCALLOUTS];
+
+static
+void
+tcallout_func(void *data1, unsigned long num)
+{
+	(void)data1;
+	tcallout_fired[num] = curcpu->c_hardclocks;
+}
+
+/*
+ * Delays that land in level 0 and level 1 of the wheel, and on
+ * either side of the cascade between them.
+ */
+static
+unsigned
+tcallout_delay(unsigned num)
+{
+	static const unsigned delays[] = { 1, 2, 3, 7, 31, 63, 64, 65 };
+
+	return delays[num % 8] + (num / 8) * 70;
+}
+
+/*
+ * Delays for levels 2 and 3, and beyond what the wheel can reach
+ * (2^24 hardclocks), which get cascaded and re-armed. All of them
+ * are far more hardclocks than the test waits, so we only check that
+ * they keep their expiry time and don't run early.
+ */
+#define NFARCALLOUTS 4
+static const unsigned tcallout_fardelays[NFARCALLOUTS] = {
+	100000, 300000, 20000000, 100000000,
+};
+static struct callout tfarcallouts[NFARCALLOUTS];
+
+static
+void
+tfarcallout_func(void *data1, unsigned long num)
+{
+	(void)data1;
+	kprintf("far callout %lu: ran\n", num);
+}
+
+int
+callouttest(int nargs, char **args)
+{
+	struct wchan *wc;
+	time_t s1, s2, rs;
+	uint32_t ns1, ns2, rns;
+	unsigned fardue[NFARCALLOUTS];
+	unsigned i, ms;
+	int spl, result;
+	bool ok = true;
+
+	(void)nargs;
+	(void)args;
+
+	kprintf("Starting callout test...\n");
+
+	/*
+	 * Schedule a spread of callouts, and cancel every fourth. Do
+	 * it all without a hardclock in between so none can run yet.
+	 */
+	spl = splhigh();
+	for (i=0; i<NFARCALLOUTS; i++) {
+		callout_init(&tfarcallouts[i], tfarcallout_func, NULL, i);
+		callout_schedule(&tfarcallouts[i], tcallout_fardelays[i]);
+		fardue[i] = curcpu->c_hardclocks + tcallout_fardelays[i];
+	}
+	for (i=0; i<NCALLOUTS; i++) {
+		callout_init(&tcallouts[i], tcallout_func, NULL, i);
+		tcallout_fired[i] = 0;
+		tcallout_due[i] = curcpu->c_hardclocks + tcallout_delay(i);
+		callout_schedule(&tcallouts[i], tcallout_delay(i));
+	}
+	for (i=0; i<NCALLOUTS; i+=4) {
+		if (!callout_stop(&tcallouts[i])) {
+			kprintf("callout %u: stop failed\n", i);
+			ok = false;
+		}
+	}
+	splx(spl);
+
+	/* Wait until well past the last one. */
+	clocksleep_ms(1000 * (tcallout_delay(NCALLOUTS-1) / HZ + 1));
+
+	for (i=0; i<NCALLOUTS; i++) {
+		if (i % 4 == 0) {
+			if (tcallout_fired[i] != 0) {
+				kprintf("callout %u: ran after stop\n", i);
+				ok = false;
+			}
+			continue;
+		}
+		if (callout_pending(&tcallouts[i]) || tcallout_fired[i] == 0) {
+			kprintf("callout %u: never ran\n", i);
+			ok = false;
+		}
+		else if ((int)(tcallout_fired[i] - tcallout_due[i]) < 0) {
+			kprintf("callout %u: ran at %u, due %u\n", i,
+				tcallout_fired[i], tcallout_due[i]);
+			ok = false;
+		}
+	}
+
+	/* The far ones should still be pending, due when they were. */
+	for (i=0; i<NFARCALLOUTS; i++) {
+		if (!callout_stop(&tfarcallouts[i])) {
+			kprintf("far callout %u: ran early\n", i);
+			ok = false;
+		}
+		else if (tfarcallouts[i].co_expire != fardue[i]) {
+			kprintf("far callout %u: due %u, expected %u\n", i,
+				tfarcallouts[i].co_expire, fardue[i]);
+			ok = false;
+		}
+	}
+
+	/* A timed sleep nobody wakes must time out, and not early. */
+	wc = wchan_create("callouttest");
+	if (wc == NULL) {
+		panic("callouttest: wchan_create failed\n");
+	}
+	for (ms = 10; ms <= 250; ms *= 5) {
+		gettime(&s1, &ns1);
+		wchan_lock(wc);
+		result = wchan_timedsleep(wc, mstohardclocks(ms) + 1);
+		gettime(&s2, &ns2);
+		getinterval(s1, ns1, s2, ns2, &rs, &rns);
+
+		if (result != ETIMEDOUT) {
+			kprintf("timed sleep %u ms: returned %d\n", ms, result);
+			ok = false;
+		}
+		if (rs * 1000 + rns / 1000000 < ms) {
+			kprintf("timed sleep %u ms: woke after %lu.%09lu s\n",
+				ms, (unsigned long)rs, (unsigned long)rns);
+			ok = false;
+		}
+	}
+	wchan_destroy(wc);
+
+	kprintf("Callout test %s.\n", ok ? "done" : "FAILED");
+	return 0;
+}
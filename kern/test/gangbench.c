@@ -0,0 +1,231 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Gang scheduling benchmark.
+ *
+ * One worker thread per cpu runs short bursts of work separated by a
+ * spinning barrier, while one cpu hog per cpu competes with them.
+ * Without gang scheduling the workers get descheduled at unrelated
+ * times and their peers spin at the barrier waiting for them; with
+ * it, they run together in their gang's turns. We count barrier
+ * rounds completed in a fixed time each way.
+ */
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <cpu.h>
+#include <spinlock.h>
+#include <clock.h>
+#include <thread.h>
+#include <current.h>
+#include <proc.h>
+#include <synch.h>
+#include <test.h>
+#include "opt-A2.h"
+
+#define GB_RUNMS	3000	/* length of each run */
+#define GB_WORK		2000	/* loop iterations between barriers */
+
+static struct semaphore *gb_done;
+static volatile bool gb_stop;
+static volatile unsigned gb_rounds;
+
+/* Spinning barrier */
+static struct spinlock gb_lock = SPINLOCK_INITIALIZER;
+static unsigned gb_nthreads;
+static unsigned gb_arrived;
+static volatile unsigned gb_generation;
+
+/*
+ * Wait at the barrier. Returns false if told to stop while waiting.
+ */
+static
+bool
+gb_barrier(void)
+{
+	unsigned gen;
+
+	spinlock_acquire(&gb_lock);
+	gen = gb_generation;
+	gb_arrived++;
+	if (gb_arrived == gb_nthreads) {
+		gb_arrived = 0;
+		gb_generation++;
+		spinlock_release(&gb_lock);
+		return true;
+	}
+	spinlock_release(&gb_lock);
+
+	while (gb_generation == gen) {
+		if (gb_stop) {
+			return false;
+		}
+	}
+	return true;
+}
+
+static
+void
+gb_worker(void *junk, unsigned long num)
+{
+	volatile unsigned x = 0;
+	unsigned i;
+
+	(void)junk;
+
+	while (!gb_stop) {
+		for (i=0; i<GB_WORK; i++) {
+			x++;
+		}
+		if (!gb_barrier()) {
+			break;
+		}
+		if (num == 0) {
+			gb_rounds++;
+		}
+	}
+	/* Not a kernel thread, so detach from the process ourselves */
+	proc_remthread(curthread);
+	V(gb_done);
+}
+
+static
+void
+gb_hog(void *junk, unsigned long num)
+{
+	volatile unsigned x = 0;
+
+	(void)junk;
+	(void)num;
+
+	while (!gb_stop) {
+		x++;
+	}
+	V(gb_done);
+}
+
+/*
+ * One timed run, with gang scheduling of P on or off. Returns the
+ * number of barrier rounds completed.
+ */
+static
+unsigned
+gb_run(struct proc *p, unsigned numcpus, bool gang)
+{
+	char name[16];
+	unsigned i, started;
+	int result;
+
+	result = proc_setgang(p, gang);
+	if (result) {
+		panic("gangbench: proc_setgang: %s\n", strerror(result));
+	}
+
+	gb_stop = false;
+	gb_rounds = 0;
+	gb_nthreads = numcpus;
+	gb_arrived = 0;
+
+	started = 0;
+	for (i=0; i<numcpus; i++) {
+		snprintf(name, sizeof(name), "gbhog%u", i);
+		result = thread_fork(name, NULL, gb_hog, NULL, i);
+		if (result) {
+			panic("gangbench: thread_fork: %s\n",
+			      strerror(result));
+		}
+		started++;
+	}
+	for (i=0; i<numcpus; i++) {
+		snprintf(name, sizeof(name), "gbworker%u", i);
+		result = thread_fork(name, p, gb_worker, NULL, i);
+		if (result) {
+			panic("gangbench: thread_fork: %s\n",
+			      strerror(result));
+		}
+		started++;
+	}
+
+	clocksleep_ms(GB_RUNMS);
+	gb_stop = true;
+	for (i=0; i<started; i++) {
+		P(gb_done);
+	}
+	return gb_rounds;
+}
+
+int
+gangbench(int nargs, char **args)
+{
+	struct proc *p;
+	unsigned numcpus, plain, ganged;
+
+	(void)nargs;
+	(void)args;
+
+	numcpus = cpu_count();
+	if (numcpus < 2) {
+		kprintf("gangbench: needs more than one cpu\n");
+		return 0;
+	}
+
+	gb_done = sem_create("gangbench", 0);
+	if (gb_done == NULL) {
+		return ENOMEM;
+	}
+	p = proc_create_runprogram("gangbench");
+	if (p == NULL) {
+		sem_destroy(gb_done);
+		return ENOMEM;
+	}
+
+	kprintf("gangbench: %u workers and %u hogs, %u ms per run\n",
+		numcpus, numcpus, GB_RUNMS);
+	plain = gb_run(p, numcpus, false);
+	kprintf("gangbench: without gang: %u barrier rounds\n", plain);
+	ganged = gb_run(p, numcpus, true);
+	kprintf("gangbench: with gang:    %u barrier rounds\n", ganged);
+
+	proc_setgang(p, false);
+#if OPT_A2
+	p->alive = false;
+#endif
+	proc_destroy(p);
+	/*
+	 * If that was the only process, proc_destroy woke the menu's
+	 * wait for all processes to finish; undo that.
+	 */
+	if (proc_count_get() == 0) {
+		P(no_proc_sem);
+	}
+
+	sem_destroy(gb_done);
+	return 0;
+}
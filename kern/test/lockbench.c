@@ -0,0 +1,137 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Lock fairness/throughput benchmark.
+ *
+ * A handful of threads per cpu take a shared lock over and over for a
+ * fixed time, doing a little work inside and a little outside, once
+ * with the default (barging) release and once with handoff (see
+ * lock_sethandoff). For each run it reports the total number of
+ * acquisitions, the fewest and most any one thread got, and the
+ * longest run of back-to-back acquisitions by any one thread.
+ * Barging should get more done overall; handoff should spread the
+ * lock out evenly and keep streaks short.
+ */
+#include <types.h>
+#include <lib.h>
+#include <cpu.h>
+#include <synch.h>
+#include <test.h>
+
+#define LB_RUNMS	2000	/* length of each run */
+#define LB_PERCPU	4	/* threads per cpu */
+#define LB_INSIDE	200	/* work with the lock held */
+#define LB_OUTSIDE	100	/* work between acquisitions */
+
+static struct lock *lb_lock;
+
+/* Protected by lb_lock */
+static unsigned long lb_last;
+static unsigned lb_streak;
+static unsigned lb_maxstreak;
+
+static
+void
+lb_work(unsigned n)
+{
+	volatile unsigned i;
+
+	for (i=0; i<n; i++);
+}
+
+static
+unsigned
+lb_body(unsigned long num, volatile bool *stop)
+{
+	unsigned count;
+
+	count = 0;
+	while (!*stop) {
+		lock_acquire(lb_lock);
+		if (lb_last == num) {
+			lb_streak++;
+			if (lb_streak > lb_maxstreak) {
+				lb_maxstreak = lb_streak;
+			}
+		}
+		else {
+			lb_last = num;
+			lb_streak = 1;
+		}
+		lb_work(LB_INSIDE);
+		lock_release(lb_lock);
+		count++;
+		lb_work(LB_OUTSIDE);
+	}
+	return count;
+}
+
+static
+void
+lb_run(unsigned nthreads, bool handoff)
+{
+	struct bench_result res;
+
+	lock_sethandoff(lb_lock, handoff);
+	lb_last = (unsigned long)-1;
+	lb_streak = 0;
+	lb_maxstreak = 0;
+	bench_run("lockbench", nthreads, false, LB_RUNMS, lb_body, &res);
+
+	kprintf("%-8s %9u acquisitions, per thread %u-%u, "
+		"longest streak %u\n", handoff ? "handoff:" : "barging:",
+		res.br_total, res.br_min, res.br_max, lb_maxstreak);
+}
+
+int
+lockbench(int nargs, char **args)
+{
+	unsigned nthreads;
+
+	(void)nargs;
+	(void)args;
+
+	nthreads = cpu_count() * LB_PERCPU;
+	if (nthreads > BENCH_MAXTHREADS) {
+		nthreads = BENCH_MAXTHREADS;
+	}
+
+	lb_lock = lock_create("lockbench");
+	if (lb_lock == NULL) {
+		panic("lockbench: lock_create failed\n");
+	}
+
+	kprintf("%u threads, %u ms each\n", nthreads, LB_RUNMS);
+	lb_run(nthreads, false);
+	lb_run(nthreads, true);
+
+	lock_destroy(lb_lock);
+	return 0;
+}
@@ -0,0 +1,341 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Reader-writer lock tests.
+ *
+ * rwtest hammers one rwlock from many threads with a mix of reads,
+ * writes, upgrades and downgrades, and checks that a writer never
+ * overlaps anyone and that readers never see a half-done write.
+ *
+ * rwbench times a read-mostly workload under an rwlock and under a
+ * plain lock, at a few read/write ratios.
+ */
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <clock.h>
+#include <spinlock.h>
+#include <thread.h>
+#include <synch.h>
+#include <test.h>
+
+#define RWT_THREADS	16
+#define RWT_LOOPS	200
+#define RWT_DELAY	200	/* loop iterations inside the lock */
+
+#define RWB_THREADS	8
+#define RWB_OPS		2000	/* per thread */
+#define RWB_WORK	100	/* loop iterations inside the lock */
+
+static struct rwlock *rwt_rw;
+static struct lock *rwt_lock;
+static struct semaphore *rwt_done;
+
+/* The data: rwt_val2 is always rwt_val1 squared, outside of writes */
+static volatile unsigned long rwt_val1;
+static volatile unsigned long rwt_val2;
+
+/* Who is inside, and what went wrong */
+static struct spinlock rwt_statlock = SPINLOCK_INITIALIZER;
+static unsigned rwt_nreaders;
+static unsigned rwt_nwriters;
+static unsigned rwt_errors;
+static unsigned rwt_upgradefails;
+
+static
+void
+rwt_error(unsigned long num, const char *msg)
+{
+	kprintf("thread %lu: %s\n", num, msg);
+	rwt_errors++;
+}
+
+static
+void
+rwt_enter(unsigned long num, bool writer)
+{
+	spinlock_acquire(&rwt_statlock);
+	if (rwt_nwriters > 0) {
+		rwt_error(num, "entered alongside a writer");
+	}
+	if (writer && rwt_nreaders > 0) {
+		rwt_error(num, "writer entered alongside readers");
+	}
+	if (writer) {
+		rwt_nwriters++;
+	}
+	else {
+		rwt_nreaders++;
+	}
+	spinlock_release(&rwt_statlock);
+}
+
+static
+void
+rwt_leave(bool writer)
+{
+	spinlock_acquire(&rwt_statlock);
+	if (writer) {
+		KASSERT(rwt_nwriters > 0);
+		rwt_nwriters--;
+	}
+	else {
+		KASSERT(rwt_nreaders > 0);
+		rwt_nreaders--;
+	}
+	spinlock_release(&rwt_statlock);
+}
+
+static
+void
+rwt_read(unsigned long num)
+{
+	unsigned long v1, v2;
+	volatile unsigned i;
+
+	rwt_enter(num, false);
+	v1 = rwt_val1;
+	for (i=0; i<RWT_DELAY; i++);
+	v2 = rwt_val2;
+	if (v2 != v1*v1) {
+		spinlock_acquire(&rwt_statlock);
+		rwt_error(num, "read a half-done write");
+		spinlock_release(&rwt_statlock);
+	}
+	rwt_leave(false);
+}
+
+static
+void
+rwt_write(unsigned long num)
+{
+	volatile unsigned i;
+
+	rwt_enter(num, true);
+	rwt_val1 = num;
+	for (i=0; i<RWT_DELAY; i++);
+	rwt_val2 = num*num;
+	rwt_leave(true);
+}
+
+static
+void
+rwtestthread(void *junk, unsigned long num)
+{
+	unsigned i;
+	bool upgraded;
+
+	(void)junk;
+
+	for (i=0; i<RWT_LOOPS; i++) {
+		switch (random() % 8) {
+		    case 5:
+			rwlock_acquire_write(rwt_rw);
+			rwt_write(num);
+			rwlock_release_write(rwt_rw);
+			break;
+		    case 6:
+			rwlock_acquire_read(rwt_rw);
+			rwt_read(num);
+			upgraded = rwlock_upgrade(rwt_rw);
+			if (upgraded) {
+				rwt_write(num);
+				rwlock_downgrade(rwt_rw);
+			}
+			else {
+				spinlock_acquire(&rwt_statlock);
+				rwt_upgradefails++;
+				spinlock_release(&rwt_statlock);
+			}
+			rwt_read(num);
+			rwlock_release_read(rwt_rw);
+			break;
+		    case 7:
+			rwlock_acquire_write(rwt_rw);
+			rwt_write(num);
+			rwlock_downgrade(rwt_rw);
+			rwt_read(num);
+			rwlock_release_read(rwt_rw);
+			break;
+		    default:
+			rwlock_acquire_read(rwt_rw);
+			rwt_read(num);
+			rwlock_release_read(rwt_rw);
+			break;
+		}
+	}
+	V(rwt_done);
+}
+
+int
+rwtest(int nargs, char **args)
+{
+	unsigned i;
+	int result;
+
+	(void)nargs;
+	(void)args;
+
+	kprintf("Starting rwlock test...\n");
+
+	rwt_rw = rwlock_create("rwtest");
+	rwt_done = sem_create("rwtest done", 0);
+	if (rwt_rw == NULL || rwt_done == NULL) {
+		panic("rwtest: out of memory\n");
+	}
+	rwt_val1 = rwt_val2 = 0;
+	rwt_nreaders = rwt_nwriters = 0;
+	rwt_errors = rwt_upgradefails = 0;
+
+	for (i=0; i<RWT_THREADS; i++) {
+		result = thread_fork("rwtest", NULL, rwtestthread, NULL, i);
+		if (result) {
+			panic("rwtest: thread_fork failed: %s\n",
+			      strerror(result));
+		}
+	}
+	for (i=0; i<RWT_THREADS; i++) {
+		P(rwt_done);
+	}
+
+	rwlock_destroy(rwt_rw);
+	sem_destroy(rwt_done);
+
+	kprintf("%u upgrades lost to another upgrader\n", rwt_upgradefails);
+	kprintf("Rwlock test %s.\n", rwt_errors == 0 ? "done" : "FAILED");
+	return 0;
+}
+
+////////////////////////////////////////////////////////////
+
+/* One write per rwb_writeevery operations */
+static unsigned rwb_writeevery;
+static bool rwb_userw;
+
+static
+void
+rwb_work(void)
+{
+	volatile unsigned i;
+
+	for (i=0; i<RWB_WORK; i++);
+}
+
+static
+void
+rwbenchthread(void *junk, unsigned long num)
+{
+	unsigned i;
+	bool write;
+
+	(void)junk;
+
+	for (i=0; i<RWB_OPS; i++) {
+		write = ((i + num) % rwb_writeevery) == 0;
+		if (!rwb_userw) {
+			lock_acquire(rwt_lock);
+			rwb_work();
+			lock_release(rwt_lock);
+		}
+		else if (write) {
+			rwlock_acquire_write(rwt_rw);
+			rwb_work();
+			rwlock_release_write(rwt_rw);
+		}
+		else {
+			rwlock_acquire_read(rwt_rw);
+			rwb_work();
+			rwlock_release_read(rwt_rw);
+		}
+	}
+	V(rwt_done);
+}
+
+/*
+ * Run the benchmark once and return the elapsed time in ms.
+ */
+static
+unsigned
+rwb_run(bool userw, unsigned writeevery)
+{
+	time_t s1, s2, rs;
+	uint32_t ns1, ns2, rns;
+	unsigned i;
+	int result;
+
+	rwb_userw = userw;
+	rwb_writeevery = writeevery;
+
+	gettime(&s1, &ns1);
+	for (i=0; i<RWB_THREADS; i++) {
+		result = thread_fork("rwbench", NULL, rwbenchthread, NULL, i);
+		if (result) {
+			panic("rwbench: thread_fork failed: %s\n",
+			      strerror(result));
+		}
+	}
+	for (i=0; i<RWB_THREADS; i++) {
+		P(rwt_done);
+	}
+	gettime(&s2, &ns2);
+	getinterval(s1, ns1, s2, ns2, &rs, &rns);
+
+	return rs * 1000 + rns / 1000000;
+}
+
+int
+rwbench(int nargs, char **args)
+{
+	static const unsigned ratios[] = { 2, 10, 100 };
+	unsigned i, lockms, rwms;
+
+	(void)nargs;
+	(void)args;
+
+	rwt_rw = rwlock_create("rwbench");
+	rwt_lock = lock_create("rwbench");
+	rwt_done = sem_create("rwbench done", 0);
+	if (rwt_rw == NULL || rwt_lock == NULL || rwt_done == NULL) {
+		panic("rwbench: out of memory\n");
+	}
+
+	kprintf("%u threads, %u operations each\n", RWB_THREADS, RWB_OPS);
+	for (i=0; i<sizeof(ratios)/sizeof(ratios[0]); i++) {
+		lockms = rwb_run(false, ratios[i]);
+		rwms = rwb_run(true, ratios[i]);
+		kprintf("1 write in %3u: lock %5u ms, rwlock %5u ms\n",
+			ratios[i], lockms, rwms);
+	}
+
+	rwlock_destroy(rwt_rw);
+	lock_destroy(rwt_lock);
+	sem_destroy(rwt_done);
+	return 0;
+}
@@ -0,0 +1,194 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Seqlock test.
+ *
+ * One writer thread keeps updating a pair of words, always leaving
+ * the second the complement of the first, under a spinlock and a
+ * seqlock. A reader on every other cpu (or, with one cpu, a few
+ * readers sharing it with the writer) copies the pair with the
+ * seqlock read loop and checks that it never sees one word from one
+ * update and the other from another. The number of reads and of
+ * retries is reported, so the cost of readers colliding with the
+ * writer can be seen.
+ */
+#include <types.h>
+#include <lib.h>
+#include <cpu.h>
+#include <spinlock.h>
+#include <seqlock.h>
+#include <clock.h>
+#include <thread.h>
+#include <current.h>
+#include <synch.h>
+#include <test.h>
+
+#define SQ_RUNMS	2000	/* length of the run */
+#define SQ_MAXCPUS	32
+#define SQ_UPREADERS	3	/* readers to use on a uniprocessor */
+
+static struct semaphore *sq_done;
+static volatile bool sq_stop;
+
+static struct spinlock sq_lock = SPINLOCK_INITIALIZER;
+static struct seqlock sq_seq = SEQLOCK_INITIALIZER;
+static volatile unsigned sq_a, sq_b;
+
+static unsigned sq_writes;
+static unsigned sq_reads[SQ_MAXCPUS];
+static unsigned sq_retries[SQ_MAXCPUS];
+static unsigned sq_torn[SQ_MAXCPUS];
+
+static
+void
+sq_writer(void *junk, unsigned long num)
+{
+	unsigned i, n;
+
+	(void)junk;
+
+	thread_setaffinity(curthread, (uint32_t)1 << num);
+	thread_yield();
+
+	n = 0;
+	while (!sq_stop) {
+		spinlock_acquire(&sq_lock);
+		seqlock_write_begin(&sq_seq);
+		sq_a = n;
+		/* Widen the window a reader could see a torn pair in */
+		for (i=0; i<8; i++) {
+			membar_producer();
+		}
+		sq_b = ~n;
+		seqlock_write_end(&sq_seq);
+		spinlock_release(&sq_lock);
+		n++;
+	}
+	sq_writes = n;
+	V(sq_done);
+}
+
+static
+void
+sq_reader(void *junk, unsigned long num)
+{
+	unsigned seq, a, b, reads, retries, torn;
+	unsigned cpunum;
+
+	(void)junk;
+
+	cpunum = cpu_count() > 1 ? num : 0;
+	thread_setaffinity(curthread, (uint32_t)1 << cpunum);
+	thread_yield();
+
+	reads = retries = torn = 0;
+	while (!sq_stop) {
+		seq = seqlock_read_begin(&sq_seq);
+		a = sq_a;
+		b = sq_b;
+		while (seqlock_read_retry(&sq_seq, seq)) {
+			retries++;
+			seq = seqlock_read_begin(&sq_seq);
+			a = sq_a;
+			b = sq_b;
+		}
+		if (b != ~a) {
+			torn++;
+		}
+		reads++;
+	}
+	sq_reads[num] = reads;
+	sq_retries[num] = retries;
+	sq_torn[num] = torn;
+	V(sq_done);
+}
+
+int
+seqlocktest(int nargs, char **args)
+{
+	unsigned i, numcpus, nreaders, reads, retries, torn;
+	int result;
+
+	(void)nargs;
+	(void)args;
+
+	numcpus = cpu_count();
+	if (numcpus > SQ_MAXCPUS) {
+		numcpus = SQ_MAXCPUS;
+	}
+	nreaders = numcpus > 1 ? numcpus - 1 : SQ_UPREADERS;
+
+	sq_done = sem_create("seqlocktest", 0);
+	if (sq_done == NULL) {
+		panic("seqlocktest: sem_create failed\n");
+	}
+
+	sq_a = 0;
+	sq_b = ~0U;
+	sq_stop = false;
+	sq_writes = 0;
+	result = thread_fork("sqwriter", NULL, sq_writer, NULL, 0);
+	if (result) {
+		panic("seqlocktest: thread_fork: %s\n", strerror(result));
+	}
+	/* Readers are numbered from 1, after the writer's cpu */
+	for (i=1; i<=nreaders; i++) {
+		sq_reads[i] = sq_retries[i] = sq_torn[i] = 0;
+		result = thread_fork("sqreader", NULL, sq_reader, NULL, i);
+		if (result) {
+			panic("seqlocktest: thread_fork: %s\n",
+			      strerror(result));
+		}
+	}
+
+	clocksleep_ms(SQ_RUNMS);
+	sq_stop = true;
+	for (i=0; i<=nreaders; i++) {
+		P(sq_done);
+	}
+	sem_destroy(sq_done);
+
+	reads = retries = torn = 0;
+	for (i=1; i<=nreaders; i++) {
+		reads += sq_reads[i];
+		retries += sq_retries[i];
+		torn += sq_torn[i];
+	}
+	kprintf("%u readers, %u ms: %u writes, %u reads, %u retries\n",
+		nreaders, SQ_RUNMS, sq_writes, reads, retries);
+	if (torn > 0) {
+		kprintf("seqlocktest: %u torn reads\n", torn);
+		kprintf("seqlocktest: FAILED\n");
+	}
+	else {
+		kprintf("seqlocktest: passed\n");
+	}
+	return 0;
+}
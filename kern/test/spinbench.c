@@ -0,0 +1,149 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Spinlock contention benchmark.
+ *
+ * One thread per cpu takes a shared lock over and over for a fixed
+ * time, doing a little work inside and outside it. This is run once
+ * with the ticket spinlocks from spinlock.c and once with a plain
+ * test-and-set lock like the one they replaced, and reports the
+ * total number of acquisitions and how evenly they were spread
+ * across cpus.
+ */
+#include <types.h>
+#include <lib.h>
+#include <spl.h>
+#include <cpu.h>
+#include <spinlock.h>
+#include <test.h>
+
+#define SB_RUNMS	2000	/* length of each run */
+#define SB_INSIDE	20	/* loop iterations holding the lock */
+#define SB_OUTSIDE	20	/* loop iterations between acquires */
+
+static bool sb_tas;
+
+static struct spinlock sb_lock = SPINLOCK_INITIALIZER;
+static volatile spinlock_data_t sb_taslock = SPINLOCK_DATA_INITIALIZER;
+static volatile unsigned long sb_shared;
+
+/*
+ * The old test-and-test-and-set lock.
+ */
+static
+void
+sb_tas_acquire(void)
+{
+	splraise(IPL_NONE, IPL_HIGH);
+	while (1) {
+		if (spinlock_data_get(&sb_taslock) != 0) {
+			continue;
+		}
+		if (spinlock_data_testandset(&sb_taslock) != 0) {
+			continue;
+		}
+		break;
+	}
+}
+
+static
+void
+sb_tas_release(void)
+{
+	spinlock_data_set(&sb_taslock, 0);
+	spllower(IPL_HIGH, IPL_NONE);
+}
+
+static
+unsigned
+sb_body(unsigned long num, volatile bool *stop)
+{
+	volatile unsigned i;
+	unsigned count;
+
+	(void)num;
+
+	count = 0;
+	while (!*stop) {
+		if (sb_tas) {
+			sb_tas_acquire();
+		}
+		else {
+			spinlock_acquire(&sb_lock);
+		}
+		for (i=0; i<SB_INSIDE; i++) {
+			sb_shared++;
+		}
+		if (sb_tas) {
+			sb_tas_release();
+		}
+		else {
+			spinlock_release(&sb_lock);
+		}
+		count++;
+		for (i=0; i<SB_OUTSIDE; i++);
+	}
+	return count;
+}
+
+static
+void
+sb_run(unsigned numcpus, bool tas)
+{
+	struct bench_result res;
+
+	sb_tas = tas;
+	bench_run("spinbench", numcpus, true, SB_RUNMS, sb_body, &res);
+	kprintf("%-14s %8u acquires, per cpu min %u max %u\n",
+		tas ? "test-and-set:" : "ticket:", res.br_total,
+		res.br_min, res.br_max);
+}
+
+int
+spinbench(int nargs, char **args)
+{
+	unsigned numcpus;
+
+	(void)nargs;
+	(void)args;
+
+	numcpus = cpu_count();
+	if (numcpus > BENCH_MAXTHREADS) {
+		numcpus = BENCH_MAXTHREADS;
+	}
+	if (numcpus < 2) {
+		kprintf("spinbench: only one cpu, so no contention\n");
+	}
+
+	kprintf("%u cpus, %u ms each\n", numcpus, SB_RUNMS);
+	sb_run(numcpus, false);
+	sb_run(numcpus, true);
+	return 0;
+}
@@ -32,6 +32,7 @@
  */
 
 #include <types.h>
+#include <kern/errno.h>
 #include <lib.h>
 #include <clock.h>
 #include <thread.h>
@@ -347,3 +348,313 @@ cvtest(int nargs, char **args)
 
 	return 0;
 }
+
+////////////////////////////////////////////////////////////
+//
+// Timed waits.
+
+#define NTIMEDTHREADS	8
+#define NTIMEDLOOPS	40
+#define NTIMEDPOSTS	(NTIMEDTHREADS * NTIMEDLOOPS / 2)
+
+static struct semaphore *timedsem;
+static struct lock *timedlock;
+static struct cv *timedcv;
+static struct semaphore *timeddone;
+static volatile unsigned timedgot;
+static volatile bool timedflag;
+static volatile bool timedstop;
+static volatile bool timedfailed;
+
+/*
+ * Milliseconds since (SECS, NSECS).
+ */
+static
+unsigned
+timedelapsed(time_t secs, uint32_t nsecs)
+{
+	time_t secs2;
+	uint32_t nsecs2;
+
+	gettime(&secs2, &nsecs2);
+	getinterval(secs, nsecs, secs2, nsecs2, &secs2, &nsecs2);
+	return secs2 * 1000 + nsecs2 / 1000000;
+}
+
+static
+void
+timedfail(const char *msg)
+{
+	kprintf("%s\n", msg);
+	timedfailed = true;
+}
+
+/*
+ * Take the semaphore NTIMEDLOOPS times with short timeouts, which
+ * sometimes win and sometimes don't.
+ */
+static
+void
+timedsemthread(void *junk, unsigned long num)
+{
+	unsigned i, got;
+
+	(void)junk;
+
+	got = 0;
+	for (i=0; i<NTIMEDLOOPS; i++) {
+		if (P_timed(timedsem, 1 + (num + i) % 5) == 0) {
+			got++;
+		}
+	}
+	lock_acquire(timedlock);
+	timedgot += got;
+	lock_release(timedlock);
+	V(timeddone);
+}
+
+static
+void
+timedpostthread(void *junk, unsigned long num)
+{
+	unsigned i;
+
+	(void)junk;
+	(void)num;
+
+	for (i=0; i<NTIMEDPOSTS; i++) {
+		V(timedsem);
+		if (i % 4 == 0) {
+			clocksleep_ms(1);
+		}
+		else {
+			thread_yield();
+		}
+	}
+	V(timeddone);
+}
+
+int
+timedsemtest(int nargs, char **args)
+{
+	time_t secs;
+	uint32_t nsecs;
+	unsigned i, ms, left;
+	int result;
+
+	(void)nargs;
+	(void)args;
+
+	kprintf("Starting timed semaphore test...\n");
+	timedsem = sem_create("timedsem", 0);
+	timedlock = lock_create("timedlock");
+	timeddone = sem_create("timeddone", 0);
+	if (timedsem == NULL || timedlock == NULL || timeddone == NULL) {
+		panic("timedsemtest: out of memory\n");
+	}
+	timedfailed = false;
+
+	/* Nobody posts: we should time out, and not early. */
+	gettime(&secs, &nsecs);
+	result = P_timed(timedsem, 100);
+	ms = timedelapsed(secs, nsecs);
+	if (result != ETIMEDOUT) {
+		timedfail("P_timed on an empty semaphore didn't time out");
+	}
+	if (ms < 100) {
+		kprintf("P_timed(100 ms) returned after %u ms\n", ms);
+		timedfail("P_timed timed out early");
+	}
+
+	/* A zero timeout is a trylock. */
+	V(timedsem);
+	if (P_timed(timedsem, 0) != 0) {
+		timedfail("P_timed(0) didn't take an available count");
+	}
+	if (P_timed(timedsem, 0) != ETIMEDOUT) {
+		timedfail("P_timed(0) took a count that wasn't there");
+	}
+
+	/*
+	 * Timeouts racing with posts. Every V must end up either
+	 * taken by some P_timed or still in the count.
+	 */
+	timedgot = 0;
+	for (i=0; i<NTIMEDTHREADS; i++) {
+		result = thread_fork("timedsem", NULL, timedsemthread,
+				     NULL, i);
+		if (result) {
+			panic("timedsemtest: thread_fork failed: %s\n",
+			      strerror(result));
+		}
+	}
+	result = thread_fork("timedpost", NULL, timedpostthread, NULL, 0);
+	if (result) {
+		panic("timedsemtest: thread_fork failed: %s\n",
+		      strerror(result));
+	}
+	for (i=0; i<NTIMEDTHREADS + 1; i++) {
+		P(timeddone);
+	}
+	left = 0;
+	while (P_timed(timedsem, 0) == 0) {
+		left++;
+	}
+	kprintf("%u posts: %u taken by timed waits, %u left over\n",
+		NTIMEDPOSTS, timedgot, left);
+	if (timedgot + left != NTIMEDPOSTS) {
+		timedfail("Posts were lost or taken twice");
+	}
+
+	sem_destroy(timedsem);
+	lock_destroy(timedlock);
+	sem_destroy(timeddone);
+	kprintf(timedfailed ? "Timed semaphore test FAILED\n" :
+		"Timed semaphore test done\n");
+	return 0;
+}
+
+/*
+ * Wait on the cv with a long timeout until timedflag is set.
+ */
+static
+void
+timedcvwaiter(void *junk, unsigned long num)
+{
+	int result;
+
+	(void)junk;
+	(void)num;
+
+	lock_acquire(timedlock);
+	while (!timedflag) {
+		result = cv_timedwait(timedcv, timedlock, 5000);
+		if (result == ETIMEDOUT) {
+			timedfail("cv_timedwait timed out despite a signal");
+			break;
+		}
+	}
+	if (!lock_do_i_hold(timedlock)) {
+		timedfail("cv_timedwait returned without the lock");
+	}
+	lock_release(timedlock);
+	V(timeddone);
+}
+
+/*
+ * Wait with very short timeouts while somebody else broadcasts, so
+ * timeouts and wakeups keep colliding.
+ */
+static
+void
+timedcvstorm(void *junk, unsigned long num)
+{
+	unsigned i;
+
+	(void)junk;
+
+	lock_acquire(timedlock);
+	for (i=0; i<NTIMEDLOOPS; i++) {
+		cv_timedwait(timedcv, timedlock, 1 + (num + i) % 3);
+		if (!lock_do_i_hold(timedlock)) {
+			timedfail("cv_timedwait returned without the lock");
+		}
+	}
+	lock_release(timedlock);
+	V(timeddone);
+}
+
+static
+void
+timedcvbroadcaster(void *junk, unsigned long num)
+{
+	(void)junk;
+	(void)num;
+
+	while (!timedstop) {
+		lock_acquire(timedlock);
+		cv_broadcast(timedcv, timedlock);
+		lock_release(timedlock);
+		thread_yield();
+	}
+	V(timeddone);
+}
+
+int
+timedcvtest(int nargs, char **args)
+{
+	time_t secs;
+	uint32_t nsecs;
+	unsigned i, ms;
+	int result;
+
+	(void)nargs;
+	(void)args;
+
+	kprintf("Starting timed CV test...\n");
+	timedlock = lock_create("timedlock");
+	timedcv = cv_create("timedcv");
+	timeddone = sem_create("timeddone", 0);
+	if (timedlock == NULL || timedcv == NULL || timeddone == NULL) {
+		panic("timedcvtest: out of memory\n");
+	}
+	timedfailed = false;
+
+	/* Nobody signals: we should time out, holding the lock. */
+	lock_acquire(timedlock);
+	gettime(&secs, &nsecs);
+	result = cv_timedwait(timedcv, timedlock, 100);
+	ms = timedelapsed(secs, nsecs);
+	if (result != ETIMEDOUT) {
+		timedfail("cv_timedwait without a signal didn't time out");
+	}
+	if (ms < 100) {
+		kprintf("cv_timedwait(100 ms) returned after %u ms\n", ms);
+		timedfail("cv_timedwait timed out early");
+	}
+	if (!lock_do_i_hold(timedlock)) {
+		timedfail("cv_timedwait returned without the lock");
+	}
+	lock_release(timedlock);
+
+	/* A signal well before the timeout wakes the waiter with 0. */
+	timedflag = false;
+	result = thread_fork("timedcv", NULL, timedcvwaiter, NULL, 0);
+	if (result) {
+		panic("timedcvtest: thread_fork failed: %s\n",
+		      strerror(result));
+	}
+	clocksleep_ms(50);
+	lock_acquire(timedlock);
+	timedflag = true;
+	cv_signal(timedcv, timedlock);
+	lock_release(timedlock);
+	P(timeddone);
+
+	/* Timeouts colliding with broadcasts. */
+	timedstop = false;
+	for (i=0; i<NTIMEDTHREADS; i++) {
+		result = thread_fork("timedcv", NULL, timedcvstorm, NULL, i);
+		if (result) {
+			panic("timedcvtest: thread_fork failed: %s\n",
+			      strerror(result));
+		}
+	}
+	result = thread_fork("timedcv", NULL, timedcvbroadcaster, NULL, 0);
+	if (result) {
+		panic("timedcvtest: thread_fork failed: %s\n",
+		      strerror(result));
+	}
+	for (i=0; i<NTIMEDTHREADS; i++) {
+		P(timeddone);
+	}
+	timedstop = true;
+	P(timeddone);
+
+	lock_destroy(timedlock);
+	cv_destroy(timedcv);
+	sem_destroy(timeddone);
+	kprintf(timedfailed ? "Timed CV test FAILED\n" :
+		"Timed CV test done\n");
+	return 0;
+}
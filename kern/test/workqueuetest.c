@@ -0,0 +1,147 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Workqueue test code.
+ */
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <cpu.h>
+#include <spinlock.h>
+#include <thread.h>
+#include <current.h>
+#include <workqueue.h>
+#include <test.h>
+
+#define NITEMS    32	/* per cpu */
+#define NDEFERRED 64
+
+static struct spinlock wqtest_lock = SPINLOCK_INITIALIZER;
+static unsigned wqtest_ran;
+static unsigned wqtest_wrongcpu;
+static unsigned wqtest_deferred;
+
+static
+void
+wqtest_item(void *data1, unsigned long data2)
+{
+	struct cpu *c = data1;
+
+	(void)data2;
+
+	spinlock_acquire(&wqtest_lock);
+	wqtest_ran++;
+	if (curcpu->c_self != c) {
+		wqtest_wrongcpu++;
+	}
+	spinlock_release(&wqtest_lock);
+}
+
+static
+void
+wqtest_defer(void *data1, unsigned long data2)
+{
+	(void)data1;
+
+	spinlock_acquire(&wqtest_lock);
+	wqtest_deferred += data2;
+	spinlock_release(&wqtest_lock);
+}
+
+int
+workqueuetest(int nargs, char **args)
+{
+	struct work *items;
+	struct cpu *c;
+	unsigned i, j, numcpus, expected;
+	bool ok = true;
+
+	(void)nargs;
+	(void)args;
+
+	kprintf("Starting workqueue test...\n");
+
+	numcpus = cpu_count();
+	items = kmalloc(numcpus * NITEMS * sizeof(*items));
+	if (items == NULL) {
+		kprintf("workqueuetest: Out of memory\n");
+		return ENOMEM;
+	}
+
+	wqtest_ran = wqtest_wrongcpu = wqtest_deferred = 0;
+
+	/* Queue a burst on every cpu. */
+	for (i=0; i<numcpus; i++) {
+		c = cpu_get(i);
+		for (j=0; j<NITEMS; j++) {
+			work_init(&items[i*NITEMS + j], wqtest_item, c, j);
+			if (!work_queue_on(c, &items[i*NITEMS + j])) {
+				kprintf("workqueuetest: fresh item was pending\n");
+				ok = false;
+			}
+		}
+	}
+
+	/* And some one-shot items from here. */
+	expected = 0;
+	for (i=0; i<NDEFERRED; i++) {
+		work_defer(wqtest_defer, NULL, i);
+		expected += i;
+	}
+
+	workqueue_flush();
+
+	spinlock_acquire(&wqtest_lock);
+	if (wqtest_ran != numcpus * NITEMS) {
+		kprintf("workqueuetest: %u of %u items ran\n",
+			wqtest_ran, numcpus * NITEMS);
+		ok = false;
+	}
+	if (wqtest_wrongcpu != 0) {
+		kprintf("workqueuetest: %u items ran on the wrong cpu\n",
+			wqtest_wrongcpu);
+		ok = false;
+	}
+	if (wqtest_deferred != expected) {
+		kprintf("workqueuetest: deferred sum %u, expected %u\n",
+			wqtest_deferred, expected);
+		ok = false;
+	}
+	spinlock_release(&wqtest_lock);
+
+	for (i=0; i<numcpus * NITEMS; i++) {
+		KASSERT(!items[i].w_pending);
+	}
+	kfree(items);
+
+	workqueue_printstats();
+	kprintf("Workqueue test %s.\n", ok ? "done" : "FAILED");
+	return 0;
+}
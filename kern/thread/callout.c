@@ -0,0 +1,338 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Callouts, kept in a per-cpu hierarchical timing wheel.
+ *
+ * The wheel has CW_LEVELS levels of CW_SLOTS slots each. Level 0
+ * holds callouts due within the next CW_SLOTS hardclocks, one slot
+ * per hardclock; each higher level covers CW_SLOTS times the span of
+ * the one below with the same number of slots. Whenever level 0 comes
+ * round to slot 0, the current slot of level 1 is emptied and its
+ * callouts reinserted, which drops them to level 0 (and likewise up
+ * the levels). A callout is therefore moved at most CW_LEVELS-1 times
+ * before it runs, and insert and remove are constant time list
+ * operations.
+ *
+ * The wheel reaches CW_MAXDELTA (2^24 - 1) hardclocks ahead. Callouts
+ * further out than that are parked in the furthest slot of the top
+ * level, keeping their real expiry time. When that slot is cascaded
+ * they are re-armed from there, as many times as it takes, and work
+ * their way down once they are within reach.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <cpu.h>
+#include <spl.h>
+#include <spinlock.h>
+#include <thread.h>
+#include <current.h>
+#include <callout.h>
+
+#define CW_BITS		6
+#define CW_SLOTS	(1 << CW_BITS)
+#define CW_MASK		(CW_SLOTS - 1)
+#define CW_LEVELS	4
+#define CW_MAXDELTA	((1U << (CW_BITS * CW_LEVELS)) - 1)
+
+struct callwheel {
+	struct spinlock cw_lock;
+	unsigned cw_now;		/* Next hardclock to process */
+	unsigned cw_count;		/* Callouts pending */
+	struct callout *cw_running;	/* Callout being run right now */
+	struct callout *cw_slots[CW_LEVELS][CW_SLOTS];
+};
+
+/*
+ * Put a callout in the right slot for its expiry time. Callouts
+ * already due go in the current slot; ones out of reach go in the
+ * top level's furthest slot, without changing co_expire.
+ */
+static
+void
+callwheel_insert(struct callwheel *cw, struct callout *co)
+{
+	unsigned delta, level, slot, when;
+	struct callout **head;
+
+	KASSERT(spinlock_do_i_hold(&cw->cw_lock));
+
+	delta = co->co_expire - cw->cw_now;
+	if ((int)delta < 0) {
+		co->co_expire = cw->cw_now;
+		delta = 0;
+	}
+	when = co->co_expire;
+	if (delta > CW_MAXDELTA) {
+		when = cw->cw_now + CW_MAXDELTA;
+		delta = CW_MAXDELTA;
+	}
+
+	for (level = 0; level < CW_LEVELS - 1; level++) {
+		if (delta < (1U << (CW_BITS * (level + 1)))) {
+			break;
+		}
+	}
+	slot = (when >> (CW_BITS * level)) & CW_MASK;
+
+	head = &cw->cw_slots[level][slot];
+	co->co_next = *head;
+	if (co->co_next != NULL) {
+		co->co_next->co_prevp = &co->co_next;
+	}
+	co->co_prevp = head;
+	*head = co;
+}
+
+static
+void
+callwheel_remove(struct callwheel *cw, struct callout *co)
+{
+	KASSERT(spinlock_do_i_hold(&cw->cw_lock));
+	KASSERT(co->co_prevp != NULL);
+
+	*co->co_prevp = co->co_next;
+	if (co->co_next != NULL) {
+		co->co_next->co_prevp = co->co_prevp;
+	}
+	co->co_next = NULL;
+	co->co_prevp = NULL;
+}
+
+/*
+ * Move the callouts in the current slot of LEVEL down a level.
+ * Returns the slot index, so the caller knows whether the level
+ * above needs to cascade as well.
+ */
+static
+unsigned
+callwheel_cascade(struct callwheel *cw, unsigned level)
+{
+	struct callout *co, *next;
+	unsigned slot;
+
+	slot = (cw->cw_now >> (CW_BITS * level)) & CW_MASK;
+	co = cw->cw_slots[level][slot];
+	cw->cw_slots[level][slot] = NULL;
+	for (; co != NULL; co = next) {
+		next = co->co_next;
+		callwheel_insert(cw, co);
+	}
+	return slot;
+}
+
+struct callwheel *
+callwheel_create(void)
+{
+	struct callwheel *cw;
+	unsigned i, j;
+
+	cw = kmalloc(sizeof(*cw));
+	if (cw == NULL) {
+		return NULL;
+	}
+	spinlock_init(&cw->cw_lock);
+	cw->cw_now = 0;
+	cw->cw_count = 0;
+	cw->cw_running = NULL;
+	for (i=0; i<CW_LEVELS; i++) {
+		for (j=0; j<CW_SLOTS; j++) {
+			cw->cw_slots[i][j] = NULL;
+		}
+	}
+	return cw;
+}
+
+void
+callout_init(struct callout *co,
+	     void (*func)(void *data1, unsigned long data2),
+	     void *data1, unsigned long data2)
+{
+	co->co_next = NULL;
+	co->co_prevp = NULL;
+	co->co_cpu = NULL;
+	co->co_expire = 0;
+	co->co_func = func;
+	co->co_data1 = data1;
+	co->co_data2 = data2;
+}
+
+void
+callout_schedule(struct callout *co, unsigned ticks)
+{
+	struct callwheel *cw;
+	int spl;
+
+	/* Take it off whatever wheel it's on now. */
+	callout_stop(co);
+
+	/* Stay on this cpu until we're on its wheel. */
+	spl = splhigh();
+	cw = curcpu->c_callwheel;
+	spinlock_acquire(&cw->cw_lock);
+	/*
+	 * Count from the hardclock we're in now, not from cw_now,
+	 * which lags behind while the cpu is tickless.
+	 */
+	co->co_cpu = curcpu->c_self;
+	co->co_expire = curcpu->c_hardclocks + (ticks > 0 ? ticks : 1);
+	callwheel_insert(cw, co);
+	cw->cw_count++;
+	spinlock_release(&cw->cw_lock);
+	splx(spl);
+}
+
+bool
+callout_stop(struct callout *co)
+{
+	struct callwheel *cw;
+	bool wasqueued;
+
+	if (co->co_cpu == NULL) {
+		/* Never scheduled. */
+		return false;
+	}
+	cw = co->co_cpu->c_callwheel;
+
+	spinlock_acquire(&cw->cw_lock);
+	wasqueued = (co->co_prevp != NULL);
+	if (wasqueued) {
+		callwheel_remove(cw, co);
+		cw->cw_count--;
+	}
+	else if (co->co_cpu != curcpu->c_self) {
+		/*
+		 * It may be running on its own cpu right now; wait for
+		 * it to finish. (On this cpu, if it's running, we're
+		 * being called from it.)
+		 */
+		while (cw->cw_running == co) {
+			spinlock_release(&cw->cw_lock);
+			spinlock_acquire(&cw->cw_lock);
+		}
+	}
+	spinlock_release(&cw->cw_lock);
+	return wasqueued;
+}
+
+bool
+callout_pending(struct callout *co)
+{
+	return co->co_prevp != NULL;
+}
+
+/*
+ * Run everything due up to and including the current hardclock.
+ * Called on every hardclock, and when a tickless cpu wakes up.
+ */
+void
+callout_hardclock(void)
+{
+	struct callwheel *cw;
+	struct callout *co;
+	unsigned slot, now;
+	void (*func)(void *, unsigned long);
+	void *data1;
+	unsigned long data2;
+
+	cw = curcpu->c_callwheel;
+	now = curcpu->c_hardclocks;
+
+	spinlock_acquire(&cw->cw_lock);
+	while ((int)(now - cw->cw_now) >= 0) {
+		if (cw->cw_count == 0) {
+			/* Nothing pending; skip ahead. */
+			cw->cw_now = now + 1;
+			break;
+		}
+
+		slot = cw->cw_now & CW_MASK;
+		if (slot == 0 &&
+		    callwheel_cascade(cw, 1) == 0 &&
+		    callwheel_cascade(cw, 2) == 0) {
+			callwheel_cascade(cw, 3);
+		}
+
+		while ((co = cw->cw_slots[0][slot]) != NULL) {
+			callwheel_remove(cw, co);
+			cw->cw_count--;
+			func = co->co_func;
+			data1 = co->co_data1;
+			data2 = co->co_data2;
+			cw->cw_running = co;
+			spinlock_release(&cw->cw_lock);
+
+			func(data1, data2);
+
+			spinlock_acquire(&cw->cw_lock);
+			cw->cw_running = NULL;
+		}
+		cw->cw_now++;
+	}
+	spinlock_release(&cw->cw_lock);
+}
+
+/*
+ * How many hardclocks from now until something might need doing.
+ * Anything due within level 0 is found exactly; otherwise we wake up
+ * for the next cascade, which is at most CW_SLOTS hardclocks away.
+ */
+unsigned
+callout_nextdue(void)
+{
+	struct callwheel *cw;
+	unsigned now, i, ret;
+
+	cw = curcpu->c_callwheel;
+	now = curcpu->c_hardclocks;
+
+	spinlock_acquire(&cw->cw_lock);
+	if (cw->cw_count == 0) {
+		ret = 0;
+	}
+	else if ((int)(now - cw->cw_now) >= 0) {
+		/* Behind; catch up on the next hardclock. */
+		ret = 1;
+	}
+	else {
+		ret = CW_SLOTS - (cw->cw_now & CW_MASK);
+		for (i = 0; i < ret; i++) {
+			if (cw->cw_slots[0][(cw->cw_now + i) & CW_MASK]
+			    != NULL) {
+				ret = i;
+				break;
+			}
+		}
+		/* cw_now is the hardclock after now */
+		ret += cw->cw_now - now;
+	}
+	spinlock_release(&cw->cw_lock);
+	return ret;
+}
@@ -34,13 +34,15 @@
 #include <clock.h>
 #include <thread.h>
 #include <current.h>
+#include <mainbus.h>
+#include <callout.h>
 
 /*
  * Time handling.
  *
- * This is pretty primitive. A real kernel will typically have some
- * kind of support for scheduling callbacks to happen at specific
- * points in the future, usually with more resolution that one second.
+ * Callbacks at specific points in the future are callouts (see
+ * callout.c), which have hardclock resolution; timed sleeps are built
+ * on those.
  *
  * A real kernel also has to maintain the time of day; in OS/161 we
  * skimp on that because we have a known-good hardware clock.
@@ -51,13 +53,19 @@
  * the scheduler.
  */
 #define SCHEDULE_HARDCLOCKS	4	/* Reschedule every 4 hardclocks. */
-#define MIGRATE_HARDCLOCKS	16	/* Migrate every 16 hardclocks. */
+#define MIGRATE_HARDCLOCKS	4	/* Poke idle cpus every 4 hardclocks. */
 
 /*
  * Once a second, everything waiting on lbolt is awakened by CPU 0.
  */
 static struct wchan *lbolt;
 
+/*
+ * Threads in clocksleep_ms wait here. Nobody wakes it; they leave
+ * when their timeouts expire.
+ */
+static struct wchan *sleepchan;
+
 /*
  * Setup.
  */
@@ -68,6 +76,10 @@ hardclock_bootstrap(void)
 	if (lbolt == NULL) {
 		panic("Couldn't create lbolt\n");
 	}
+	sleepchan = wchan_create("clocksleep");
+	if (sleepchan == NULL) {
+		panic("Couldn't create clocksleep channel\n");
+	}
 }
 
 /*
@@ -93,13 +105,94 @@ hardclock(void)
 	 */
 
 	curcpu->c_hardclocks++;
+	callout_hardclock();
 	if ((curcpu->c_hardclocks % SCHEDULE_HARDCLOCKS) == 0) {
 		schedule();
 	}
 	if ((curcpu->c_hardclocks % MIGRATE_HARDCLOCKS) == 0) {
 		thread_consider_migration();
 	}
-	thread_yield();
+	thread_gang_tick();
+	/*
+	 * Charge the tick to the current thread; switch away only if
+	 * its quantum ran out or something more important is waiting.
+	 * RCU readers aren't preempted; they'll be asked again next tick.
+	 */
+	if (thread_quantum_tick() && curthread->t_rcudepth == 0) {
+		thread_yield();
+	}
+}
+
+/*
+ * Stop hardclock on this cpu because it's about to idle. Called from
+ * the idle loop with interrupts off. If callouts are pending, the
+ * timer is left to go off when the first one is due.
+ */
+void
+hardclock_stop(void)
+{
+	KASSERT(curthread->t_curspl > 0);
+	KASSERT(!curcpu->c_tickless);
+
+	curcpu->c_tickless = true;
+	mainbus_timer_stop(callout_nextdue());
+}
+
+/*
+ * Restart hardclock when the idle loop wakes up, and account for the
+ * ticks we slept through.
+ */
+void
+hardclock_restart(void)
+{
+	KASSERT(curthread->t_curspl > 0);
+	KASSERT(curcpu->c_tickless);
+
+	hardclock_skip(mainbus_timer_restart());
+	curcpu->c_tickless = false;
+}
+
+/*
+ * Account for hardclocks that didn't happen. They're still counted
+ * in c_hardclocks, which is used as this cpu's notion of time, and
+ * any callouts that came due in them are run now.
+ */
+void
+hardclock_skip(unsigned ticks)
+{
+	curcpu->c_hardclocks += ticks;
+	curcpu->c_ticksskipped += ticks;
+	callout_hardclock();
+}
+
+/*
+ * Convert milliseconds to hardclocks, rounding up. Very long times
+ * come out as HARDCLOCKS_MAX rather than wrapping around, so callers
+ * can still add a tick or two.
+ */
+#define HARDCLOCKS_MAX	((unsigned)-1 / 4)
+
+unsigned
+mstohardclocks(unsigned ms)
+{
+	if (ms / 1000 >= HARDCLOCKS_MAX / HZ) {
+		return HARDCLOCKS_MAX;
+	}
+	return (ms / 1000) * HZ + DIVROUNDUP((ms % 1000) * HZ, 1000);
+}
+
+/*
+ * Suspend execution for at least MS milliseconds. We're partway
+ * through the current hardclock, so it doesn't count.
+ */
+void
+clocksleep_ms(unsigned ms)
+{
+	if (ms == 0) {
+		return;
+	}
+	wchan_lock(sleepchan);
+	wchan_timedsleep(sleepchan, mstohardclocks(ms) + 1);
 }
 
 /*
@@ -108,9 +201,7 @@ hardclock(void)
 void
 clocksleep(int num_secs)
 {
-	while (num_secs > 0) {
-		wchan_lock(lbolt);
-		wchan_sleep(lbolt);
-		num_secs--;
+	if (num_secs > 0) {
+		clocksleep_ms((unsigned)num_secs * 1000);
 	}
 }
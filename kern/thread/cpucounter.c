@@ -0,0 +1,86 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Per-cpu counters. See cpucounter.h.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <spl.h>
+#include <cpu.h>
+#include <current.h>
+#include <cpucounter.h>
+
+void
+cpucounter_add(unsigned which, unsigned n)
+{
+	int spl;
+
+	KASSERT(which < CPUCOUNTER_COUNT);
+
+	/* Stay on this cpu until the store is done. */
+	spl = splhigh();
+	curcpu->c_counters[which] += n;
+	splx(spl);
+}
+
+void
+cpucounter_inc(unsigned which)
+{
+	cpucounter_add(which, 1);
+}
+
+unsigned
+cpucounter_read(unsigned which)
+{
+	unsigned i, numcpus, total;
+
+	KASSERT(which < CPUCOUNTER_COUNT);
+
+	total = 0;
+	numcpus = cpu_count();
+	for (i=0; i<numcpus; i++) {
+		total += cpu_get(i)->c_counters[which];
+	}
+	return total;
+}
+
+void
+cpucounter_reset(unsigned which)
+{
+	unsigned i, numcpus;
+
+	KASSERT(which < CPUCOUNTER_COUNT);
+
+	numcpus = cpu_count();
+	for (i=0; i<numcpus; i++) {
+		cpu_get(i)->c_counters[which] = 0;
+	}
+}
@@ -0,0 +1,281 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Lock contention statistics. See lockstat.h.
+ */
+#include <types.h>
+#include <lib.h>
+#include <spl.h>
+#include <clock.h>
+#include <spinlock.h>
+#include <lockstat.h>
+
+/*
+ * The table of records. Records are never freed; once the table is
+ * full, new locks just don't get one.
+ *
+ * The table is looked up from inside spinlock_acquire, so it can't
+ * be protected by a spinlock. It has a bare test-and-set lock of its
+ * own instead, always taken with interrupts off.
+ */
+static struct lockstat lockstat_table[LOCKSTAT_MAX];
+static unsigned lockstat_count;
+static unsigned lockstat_dropped;
+static volatile spinlock_data_t lockstat_tablelock = SPINLOCK_DATA_INITIALIZER;
+
+/*
+ * Wait times are only measured once the clock exists.
+ */
+static volatile bool lockstat_timing;
+
+static
+int
+lockstat_lockup(void)
+{
+	int spl;
+
+	spl = splhigh();
+	while (spinlock_data_get(&lockstat_tablelock) != 0 ||
+	       spinlock_data_testandset(&lockstat_tablelock) != 0) {
+		/* nothing */
+	}
+	return spl;
+}
+
+static
+void
+lockstat_unlock(int spl)
+{
+	spinlock_data_set(&lockstat_tablelock, 0);
+	splx(spl);
+}
+
+void
+lockstat_bootstrap(void)
+{
+	lockstat_timing = true;
+}
+
+/*
+ * Copy NAME into DEST, truncating it to fit.
+ */
+static
+void
+lockstat_copyname(char *dest, const char *name)
+{
+	unsigned i;
+
+	for (i=0; i<LOCKSTAT_NAMELEN-1 && name[i] != 0; i++) {
+		dest[i] = name[i];
+	}
+	dest[i] = 0;
+}
+
+/*
+ * Find a free record and fill in its identity. Table lock held.
+ */
+static
+struct lockstat *
+lockstat_new(const char *kind, const char *name, const void *addr)
+{
+	struct lockstat *ls;
+
+	if (lockstat_count == LOCKSTAT_MAX) {
+		lockstat_dropped++;
+		return NULL;
+	}
+	ls = &lockstat_table[lockstat_count++];
+	lockstat_copyname(ls->ls_name, name);
+	ls->ls_kind = kind;
+	ls->ls_addr = addr;
+	ls->ls_acquires = 0;
+	ls->ls_contended = 0;
+	ls->ls_spins = 0;
+	ls->ls_waitns = 0;
+	return ls;
+}
+
+/*
+ * Get the record for the lock or semaphore named NAME, making it if
+ * need be. Called when the lock is created.
+ */
+struct lockstat *
+lockstat_lookup(const char *kind, const char *name)
+{
+	char shortname[LOCKSTAT_NAMELEN];
+	struct lockstat *ls;
+	unsigned i;
+	int spl;
+
+	lockstat_copyname(shortname, name);
+
+	spl = lockstat_lockup();
+	for (i=0; i<lockstat_count; i++) {
+		ls = &lockstat_table[i];
+		if (ls->ls_addr == NULL && ls->ls_kind == kind &&
+		    !strcmp(ls->ls_name, shortname)) {
+			lockstat_unlock(spl);
+			return ls;
+		}
+	}
+	ls = lockstat_new(kind, shortname, NULL);
+	lockstat_unlock(spl);
+
+	return ls;
+}
+
+/*
+ * Make a record for the spinlock at ADDR, first contended when
+ * called from CALLER. Called from spinlock_acquire with the spinlock
+ * held, so this can't race with itself for the same spinlock.
+ */
+struct lockstat *
+lockstat_spinlock(const void *addr, const void *caller)
+{
+	char name[LOCKSTAT_NAMELEN];
+	struct lockstat *ls;
+	int spl;
+
+	snprintf(name, sizeof(name), "%lx by %lx",
+		 (unsigned long)addr, (unsigned long)caller);
+
+	spl = lockstat_lockup();
+	ls = lockstat_new("spinlock", name, addr);
+	lockstat_unlock(spl);
+
+	return ls;
+}
+
+/*
+ * Note the time a wait started.
+ */
+void
+lockstat_waitbegin(struct lockstat_wait *lw)
+{
+	lw->lw_valid = lockstat_timing;
+	if (lw->lw_valid) {
+		gettime(&lw->lw_secs, &lw->lw_nsecs);
+	}
+}
+
+/*
+ * Record a finished wait of SPINS spin loop turns that started at LW.
+ * The caller holds the lock the record belongs to.
+ */
+void
+lockstat_waitend(struct lockstat *ls, const struct lockstat_wait *lw,
+		 unsigned spins)
+{
+	time_t secs, rsecs;
+	uint32_t nsecs, rnsecs;
+
+	if (ls == NULL) {
+		return;
+	}
+	ls->ls_contended++;
+	ls->ls_spins += spins;
+	if (lw->lw_valid) {
+		gettime(&secs, &nsecs);
+		getinterval(lw->lw_secs, lw->lw_nsecs, secs, nsecs,
+			    &rsecs, &rnsecs);
+		ls->ls_waitns += (uint64_t)rsecs * 1000000000 + rnsecs;
+	}
+}
+
+/*
+ * Zero all the counts. The records themselves stay, since locks
+ * point at them.
+ */
+void
+lockstat_reset(void)
+{
+	struct lockstat *ls;
+	unsigned i;
+	int spl;
+
+	spl = lockstat_lockup();
+	for (i=0; i<lockstat_count; i++) {
+		ls = &lockstat_table[i];
+		ls->ls_acquires = 0;
+		ls->ls_contended = 0;
+		ls->ls_spins = 0;
+		ls->ls_waitns = 0;
+	}
+	lockstat_dropped = 0;
+	lockstat_unlock(spl);
+}
+
+/*
+ * Print the TOPN records with the most wait time, most first.
+ *
+ * This is a selection over the whole table for each line printed,
+ * which is fine for a debugging command. The counts are read without
+ * locking and may be a little stale.
+ */
+void
+lockstat_print(unsigned topn)
+{
+	bool shown[LOCKSTAT_MAX];
+	struct lockstat *ls, *best;
+	unsigned i, n, count;
+
+	count = lockstat_count;
+	for (i=0; i<count; i++) {
+		shown[i] = false;
+	}
+
+	kprintf("%-24s %-8s %10s %10s %12s %12s\n", "name", "kind",
+		"acquires", "contended", "spins", "wait (us)");
+	for (n=0; n<topn; n++) {
+		best = NULL;
+		for (i=0; i<count; i++) {
+			ls = &lockstat_table[i];
+			if (shown[i] || ls->ls_contended == 0) {
+				continue;
+			}
+			if (best == NULL || ls->ls_waitns > best->ls_waitns ||
+			    (ls->ls_waitns == best->ls_waitns &&
+			     ls->ls_contended > best->ls_contended)) {
+				best = ls;
+			}
+		}
+		if (best == NULL) {
+			break;
+		}
+		shown[best - lockstat_table] = true;
+		kprintf("%-24s %-8s %10u %10u %12llu %12llu\n",
+			best->ls_name, best->ls_kind, best->ls_acquires,
+			best->ls_contended,
+			(unsigned long long)best->ls_spins,
+			(unsigned long long)(best->ls_waitns / 1000));
+	}
+	kprintf("%u locks recorded, %u not recorded for lack of space\n",
+		count, lockstat_dropped);
+}
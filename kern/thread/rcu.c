@@ -0,0 +1,257 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Read-copy-update. See rcu.h.
+ */
+#include <types.h>
+#include <lib.h>
+#include <cpu.h>
+#include <spinlock.h>
+#include <wchan.h>
+#include <thread.h>
+#include <current.h>
+#include <callout.h>
+#include <rcu.h>
+
+/*
+ * Items handed to call_rcu wait on rcu_next until a grace period
+ * starts, then on rcu_cur until it ends. Starting a grace period
+ * snapshots every cpu's c_rcuqs count of quiescent states into
+ * c_rcusnap; it ends when each cpu's count has moved or the cpu is
+ * idle.
+ *
+ * rcu_callout runs once a hardclock, on whichever cpu last scheduled
+ * it, while anything is waiting. rcu_ticking says it is scheduled or
+ * still running. It is only cleared by the callout, once it has
+ * nothing left to do, including running the finished callbacks; and
+ * call_rcu only schedules the callout when it is clear. So call_rcu
+ * never finds the callout running on another cpu, and its
+ * callout_schedule never waits for it with rcu_lock held. The
+ * callout reschedules itself on its own cpu, which doesn't wait
+ * either.
+ */
+static struct spinlock rcu_lock = SPINLOCK_INITIALIZER;
+static struct rcu_head *rcu_next;
+static struct rcu_head *rcu_cur;
+static bool rcu_gp;
+static bool rcu_ticking;
+static struct callout rcu_callout;
+static unsigned rcu_gpcount;
+
+/* rcu_synchronize sleeps here */
+static struct wchan *rcu_syncwchan;
+
+static void rcu_tick(void *data1, unsigned long data2);
+
+void
+rcu_bootstrap(void)
+{
+	rcu_syncwchan = wchan_create("rcu_synchronize");
+	if (rcu_syncwchan == NULL) {
+		panic("rcu_bootstrap: Out of memory\n");
+	}
+	callout_init(&rcu_callout, rcu_tick, NULL, 0);
+}
+
+void
+rcu_read_lock(void)
+{
+	curthread->t_rcudepth++;
+}
+
+void
+rcu_read_unlock(void)
+{
+	KASSERT(curthread->t_rcudepth > 0);
+	curthread->t_rcudepth--;
+}
+
+/*
+ * Begin a grace period for everything on rcu_next.
+ */
+static
+void
+rcu_gp_start(void)
+{
+	unsigned i, num;
+	struct cpu *c;
+
+	KASSERT(spinlock_do_i_hold(&rcu_lock));
+	KASSERT(!rcu_gp);
+
+	num = cpu_count();
+	for (i=0; i<num; i++) {
+		c = cpu_get(i);
+		c->c_rcusnap = c->c_rcuqs;
+	}
+	rcu_cur = rcu_next;
+	rcu_next = NULL;
+	rcu_gp = true;
+}
+
+/*
+ * Check whether every cpu has been quiescent since the grace period
+ * started. An idle cpu counts, as it can't be inside a read section.
+ */
+static
+bool
+rcu_gp_over(void)
+{
+	unsigned i, num;
+	struct cpu *c;
+
+	KASSERT(spinlock_do_i_hold(&rcu_lock));
+
+	num = cpu_count();
+	for (i=0; i<num; i++) {
+		c = cpu_get(i);
+		if (c->c_rcuqs == c->c_rcusnap && !c->c_isidle) {
+			return false;
+		}
+	}
+	return true;
+}
+
+/*
+ * The callout: end the grace period if we can, run what was waiting
+ * for it, and start the next one.
+ */
+static
+void
+rcu_tick(void *data1, unsigned long data2)
+{
+	struct rcu_head *done, *next;
+
+	(void)data1;
+	(void)data2;
+
+	done = NULL;
+	spinlock_acquire(&rcu_lock);
+	KASSERT(rcu_ticking);
+	if (rcu_gp && rcu_gp_over()) {
+		done = rcu_cur;
+		rcu_cur = NULL;
+		rcu_gp = false;
+		rcu_gpcount++;
+	}
+	if (!rcu_gp && rcu_next != NULL) {
+		rcu_gp_start();
+	}
+	if (rcu_gp) {
+		callout_schedule(&rcu_callout, 1);
+	}
+	else if (done == NULL) {
+		rcu_ticking = false;
+	}
+	spinlock_release(&rcu_lock);
+
+	if (done == NULL) {
+		return;
+	}
+	for (; done != NULL; done = next) {
+		next = done->rh_next;
+		done->rh_func(done);
+	}
+
+	/*
+	 * If we didn't reschedule, we're still marked as ticking;
+	 * start on whatever was queued meanwhile, or stop.
+	 */
+	spinlock_acquire(&rcu_lock);
+	if (!rcu_gp) {
+		if (rcu_next != NULL) {
+			rcu_gp_start();
+			callout_schedule(&rcu_callout, 1);
+		}
+		else {
+			rcu_ticking = false;
+		}
+	}
+	spinlock_release(&rcu_lock);
+}
+
+void
+call_rcu(struct rcu_head *rh, void (*func)(struct rcu_head *rh))
+{
+	rh->rh_func = func;
+
+	spinlock_acquire(&rcu_lock);
+	rh->rh_next = rcu_next;
+	rcu_next = rh;
+	if (!rcu_ticking) {
+		rcu_ticking = true;
+		callout_schedule(&rcu_callout, 1);
+	}
+	spinlock_release(&rcu_lock);
+}
+
+/*
+ * For rcu_synchronize.
+ */
+struct rcu_sync {
+	struct rcu_head rs_head;	/* must be first */
+	volatile bool rs_done;
+};
+
+static
+void
+rcu_sync_done(struct rcu_head *rh)
+{
+	struct rcu_sync *rs = (struct rcu_sync *)rh;
+
+	rs->rs_done = true;
+	/* RS may be gone as soon as rs_done is set */
+	wchan_wakeall(rcu_syncwchan);
+}
+
+void
+rcu_synchronize(void)
+{
+	struct rcu_sync rs;
+
+	KASSERT(curthread->t_rcudepth == 0);
+	KASSERT(curthread->t_in_interrupt == false);
+
+	rs.rs_done = false;
+	call_rcu(&rs.rs_head, rcu_sync_done);
+
+	wchan_lock(rcu_syncwchan);
+	while (!rs.rs_done) {
+		wchan_sleep(rcu_syncwchan);
+		wchan_lock(rcu_syncwchan);
+	}
+	wchan_unlock(rcu_syncwchan);
+}
+
+void
+rcu_printstats(void)
+{
+	kprintf("rcu: %u grace periods\n", rcu_gpcount);
+}
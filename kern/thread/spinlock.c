@@ -36,10 +36,15 @@
 #include <spl.h>
 #include <spinlock.h>
 #include <current.h>	/* for curcpu */
+#include <lockstat.h>
 
 /*
  * Spinlocks.
+ *
+ * SPINLOCK_BACKOFF is how many loop turns a waiter sits out for each
+ * cpu ahead of it in line before looking at lk_serving again.
  */
+#define SPINLOCK_BACKOFF	16
 
 
 /*
@@ -48,8 +53,12 @@
 void
 spinlock_init(struct spinlock *lk)
 {
-	spinlock_data_set(&lk->lk_lock, 0);
+	spinlock_data_set(&lk->lk_next, 0);
+	spinlock_data_set(&lk->lk_serving, 0);
 	lk->lk_holder = NULL;
+#if OPT_LOCKSTAT
+	lk->lk_stat = NULL;
+#endif
 }
 
 /*
@@ -59,7 +68,8 @@ void
 spinlock_cleanup(struct spinlock *lk)
 {
 	KASSERT(lk->lk_holder == NULL);
-	KASSERT(spinlock_data_get(&lk->lk_lock) == 0);
+	KASSERT(spinlock_data_get(&lk->lk_next) ==
+		spinlock_data_get(&lk->lk_serving));
 }
 
 /*
@@ -67,12 +77,16 @@ spinlock_cleanup(struct spinlock *lk)
  *
  * First disable interrupts (otherwise, if we get a timer interrupt we
  * might come back to this lock and deadlock), then use a machine-level
- * atomic operation to wait for the lock to be free.
+ * atomic operation to take a ticket, and wait for it to come up.
  */
 void
 spinlock_acquire(struct spinlock *lk)
 {
 	struct cpu *mycpu;
+	spinlock_data_t ticket, ahead;
+	volatile unsigned i;
+	unsigned spins;
+	LOCKSTAT_WAITVAR(lw);
 
 	splraise(IPL_NONE, IPL_HIGH);
 
@@ -87,27 +101,40 @@ spinlock_acquire(struct spinlock *lk)
 		mycpu = NULL;
 	}
 
+	/*
+	 * Fetch-and-increment is a machine-level atomic operation
+	 * that adds 1 to lk_next and returns the previous value,
+	 * which is our place in line. Tickets wrap around; only the
+	 * difference from lk_serving matters.
+	 */
+	ticket = spinlock_data_fetchinc(&lk->lk_next);
+	spins = 0;
 	while (1) {
-		/*
-		 * Do test-test-and-set, that is, read first before
-		 * doing test-and-set, to reduce bus contention.
-		 *
-		 * Test-and-set is a machine-level atomic operation
-		 * that writes 1 into the lock word and returns the
-		 * previous value. If that value was 0, the lock was
-		 * previously unheld and we now own it. If it was 1,
-		 * we don't.
-		 */
-		if (spinlock_data_get(&lk->lk_lock) != 0) {
-			continue;
+		ahead = ticket - spinlock_data_get(&lk->lk_serving);
+		if (ahead == 0) {
+			break;
+		}
+		if (spins == 0) {
+			LOCKSTAT_WAITBEGIN(lw);
 		}
-		if (spinlock_data_testandset(&lk->lk_lock) != 0) {
-			continue;
+		for (i = ahead * SPINLOCK_BACKOFF; i > 0; i--) {
+			/* nothing */
 		}
-		break;
+		spins++;
 	}
 
 	lk->lk_holder = mycpu;
+
+#if OPT_LOCKSTAT
+	if (spins > 0 && lk->lk_stat == NULL) {
+		lk->lk_stat = lockstat_spinlock(lk,
+						__builtin_return_address(0));
+	}
+	LOCKSTAT_ACQUIRED(lk->lk_stat);
+	if (spins > 0) {
+		LOCKSTAT_WAITEND(lk->lk_stat, lw, spins);
+	}
+#endif
 }
 
 /*
@@ -122,7 +149,9 @@ spinlock_release(struct spinlock *lk)
 	}
 
 	lk->lk_holder = NULL;
-	spinlock_data_set(&lk->lk_lock, 0);
+	/* Only the holder writes lk_serving, so no atomic op is needed */
+	spinlock_data_set(&lk->lk_serving,
+			  spinlock_data_get(&lk->lk_serving) + 1);
 	spllower(IPL_HIGH, IPL_NONE);
 }
 
@@ -33,7 +33,9 @@
  */
 
 #include <types.h>
+#include <kern/errno.h>
 #include <lib.h>
+#include <clock.h>
 #include <spinlock.h>
 #include <wchan.h>
 #include <thread.h>
@@ -42,6 +44,64 @@
 
 bool rogersdebug = false;     // dont forget to false it later
 
+////////////////////////////////////////////////////////////
+//
+// Timed waits.
+
+/*
+ * A timed wait can be woken and then find someone else got there
+ * first, and has to go back to sleep for whatever is left of its
+ * time. So we turn the timeout into a deadline on the time-of-day
+ * clock up front, and work out how many hardclocks remain each time
+ * we sleep.
+ */
+struct synch_deadline {
+	time_t sd_secs;
+	uint32_t sd_nsecs;
+};
+
+static
+void
+synch_setdeadline(struct synch_deadline *sd, unsigned ms)
+{
+	gettime(&sd->sd_secs, &sd->sd_nsecs);
+	sd->sd_secs += ms / 1000;
+	sd->sd_nsecs += (ms % 1000) * 1000000;
+	if (sd->sd_nsecs >= 1000000000) {
+		sd->sd_nsecs -= 1000000000;
+		sd->sd_secs++;
+	}
+}
+
+/*
+ * Hardclocks to sleep to get to the deadline, or 0 if it has passed.
+ * As in clocksleep_ms, the current partial hardclock doesn't count.
+ */
+static
+unsigned
+synch_ticksleft(const struct synch_deadline *sd)
+{
+	time_t secs, rsecs;
+	uint32_t nsecs, rnsecs;
+	unsigned ms;
+
+	gettime(&secs, &nsecs);
+	getinterval(secs, nsecs, sd->sd_secs, sd->sd_nsecs, &rsecs, &rnsecs);
+	if (rsecs < 0) {
+		return 0;
+	}
+	if (rsecs >= (time_t)(((unsigned)-1 - 1000) / 1000)) {
+		ms = (unsigned)-1;
+	}
+	else {
+		ms = (unsigned)rsecs * 1000 + DIVROUNDUP(rnsecs, 1000000);
+	}
+	if (ms == 0) {
+		return 0;
+	}
+	return mstohardclocks(ms) + 1;
+}
+
 ////////////////////////////////////////////////////////////
 //
 // Semaphore.
@@ -58,21 +118,13 @@ sem_create(const char *name, int initial_count)
                 return NULL;
         }
 
-        sem->sem_name = kstrdup(name);
-        if (sem->sem_name == NULL) {
-                kfree(sem);
-                return NULL;
-        }
-
-	sem->sem_wchan = wchan_create(sem->sem_name);
-	if (sem->sem_wchan == NULL) {
-		kfree(sem->sem_name);
-		kfree(sem);
-		return NULL;
-	}
+        sem->sem_name = name;
 
 	spinlock_init(&sem->sem_lock);
         sem->sem_count = initial_count;
+#if OPT_LOCKSTAT
+	sem->sem_stat = lockstat_lookup("sem", sem->sem_name);
+#endif
 
         return sem;
 }
@@ -82,16 +134,16 @@ sem_destroy(struct semaphore *sem)
 {
         KASSERT(sem != NULL);
 
-	/* wchan_cleanup will assert if anyone's waiting on it */
 	spinlock_cleanup(&sem->sem_lock);
-	wchan_destroy(sem->sem_wchan);
-        kfree(sem->sem_name);
         kfree(sem);
 }
 
 void 
 P(struct semaphore *sem)
 {
+	bool waited;
+	LOCKSTAT_WAITVAR(lw);
+
         KASSERT(sem != NULL);
 
         /*
@@ -103,12 +155,17 @@ P(struct semaphore *sem)
         KASSERT(curthread->t_in_interrupt == false);
 
 	spinlock_acquire(&sem->sem_lock);
+	waited = false;
         while (sem->sem_count == 0) {
+		if (!waited) {
+			LOCKSTAT_WAITBEGIN(lw);
+			waited = true;
+		}
 		/*
-		 * Bridge to the wchan lock, so if someone else comes
-		 * along in V right this instant the wakeup can't go
-		 * through on the wchan until we've finished going to
-		 * sleep. Note that wchan_sleep unlocks the wchan.
+		 * Bridge to the sleep queue lock, so if someone else
+		 * comes along in V right this instant the wakeup can't
+		 * go through until we've finished going to sleep. Note
+		 * that sleepq_sleep unlocks the sleep queue.
 		 *
 		 * Note that we don't maintain strict FIFO ordering of
 		 * threads going through the semaphore; that is, we
@@ -120,17 +177,72 @@ P(struct semaphore *sem)
 		 * Exercise: how would you implement strict FIFO
 		 * ordering?
 		 */
-		wchan_lock(sem->sem_wchan);
+		sleepq_lock(sem);
 		spinlock_release(&sem->sem_lock);
-                wchan_sleep(sem->sem_wchan);
+                sleepq_sleep(sem, sem->sem_name);
 
 		spinlock_acquire(&sem->sem_lock);
         }
         KASSERT(sem->sem_count > 0);
         sem->sem_count--;
+	LOCKSTAT_ACQUIRED(sem->sem_stat);
+	if (waited) {
+		LOCKSTAT_WAITEND(sem->sem_stat, lw, 0);
+	}
 	spinlock_release(&sem->sem_lock);
 }
 
+/*
+ * P with a timeout. A V racing with the timeout is never lost: it
+ * raises the count whether or not its wakeup finds us still on the
+ * channel, and we look at the count once more before giving up.
+ */
+int
+P_timed(struct semaphore *sem, unsigned ms)
+{
+	struct synch_deadline sd;
+	unsigned ticks;
+	bool waited;
+	LOCKSTAT_WAITVAR(lw);
+
+	KASSERT(sem != NULL);
+	/* May not block in an interrupt handler. */
+	KASSERT(curthread->t_in_interrupt == false);
+
+	synch_setdeadline(&sd, ms);
+
+	spinlock_acquire(&sem->sem_lock);
+	waited = false;
+	while (sem->sem_count == 0) {
+		ticks = (ms == 0) ? 0 : synch_ticksleft(&sd);
+		if (ticks == 0) {
+			if (waited) {
+				LOCKSTAT_WAITEND(sem->sem_stat, lw, 0);
+			}
+			spinlock_release(&sem->sem_lock);
+			return ETIMEDOUT;
+		}
+		if (!waited) {
+			LOCKSTAT_WAITBEGIN(lw);
+			waited = true;
+		}
+		/* Bridge to the sleep queue lock, as in P. */
+		sleepq_lock(sem);
+		spinlock_release(&sem->sem_lock);
+		sleepq_timedsleep(sem, sem->sem_name, ticks);
+
+		spinlock_acquire(&sem->sem_lock);
+	}
+	KASSERT(sem->sem_count > 0);
+	sem->sem_count--;
+	LOCKSTAT_ACQUIRED(sem->sem_stat);
+	if (waited) {
+		LOCKSTAT_WAITEND(sem->sem_stat, lw, 0);
+	}
+	spinlock_release(&sem->sem_lock);
+	return 0;
+}
+
 void
 V(struct semaphore *sem)
 {
@@ -140,7 +252,7 @@ V(struct semaphore *sem)
 
         sem->sem_count++;
         KASSERT(sem->sem_count > 0);
-	wchan_wakeone(sem->sem_wchan);
+	sleepq_wakeone(sem);
 
 	spinlock_release(&sem->sem_lock);
 }
@@ -149,97 +261,361 @@ V(struct semaphore *sem)
 //
 // Lock.
 
+/*
+ * Priority inheritance.
+ *
+ * A thread that has to wait for a lock records itself in the lock's
+ * lk_waiters at its current priority and then passes that priority
+ * on to the holder, and from there along the chain of locks the
+ * holder is itself waiting for. When a thread acquires a lock that
+ * still has waiters, it inherits the best of them; when it releases
+ * a lock, it goes back to the best priority among the waiters of the
+ * locks it still holds.
+ *
+ * All of this is protected by pi_lock, which nests inside the
+ * per-lock spinlocks and outside the run queue locks. To keep
+ * uncontended locks cheap, lk_holder is only changed under pi_lock
+ * when the lock has waiters; that's the only case in which another
+ * thread can reach the lock while following a chain.
+ *
+ * PI_MAXDEPTH bounds how far a chain is followed, so that a deadlock
+ * cycle doesn't loop forever.
+ */
+#define PI_MAXDEPTH	16
+
+static struct spinlock pi_lock = SPINLOCK_INITIALIZER;
+
+/*
+ * Best priority among a lock's waiters, or PRIO_NONE.
+ */
+static
+unsigned
+lock_waiterprio(struct lock *lock)
+{
+	unsigned i;
+
+	KASSERT(spinlock_do_i_hold(&pi_lock));
+
+	if (lock->lk_nwaiters > 0) {
+		for (i=0; i<MLFQ_LEVELS; i++) {
+			if (lock->lk_waiters[i] > 0) {
+				return i;
+			}
+		}
+	}
+	return PRIO_NONE;
+}
+
+/*
+ * Register the current thread as waiting for LOCK and donate its
+ * priority to LOCK's holder, transitively. Call with the lock's
+ * spinlock held, while it has a holder or has been handed off.
+ * (While handed off there is nobody to donate to yet; the waiter it
+ * was handed to picks up the donations in lock_pi_take.)
+ */
+static
+void
+lock_pi_block(struct lock *lock)
+{
+	struct thread *holder;
+	unsigned level, depth;
+
+	KASSERT(spinlock_do_i_hold(&lock->lk_spinlock));
+	KASSERT(lock->lk_holder != NULL || lock->lk_granted);
+	KASSERT(curthread->t_blockedon == NULL);
+
+	spinlock_acquire(&pi_lock);
+
+	level = thread_priority(curthread);
+	curthread->t_blockedon = lock;
+	curthread->t_waitlevel = level;
+	lock->lk_waiters[level]++;
+	lock->lk_nwaiters++;
+
+	for (depth = 0; lock != NULL && depth < PI_MAXDEPTH; depth++) {
+		holder = (struct thread *)lock->lk_holder;
+		if (holder == NULL || holder->t_inherited <= level) {
+			break;
+		}
+		thread_set_inherited(holder, level);
+
+		/* If the holder is waiting too, requeue it in that lock */
+		lock = holder->t_blockedon;
+		if (lock != NULL && holder->t_waitlevel > level) {
+			lock->lk_waiters[holder->t_waitlevel]--;
+			lock->lk_waiters[level]++;
+			holder->t_waitlevel = level;
+		}
+	}
+
+	spinlock_release(&pi_lock);
+}
+
+/*
+ * Make the current thread the holder of LOCK. If it was waiting
+ * (WAITED), take it off the waiter counts first. Then inherit
+ * whatever priority the remaining waiters have.
+ */
+static
+void
+lock_pi_take(struct lock *lock, bool waited)
+{
+	unsigned level;
+
+	KASSERT(spinlock_do_i_hold(&lock->lk_spinlock));
+	KASSERT(lock->lk_holder == NULL);
+
+	if (waited || lock->lk_nwaiters > 0) {
+		spinlock_acquire(&pi_lock);
+		if (waited) {
+			KASSERT(curthread->t_blockedon == lock);
+			KASSERT(lock->lk_nwaiters > 0);
+			lock->lk_waiters[curthread->t_waitlevel]--;
+			lock->lk_nwaiters--;
+			curthread->t_blockedon = NULL;
+			curthread->t_waitlevel = PRIO_NONE;
+		}
+		lock->lk_holder = curthread;
+		level = lock_waiterprio(lock);
+		if (level < curthread->t_inherited) {
+			thread_set_inherited(curthread, level);
+		}
+		spinlock_release(&pi_lock);
+	}
+	else {
+		lock->lk_holder = curthread;
+	}
+
+	lock->lk_nextheld = curthread->t_heldlocks;
+	curthread->t_heldlocks = lock;
+}
+
+/*
+ * Give up LOCK, and any priority the current thread inherited through
+ * it.
+ */
+static
+void
+lock_pi_drop(struct lock *lock)
+{
+	struct lock **lp, *l;
+	unsigned level, best;
+
+	KASSERT(spinlock_do_i_hold(&lock->lk_spinlock));
+
+	for (lp = &curthread->t_heldlocks; *lp != lock; lp = &(*lp)->lk_nextheld) {
+		KASSERT(*lp != NULL);
+	}
+	*lp = lock->lk_nextheld;
+	lock->lk_nextheld = NULL;
+
+	if (lock->lk_nwaiters == 0 && curthread->t_inherited == PRIO_NONE) {
+		lock->lk_holder = NULL;
+		return;
+	}
+
+	spinlock_acquire(&pi_lock);
+	lock->lk_holder = NULL;
+	if (curthread->t_inherited != PRIO_NONE) {
+		best = PRIO_NONE;
+		for (l = curthread->t_heldlocks; l != NULL; l = l->lk_nextheld) {
+			level = lock_waiterprio(l);
+			if (level < best) {
+				best = level;
+			}
+		}
+		thread_set_inherited(curthread, best);
+	}
+	spinlock_release(&pi_lock);
+}
+
 struct lock *
 lock_create(const char *name)
 {
-        struct lock *lock;
+	struct lock *lock;
+	unsigned i;
 
-        lock = kmalloc(sizeof(struct lock));
-        if (lock == NULL) {
-                return NULL;
-        }
+	lock = kmalloc(sizeof(struct lock));
+	if (lock == NULL) {
+		return NULL;
+	}
 
-        lock->lk_name = kstrdup(name);
-        if (lock->lk_name == NULL) {
-                kfree(lock);
-                return NULL;
-        }
-        
-        // add stuff here as needed
-        lock->lk_holder=NULL;  //nobody holds the lock
-        //create wait chan
-        lock->lk_wchan = wchan_create(lock->lk_name);
-	    if (lock->lk_wchan == NULL) {
-		    kfree(lock->lk_name);
-		      kfree(lock);
-		      return NULL;
-	      }
-	      
-        //create spinlock
-        spinlock_init(&lock->lk_spinlock);  
-        
-        
-        return lock;
+	lock->lk_name = name;
+	spinlock_init(&lock->lk_spinlock);
+	lock->lk_holder = NULL;		/* nobody holds the lock */
+	lock->lk_nextheld = NULL;
+	lock->lk_nwaiters = 0;
+	for (i=0; i<MLFQ_LEVELS; i++) {
+		lock->lk_waiters[i] = 0;
+	}
+	lock->lk_adaptive = true;
+	lock->lk_handoff = false;
+	lock->lk_granted = false;
+#if OPT_LOCKSTAT
+	lock->lk_stat = lockstat_lookup("lock", lock->lk_name);
+#endif
+
+	return lock;
 }
 
 void
 lock_destroy(struct lock *lock)
 {
-        KASSERT(lock != NULL);
-	
-	// make sure nobody is holding the lock
-	   KASSERT(lock->lk_holder == NULL);
+	KASSERT(lock != NULL);
 
-        // add stuff here as needed
-        spinlock_cleanup(&lock->lk_spinlock);
-         wchan_destroy(lock->lk_wchan);
-         
-        kfree(lock->lk_name);
-        kfree(lock);
+	/* make sure nobody is holding or waiting for the lock */
+	KASSERT(lock->lk_holder == NULL);
+	KASSERT(lock->lk_nwaiters == 0);
+	KASSERT(!lock->lk_granted);
+
+	spinlock_cleanup(&lock->lk_spinlock);
+	kfree(lock);
+}
+
+void
+lock_setadaptive(struct lock *lock, bool adaptive)
+{
+	KASSERT(lock != NULL);
+	lock->lk_adaptive = adaptive;
+}
+
+void
+lock_sethandoff(struct lock *lock, bool handoff)
+{
+	KASSERT(lock != NULL);
+	lock->lk_handoff = handoff;
+}
+
+/*
+ * True if the lock can't be taken right now: it's held, or it has
+ * been handed off to a waiter that hasn't run yet.
+ */
+static
+bool
+lock_busy(struct lock *lock)
+{
+	KASSERT(spinlock_do_i_hold(&lock->lk_spinlock));
+	return lock->lk_holder != NULL || lock->lk_granted;
+}
+
+/*
+ * Adaptive spinning.
+ *
+ * While the holder is running on another cpu, spin waiting for it to
+ * release the lock instead of going to sleep: a short critical
+ * section is over long before two context switches would be. We spin
+ * with the lock's spinlock released and come back every
+ * LOCK_SPINCHECK turns to see whether the holder has gone to sleep
+ * (the holder can't go away while we hold the spinlock, so that is
+ * the only time we look at it). After LOCK_SPINMAX turns we give up
+ * and sleep anyway.
+ *
+ * Called and returns with the lock's spinlock held. Returns the number
+ * of turns spun.
+ */
+#define LOCK_SPINCHECK	64
+#define LOCK_SPINMAX	2048
+
+static
+unsigned
+lock_spin(struct lock *lock)
+{
+	volatile struct thread *holder;
+	unsigned spins, i;
+
+	KASSERT(spinlock_do_i_hold(&lock->lk_spinlock));
+
+	spins = 0;
+	while (spins < LOCK_SPINMAX) {
+		holder = lock->lk_holder;
+		if (holder == NULL || holder->t_state != S_RUN) {
+			break;
+		}
+		spinlock_release(&lock->lk_spinlock);
+		for (i=0; i<LOCK_SPINCHECK && lock->lk_holder == holder; i++) {
+			/* nothing */
+		}
+		spins += i + 1;
+		spinlock_acquire(&lock->lk_spinlock);
+	}
+	return spins;
 }
 
 void
 lock_acquire(struct lock *lock)
 {
-	   
-	   KASSERT(lock != NULL);
-	   KASSERT(curthread->t_in_interrupt == false);
-	   //check for deadlock
-	   KASSERT(!lock_do_i_hold(lock));
-	   
-      spinlock_acquire(&lock->lk_spinlock);
-      
-      while (lock->lk_holder != NULL) {
-
-         wchan_lock(lock->lk_wchan);
-         spinlock_release(&lock->lk_spinlock);
-         wchan_sleep(lock->lk_wchan);
-         spinlock_acquire(&lock->lk_spinlock);
-      }
-      
-      //current thread -> lock
-      lock->lk_holder = curthread;
-      spinlock_release(&lock->lk_spinlock);
-	   
+	bool waited, contended;
+	unsigned spins;
+	LOCKSTAT_WAITVAR(lw);
+
+	KASSERT(lock != NULL);
+	KASSERT(curthread->t_in_interrupt == false);
+	/* check for deadlock */
+	KASSERT(!lock_do_i_hold(lock));
+
+	spinlock_acquire(&lock->lk_spinlock);
+
+	contended = lock_busy(lock);
+	spins = 0;
+	if (contended) {
+		LOCKSTAT_WAITBEGIN(lw);
+	}
+	if (lock->lk_adaptive && lock->lk_holder != NULL) {
+		spins = lock_spin(lock);
+	}
+
+	waited = false;
+	if (lock_busy(lock)) {
+		lock_pi_block(lock);
+		waited = true;
+	}
+	while (lock_busy(lock)) {
+		sleepq_lock(lock);
+		spinlock_release(&lock->lk_spinlock);
+		sleepq_sleep(lock, lock->lk_name);
+		spinlock_acquire(&lock->lk_spinlock);
+		if (lock->lk_granted) {
+			/* Handed to us by lock_release */
+			KASSERT(lock->lk_holder == NULL);
+			lock->lk_granted = false;
+			break;
+		}
+	}
+
+	/* current thread -> lock */
+	lock_pi_take(lock, waited);
+	LOCKSTAT_ACQUIRED(lock->lk_stat);
+	if (contended) {
+		LOCKSTAT_WAITEND(lock->lk_stat, lw, spins);
+	}
+	spinlock_release(&lock->lk_spinlock);
 }
 
 void
 lock_release(struct lock *lock)
 {
-        KASSERT(lock != NULL);
-        KASSERT(lock_do_i_hold(lock));
-        
-        spinlock_acquire(&lock->lk_spinlock);
-        lock->lk_holder = NULL;
-	     wchan_wakeone(lock->lk_wchan);
-        spinlock_release(&lock->lk_spinlock);
+	KASSERT(lock != NULL);
+	KASSERT(lock_do_i_hold(lock));
+
+	spinlock_acquire(&lock->lk_spinlock);
+	lock_pi_drop(lock);
+	/*
+	 * In handoff mode, reserve the lock for the thread we wake
+	 * (the one that has waited longest, as sleep queues are FIFO). It
+	 * can't look until we drop the spinlock, so setting the flag
+	 * after the wakeup is safe.
+	 */
+	if (sleepq_wakeone(lock) && lock->lk_handoff) {
+		lock->lk_granted = true;
+	}
+	spinlock_release(&lock->lk_spinlock);
 }
 
 bool
 lock_do_i_hold(struct lock *lock)
 {
-         KASSERT(lock!=NULL);
-        return (lock->lk_holder==curthread);
+	KASSERT(lock != NULL);
+	return (lock->lk_holder == curthread);
 }
 
 ////////////////////////////////////////////////////////////
@@ -257,17 +633,8 @@ cv_create(const char *name)
                 return NULL;
         }
 
-        cv->cv_name = kstrdup(name);
-        if (cv->cv_name==NULL) {
-                kfree(cv);
-                return NULL;
-        }
-        
-        // add stuff here as needed
-        cv->cv_wchan = wchan_create(name);
-    
-    KASSERT(cv!= NULL);
-    KASSERT(cv->cv_wchan != NULL);
+        cv->cv_name = name;
+        cv->cv_seq = 0;
         return cv;
 }
 
@@ -276,46 +643,264 @@ cv_destroy(struct cv *cv)
 {
         KASSERT(cv != NULL);
 
-        // add stuff here as needed
-        wchan_destroy(cv->cv_wchan);
-    
-        kfree(cv->cv_name);
         kfree(cv);
 }
 
+/*
+ * The CV's sleep queue may be shared with the lock's, so we can't
+ * hold it locked across lock_release the way a semaphore bridges
+ * from its spinlock. Instead, note cv_seq while still holding the
+ * lock, and after releasing the lock only go to sleep if it hasn't
+ * changed. A signal can only bump cv_seq with the lock held, so one
+ * that comes in between is seen then; one that comes after we're on
+ * the sleep queue finds us there.
+ */
 void
 cv_wait(struct cv *cv, struct lock *lock)
 {
-        // Write this
-    if (lock_do_i_hold(lock)){
-        
-        wchan_lock(cv->cv_wchan);
-        lock_release(lock);
-        wchan_sleep(cv->cv_wchan);
-        lock_acquire(lock);
-    }
-    else {
-        panic("cv_wait: lock is being held by someone else!\n");
-    }
+	unsigned seq;
+
+	KASSERT(lock_do_i_hold(lock));
+
+	seq = cv->cv_seq;
+	lock_release(lock);
+	sleepq_lock(cv);
+	if (cv->cv_seq == seq) {
+		sleepq_sleep(cv, cv->cv_name);
+	}
+	else {
+		sleepq_unlock(cv);
+	}
+	lock_acquire(lock);
+}
 
+/*
+ * cv_wait with a timeout. The sleep queue decides the race between
+ * a wakeup and the timeout: whichever takes us off the queue first
+ * wins, and the other finds us gone.
+ */
+int
+cv_timedwait(struct cv *cv, struct lock *lock, unsigned ms)
+{
+	unsigned seq;
+	int result;
+
+	KASSERT(lock_do_i_hold(lock));
+
+	seq = cv->cv_seq;
+	lock_release(lock);
+	sleepq_lock(cv);
+	if (cv->cv_seq == seq) {
+		result = sleepq_timedsleep(cv, cv->cv_name,
+					   ms == 0 ? 0 : mstohardclocks(ms) + 1);
+	}
+	else {
+		sleepq_unlock(cv);
+		result = 0;
+	}
+	lock_acquire(lock);
+	return result;
 }
 
 void
 cv_signal(struct cv *cv, struct lock *lock)
 {
-        // Write this
-        KASSERT(lock_do_i_hold(lock));
-    wchan_wakeone(cv->cv_wchan);
-	(void)lock;  // suppress warning until code gets written
+	KASSERT(lock_do_i_hold(lock));
+
+	cv->cv_seq++;
+	sleepq_wakeone(cv);
 }
 
 void
 cv_broadcast(struct cv *cv, struct lock *lock)
 {
-	// Write this
-	        KASSERT(lock_do_i_hold(lock));
-    wchan_wakeall(cv->cv_wchan);
-	(void)lock;  // suppress warning until code gets written
+	KASSERT(lock_do_i_hold(lock));
+
+	cv->cv_seq++;
+	sleepq_wakeall(cv);
+}
+
+////////////////////////////////////////////////////////////
+//
+// Reader-writer lock
+
+/* Sleep queue keys: where readers, writers, and an upgrader wait */
+#define RW_RKEY(rw)	((const void *)&(rw)->rw_readers)
+#define RW_WKEY(rw)	((const void *)&(rw)->rw_writer)
+#define RW_UKEY(rw)	((const void *)&(rw)->rw_upgrading)
+
+struct rwlock *
+rwlock_create(const char *name)
+{
+	struct rwlock *rw;
+
+	rw = kmalloc(sizeof(struct rwlock));
+	if (rw == NULL) {
+		return NULL;
+	}
+
+	rw->rw_name = name;
+	spinlock_init(&rw->rw_lock);
+	rw->rw_readers = 0;
+	rw->rw_writer = NULL;
+	rw->rw_wwaiting = 0;
+	rw->rw_upgrading = false;
+
+	return rw;
+}
+
+void
+rwlock_destroy(struct rwlock *rw)
+{
+	KASSERT(rw != NULL);
+
+	/* make sure nobody is holding or waiting for the lock */
+	KASSERT(rw->rw_readers == 0);
+	KASSERT(rw->rw_writer == NULL);
+	KASSERT(rw->rw_wwaiting == 0);
+
+	spinlock_cleanup(&rw->rw_lock);
+	kfree(rw);
+}
+
+void
+rwlock_acquire_read(struct rwlock *rw)
+{
+	KASSERT(rw != NULL);
+	KASSERT(curthread->t_in_interrupt == false);
+	KASSERT(rw->rw_writer != curthread);
+
+	spinlock_acquire(&rw->rw_lock);
+	/* Writer preference: wait behind any writer, held or waiting */
+	while (rw->rw_writer != NULL || rw->rw_wwaiting > 0 ||
+	       rw->rw_upgrading) {
+		sleepq_lock(RW_RKEY(rw));
+		spinlock_release(&rw->rw_lock);
+		sleepq_sleep(RW_RKEY(rw), rw->rw_name);
+		spinlock_acquire(&rw->rw_lock);
+	}
+	rw->rw_readers++;
+	spinlock_release(&rw->rw_lock);
+}
+
+void
+rwlock_release_read(struct rwlock *rw)
+{
+	KASSERT(rw != NULL);
+
+	spinlock_acquire(&rw->rw_lock);
+	KASSERT(rw->rw_readers > 0);
+	KASSERT(rw->rw_writer == NULL);
+	rw->rw_readers--;
+	if (rw->rw_upgrading) {
+		/* The upgrader is the last reader left */
+		if (rw->rw_readers == 1) {
+			sleepq_wakeone(RW_UKEY(rw));
+		}
+	}
+	else if (rw->rw_readers == 0 && rw->rw_wwaiting > 0) {
+		sleepq_wakeone(RW_WKEY(rw));
+	}
+	spinlock_release(&rw->rw_lock);
+}
+
+void
+rwlock_acquire_write(struct rwlock *rw)
+{
+	KASSERT(rw != NULL);
+	KASSERT(curthread->t_in_interrupt == false);
+	KASSERT(rw->rw_writer != curthread);
+
+	spinlock_acquire(&rw->rw_lock);
+	rw->rw_wwaiting++;
+	while (rw->rw_writer != NULL || rw->rw_readers > 0) {
+		sleepq_lock(RW_WKEY(rw));
+		spinlock_release(&rw->rw_lock);
+		sleepq_sleep(RW_WKEY(rw), rw->rw_name);
+		spinlock_acquire(&rw->rw_lock);
+	}
+	rw->rw_wwaiting--;
+	rw->rw_writer = curthread;
+	spinlock_release(&rw->rw_lock);
+}
+
+/*
+ * Let the next waiters in after the writer leaves: another writer if
+ * there is one, otherwise all the readers.
+ */
+static
+void
+rwlock_wakenext(struct rwlock *rw)
+{
+	KASSERT(spinlock_do_i_hold(&rw->rw_lock));
+
+	if (rw->rw_wwaiting > 0) {
+		sleepq_wakeone(RW_WKEY(rw));
+	}
+	else {
+		sleepq_wakeall(RW_RKEY(rw));
+	}
+}
+
+void
+rwlock_release_write(struct rwlock *rw)
+{
+	KASSERT(rw != NULL);
+	KASSERT(rwlock_do_i_hold_write(rw));
+
+	spinlock_acquire(&rw->rw_lock);
+	rw->rw_writer = NULL;
+	rwlock_wakenext(rw);
+	spinlock_release(&rw->rw_lock);
+}
+
+bool
+rwlock_upgrade(struct rwlock *rw)
+{
+	KASSERT(rw != NULL);
+	KASSERT(curthread->t_in_interrupt == false);
+
+	spinlock_acquire(&rw->rw_lock);
+	KASSERT(rw->rw_readers > 0);
+	if (rw->rw_upgrading) {
+		/* Two upgraders would wait for each other forever */
+		spinlock_release(&rw->rw_lock);
+		return false;
+	}
+	rw->rw_upgrading = true;
+	while (rw->rw_readers > 1) {
+		sleepq_lock(RW_UKEY(rw));
+		spinlock_release(&rw->rw_lock);
+		sleepq_sleep(RW_UKEY(rw), rw->rw_name);
+		spinlock_acquire(&rw->rw_lock);
+	}
+	rw->rw_upgrading = false;
+	rw->rw_readers = 0;
+	rw->rw_writer = curthread;
+	spinlock_release(&rw->rw_lock);
+
+	return true;
 }
 
+void
+rwlock_downgrade(struct rwlock *rw)
+{
+	KASSERT(rw != NULL);
+	KASSERT(rwlock_do_i_hold_write(rw));
+
+	spinlock_acquire(&rw->rw_lock);
+	rw->rw_writer = NULL;
+	rw->rw_readers = 1;
+	/* Waiting writers still keep new readers out */
+	if (rw->rw_wwaiting == 0) {
+		sleepq_wakeall(RW_RKEY(rw));
+	}
+	spinlock_release(&rw->rw_lock);
+}
 
+bool
+rwlock_do_i_hold_write(struct rwlock *rw)
+{
+	KASSERT(rw != NULL);
+	return (rw->rw_writer == curthread);
+}
@@ -50,6 +50,7 @@
 #include <addrspace.h>
 #include <mainbus.h>
 #include <vnode.h>
+#include <clock.h>
 
 #include "opt-synchprobs.h"
 
@@ -57,13 +58,88 @@
 /* Magic number used as a guard value on kernel thread stacks. */
 #define THREAD_STACK_MAGIC 0xbaadf00d
 
-/* Wait channel. */
+/*
+ * MLFQ tuning. The quantum at level 0 is MLFQ_QUANTUM hardclocks and
+ * doubles at each level down. Every MLFQ_BOOST_HARDCLOCKS, schedule()
+ * moves everything on the cpu back to the top level, so CPU-bound
+ * threads at the bottom can't be starved indefinitely.
+ */
+#define MLFQ_QUANTUM		2
+#define MLFQ_BOOST_HARDCLOCKS	HZ
+
+/*
+ * Maximum number of threads an idle cpu takes from another cpu's run
+ * queue in one go. This bounds how long the victim's run queue lock
+ * is held by a thief.
+ */
+#define STEAL_MAX		4
+
+/*
+ * Stride scheduling. A client with N tickets advances its pass by
+ * STRIDE1/N for every hardclock it runs, and the client with the
+ * lowest pass runs next. The MLFQ class as a whole is one client with
+ * STRIDE_TSTICKETS tickets. Stride threads get a quantum of
+ * STRIDE_QUANTUM hardclocks.
+ */
+#define STRIDE1			(1 << 16)
+#define STRIDE_TSTICKETS	100
+#define STRIDE_QUANTUM		MLFQ_QUANTUM
+
+/*
+ * Gang scheduling. Time is cut into slices of GANG_SLICE hardclocks;
+ * each gang gets a slice in turn, during which its threads run ahead
+ * of everything but EDF, followed by a slice for everything else. At
+ * most GANG_MAX processes can be gangs at once.
+ */
+#define GANG_SLICE		10
+#define GANG_MAX		8
+
+/*
+ * Values of t_runlevel other than MLFQ levels: on the stride queue,
+ * on the EDF queue, on the gang queue, and on no run queue at all.
+ */
+#define RUNQ_STRIDE	MLFQ_LEVELS
+#define RUNQ_EDF	(MLFQ_LEVELS+1)
+#define RUNQ_GANG	(MLFQ_LEVELS+2)
+#define RUNQ_NONE	(MLFQ_LEVELS+3)
+
+/*
+ * Number of exited threads (with their stacks) each cpu keeps for
+ * thread_fork to reuse, and the minimum size of a thread's name
+ * buffer, so most names fit when a thread is reused.
+ */
+#define THREAD_CACHE_MAX	8
+#define THREAD_NAMESIZE		32
+
+/*
+ * Limit on how many threads a thief examines when choosing what to
+ * steal, and how recently (in the victim's hardclocks) a thread must
+ * have run on the victim to count as cache-hot and be left alone.
+ */
+#define STEAL_SCAN		16
+#define CACHE_HOT_HARDCLOCKS	2
+
+/*
+ * Wait channel. Each sleeping thread records in t_wchankey what it's
+ * waiting for: for a wait channel from wchan_create that's always
+ * the channel itself, while the sleep queues below are wait channels
+ * shared by every object whose address hashes to them.
+ */
 struct wchan {
 	const char *wc_name;		/* name for this channel */
 	struct threadlist wc_threads;	/* list of waiting threads */
+	unsigned wc_gen;		/* bumped by wchan_wakeall */
+	unsigned wc_ntimed;		/* timed sleepers not yet done */
 	struct spinlock wc_lock;	/* lock for mutual exclusion */
 };
 
+/*
+ * Sleep queues (see wchan.h), hashed by the address being waited
+ * for. A power of two.
+ */
+#define SLEEPQ_SIZE		128
+static struct wchan sleepq_table[SLEEPQ_SIZE];
+
 /* Master array of CPUs. */
 DECLARRAY(cpu);
 DEFARRAY(cpu, /*no inline*/ );
@@ -72,889 +148,2427 @@ static struct cpuarray allcpus;
 /* Used to wait for secondary CPUs to come online. */
 static struct semaphore *cpu_startup_sem;
 
+/*
+ * Gang state, protected by gang_lock. gang_active is the gang whose
+ * turn it is, or NULL during the slice for everyone else; it is read
+ * without the lock by the dispatch code, which only needs a recent
+ * value.
+ */
+static struct spinlock gang_lock = SPINLOCK_INITIALIZER;
+static struct proc *gang_procs[GANG_MAX];
+static unsigned gang_count;
+static unsigned gang_turn;		/* gang_count means everyone else */
+static unsigned gang_nextslice;		/* c_hardclocks of next turn */
+static unsigned gang_slices;		/* turns taken */
+static struct proc *volatile gang_active;
+
+static void thread_finish_migration(void);
+static void thread_idle(void *junk, unsigned long junk2);
+static void thread_edf_release(struct thread *t);
+static unsigned thread_steal(void);
+static void wchan_timeout(void *data1, unsigned long data2);
+static void sleepq_bootstrap(void);
+
 ////////////////////////////////////////////////////////////
 
 /*
- * Stick a magic number on the bottom end of the stack. This will
- * (sometimes) catch kernel stack overflows. Use thread_checkstack()
- * to test this.
+ * Length of the quantum, in hardclocks, for the given MLFQ level.
  */
 static
-void
-thread_checkstack_init(struct thread *thread)
+unsigned
+mlfq_quantum(unsigned level)
 {
-	((uint32_t *)thread->t_stack)[0] = THREAD_STACK_MAGIC;
-	((uint32_t *)thread->t_stack)[1] = THREAD_STACK_MAGIC;
-	((uint32_t *)thread->t_stack)[2] = THREAD_STACK_MAGIC;
-	((uint32_t *)thread->t_stack)[3] = THREAD_STACK_MAGIC;
+	KASSERT(level < MLFQ_LEVELS);
+	return MLFQ_QUANTUM << level;
 }
 
 /*
- * Check the magic number we put on the bottom end of the stack in
- * thread_checkstack_init. If these assertions go off, it most likely
- * means you overflowed your stack at some point, which can cause all
- * kinds of mysterious other things to happen.
+ * Check if thread T is allowed to run on cpu C. EDF threads may only
+ * run on the cpu they have their reservation on, and gang threads on
+ * the cpu they were placed on.
+ */
+static
+bool
+thread_cpu_allowed(struct thread *t, struct cpu *c)
+{
+	if (t->t_edfperiod > 0) {
+		return t->t_edfcpu == c;
+	}
+	if (t->t_gangcpu != NULL) {
+		return t->t_gangcpu == c;
+	}
+	return (t->t_affinity & ((uint32_t)1 << c->c_number)) != 0;
+}
+
+/*
+ * Compare stride pass values, allowing for wraparound.
+ */
+static
+bool
+pass_before(uint32_t a, uint32_t b)
+{
+	return (int32_t)(a - b) < 0;
+}
+
+/*
+ * Compare EDF deadlines (in hardclocks), allowing for wraparound.
+ */
+static
+bool
+time_before(unsigned a, unsigned b)
+{
+	return (int)(a - b) < 0;
+}
+
+/*
+ * Run queue handling.
  *
- * Note that when ->t_stack is NULL, which is the case if the stack
- * cannot be freed (which in turn is the case if the stack is the boot
- * stack, and the thread is the boot thread) this doesn't do anything.
+ * Each cpu has one run queue per MLFQ level, one for the stride
+ * class, one for EDF threads bound to it, and one for gang threads
+ * placed on it. MLFQ threads are queued
+ * at the level given by thread_priority() and dispatched from the
+ * highest nonempty level; within a level it's round-robin. Stride
+ * threads are kept in order of pass and EDF threads in order of
+ * deadline; the gang queue is FIFO. A thread that has inherited a
+ * priority through a lock is treated as an MLFQ thread until it gives
+ * the priority back, unless it's an EDF thread, which is ahead of
+ * everything anyway.
+ *
+ * The queue a thread is on is kept in t_runlevel (RUNQ_NONE if not
+ * queued), since its priority can change while it waits. These must
+ * be called with the cpu's run queue lock held.
  */
 static
-void
-thread_checkstack(struct thread *thread)
+unsigned
+runqueue_level(struct cpu *c, const struct thread *t)
 {
-	if (thread->t_stack != NULL) {
-		KASSERT(((uint32_t*)thread->t_stack)[0] == THREAD_STACK_MAGIC);
-		KASSERT(((uint32_t*)thread->t_stack)[1] == THREAD_STACK_MAGIC);
-		KASSERT(((uint32_t*)thread->t_stack)[2] == THREAD_STACK_MAGIC);
-		KASSERT(((uint32_t*)thread->t_stack)[3] == THREAD_STACK_MAGIC);
+	if (t->t_edfperiod > 0 && t->t_edfcpu == c) {
+		return RUNQ_EDF;
+	}
+	if (t->t_gangcpu == c && t->t_inherited == PRIO_NONE) {
+		return RUNQ_GANG;
+	}
+	if (t->t_tickets > 0 && t->t_inherited == PRIO_NONE) {
+		return RUNQ_STRIDE;
+	}
+	return thread_priority(t);
+}
+
+static
+struct threadlist *
+runqueue_list(struct cpu *c, unsigned level)
+{
+	KASSERT(level <= RUNQ_GANG);
+	if (level == RUNQ_GANG) {
+		return &c->c_gangqueue;
+	}
+	if (level == RUNQ_EDF) {
+		return &c->c_edfqueue;
 	}
+	if (level == RUNQ_STRIDE) {
+		return &c->c_stridequeue;
+	}
+	return &c->c_runqueue[level];
 }
 
 /*
- * Create a thread. This is used both to create a first thread
- * for each CPU and to create subsequent forked threads.
+ * Number of threads queued in the MLFQ levels.
  */
 static
-struct thread *
-thread_create(const char *name)
+unsigned
+runqueue_mlfqcount(struct cpu *c)
 {
-	struct thread *thread;
+	return c->c_runcount - c->c_stridequeue.tl_count -
+		c->c_edfqueue.tl_count - c->c_gangqueue.tl_count;
+}
 
-	DEBUGASSERT(name != NULL);
+/*
+ * Find a thread of gang P on the gang queue, or NULL.
+ */
+static
+struct thread *
+gangqueue_find(struct cpu *c, struct proc *p)
+{
+	struct threadlistnode *tln;
 
-	thread = kmalloc(sizeof(*thread));
-	if (thread == NULL) {
+	if (p == NULL) {
 		return NULL;
 	}
+	for (tln = c->c_gangqueue.tl_head.tln_next;
+	     tln->tln_next != NULL; tln = tln->tln_next) {
+		if (tln->tln_self->t_proc == p) {
+			return tln->tln_self;
+		}
+	}
+	return NULL;
+}
 
-	thread->t_name = kstrdup(name);
-	if (thread->t_name == NULL) {
-		kfree(thread);
+/*
+ * Pick a gang thread to run: one of the gang whose turn it is, or,
+ * if there's no stride or MLFQ work, whichever has waited longest,
+ * so the cpu doesn't idle just because it's not their turn.
+ */
+static
+struct thread *
+gangqueue_pick(struct cpu *c)
+{
+	struct thread *t;
+
+	if (threadlist_isempty(&c->c_gangqueue)) {
 		return NULL;
 	}
-	thread->t_wchan_name = "NEW";
-	thread->t_state = S_READY;
+	t = gangqueue_find(c, gang_active);
+	if (t == NULL &&
+	    c->c_stridequeue.tl_count + runqueue_mlfqcount(c) == 0) {
+		t = c->c_gangqueue.tl_head.tln_next->tln_self;
+	}
+	return t;
+}
 
-	/* Thread subsystem fields */
-	thread_machdep_init(&thread->t_machdep);
-	threadlistnode_init(&thread->t_listnode, thread);
-	thread->t_stack = NULL;
-	thread->t_context = NULL;
-	thread->t_cpu = NULL;
-	thread->t_proc = NULL;
+/*
+ * Check whether the current thread should give way for gang reasons:
+ * a thread of the gang whose turn it is is waiting here, or the
+ * current thread is a gang thread out of turn and something else is
+ * waiting.
+ */
+static
+bool
+gang_preempt(struct cpu *c, struct thread *cur, unsigned level)
+{
+	struct proc *active = gang_active;
 
-	/* Interrupt state fields */
-	thread->t_in_interrupt = false;
-	thread->t_curspl = IPL_HIGH;
-	thread->t_iplhigh_count = 1; /* corresponding to t_curspl */
+	KASSERT(spinlock_do_i_hold(&c->c_runqueue_lock));
 
-	/* If you add to struct thread, be sure to initialize here */
+	if (level == RUNQ_GANG && cur->t_proc == active) {
+		return false;
+	}
+	if (gangqueue_find(c, active) != NULL) {
+		return true;
+	}
+	return level == RUNQ_GANG &&
+		c->c_runcount > c->c_gangqueue.tl_count;
+}
 
-	return thread;
+/*
+ * Bring an EDF thread's period up to date with its cpu's clock,
+ * starting a new period (with a full budget) for each deadline that
+ * has passed. If COUNTMISS is set, the thread has wanted to run all
+ * along, so any of those periods in which it still had budget left
+ * is a deadline miss.
+ */
+static
+void
+edf_update(struct cpu *c, struct thread *t, bool countmiss)
+{
+	KASSERT(t->t_edfcpu == c);
+
+	while (!time_before(c->c_hardclocks, t->t_edfdeadline)) {
+		if (countmiss && t->t_edfleft > 0) {
+			c->c_edfmisses++;
+		}
+		t->t_edfdeadline += t->t_edfperiod;
+		t->t_edfleft = t->t_edfbudget;
+	}
 }
 
 /*
- * Create a CPU structure. This is used for the bootup CPU and
- * also for secondary CPUs.
- *
- * The hardware number (the number assigned by firmware or system
- * board config or whatnot) is tracked separately because it is not
- * necessarily anything sane or meaningful.
+ * Insert an EDF thread into the EDF queue, after everything with the
+ * same or an earlier deadline.
  */
-struct cpu *
-cpu_create(unsigned hardware_number)
+static
+void
+edfqueue_insert(struct cpu *c, struct thread *t)
 {
-	struct cpu *c;
-	int result;
-	char namebuf[16];
+	struct threadlistnode *tln;
 
-	c = kmalloc(sizeof(*c));
-	if (c == NULL) {
-		panic("cpu_create: Out of memory\n");
+	for (tln = c->c_edfqueue.tl_tail.tln_prev;
+	     tln->tln_prev != NULL; tln = tln->tln_prev) {
+		if (!time_before(t->t_edfdeadline,
+				 tln->tln_self->t_edfdeadline)) {
+			break;
+		}
 	}
-	
-	c->c_self = c;
-	c->c_hardware_number = hardware_number;
+	if (tln->tln_prev == NULL) {
+		threadlist_addhead(&c->c_edfqueue, t);
+	}
+	else {
+		threadlist_insertafter(&c->c_edfqueue, tln->tln_self, t);
+	}
+}
 
-	c->c_curthread = NULL;
-	threadlist_init(&c->c_zombies);
-	c->c_hardclocks = 0;
+static
+void
+runqueue_doadd(struct cpu *c, struct thread *t)
+{
+	struct threadlistnode *tln;
 
-	c->c_isidle = false;
-	threadlist_init(&c->c_runqueue);
-	spinlock_init(&c->c_runqueue_lock);
+	KASSERT(spinlock_do_i_hold(&c->c_runqueue_lock));
+	KASSERT(t->t_runlevel == RUNQ_NONE);
 
-	c->c_ipi_pending = 0;
-	c->c_numshootdown = 0;
-	spinlock_init(&c->c_ipi_lock);
+	t->t_runlevel = runqueue_level(c, t);
+	c->c_runcount++;
 
-	result = cpuarray_add(&allcpus, c, &c->c_number);
-	if (result != 0) {
-		panic("cpu_create: array_add: %s\n", strerror(result));
+	if (t->t_runlevel == RUNQ_EDF) {
+		/* If it was asleep at its deadline, it had nothing to do */
+		edf_update(c, t, false);
+		edfqueue_insert(c, t);
+		return;
 	}
 
-	snprintf(namebuf, sizeof(namebuf), "<boot #%d>", c->c_number);
-	c->c_curthread = thread_create(namebuf);
-	if (c->c_curthread == NULL) {
-		panic("cpu_create: thread_create failed\n");
-	}
-	result = proc_addthread(kproc, c->c_curthread);
-	if (result) {
-		panic("cpu_create: proc_addthread:: %s\n", strerror(result));
+	if (t->t_runlevel == RUNQ_GANG) {
+		threadlist_addtail(&c->c_gangqueue, t);
+		return;
 	}
 
-	if (c->c_number == 0) {
+	if (t->t_runlevel != RUNQ_STRIDE) {
 		/*
-		 * Leave c->c_curthread->t_stack NULL for the boot
-		 * cpu. This means we're using the boot stack, which
-		 * can't be freed. (Exercise: what would it take to
-		 * make it possible to free the boot stack?)
+		 * If the MLFQ class had nothing to run, don't let it
+		 * bank credit for the time it was away.
 		 */
-		/*c->c_curthread->t_stack = ... */
-	}
-	else {
-		c->c_curthread->t_stack = kmalloc(STACK_SIZE);
-		if (c->c_curthread->t_stack == NULL) {
-			panic("cpu_create: couldn't allocate stack");
+		if (runqueue_mlfqcount(c) == 1 &&
+		    pass_before(c->c_tspass, c->c_vpass)) {
+			c->c_tspass = c->c_vpass;
 		}
-		thread_checkstack_init(c->c_curthread);
+		threadlist_addtail(&c->c_runqueue[t->t_runlevel], t);
+		return;
 	}
-	c->c_curthread->t_cpu = c;
-
-	cpu_machdep_init(c);
 
-	return c;
+	/*
+	 * Likewise for a stride thread that has been asleep, or whose
+	 * pass is from some other cpu.
+	 */
+	if (t->t_lastcpu != c || pass_before(t->t_pass, c->c_vpass)) {
+		t->t_pass = c->c_vpass;
+	}
+	/* Insert after everything with the same or a lower pass. */
+	for (tln = c->c_stridequeue.tl_tail.tln_prev;
+	     tln->tln_prev != NULL; tln = tln->tln_prev) {
+		if (!pass_before(t->t_pass, tln->tln_self->t_pass)) {
+			break;
+		}
+	}
+	if (tln->tln_prev == NULL) {
+		threadlist_addhead(&c->c_stridequeue, t);
+	}
+	else {
+		threadlist_insertafter(&c->c_stridequeue, tln->tln_self, t);
+	}
 }
 
 /*
- * Destroy a thread.
- *
- * This function cannot be called in the victim thread's own context.
- * Nor can it be called on a running thread.
- *
- * (Freeing the stack you're actually using to run is ... inadvisable.)
+ * Put a thread on the run queue. The queue counts change under
+ * c_loadseq so other cpus can read them consistently without the
+ * run queue lock; see cpu_getload().
  */
 static
 void
-thread_destroy(struct thread *thread)
+runqueue_add(struct cpu *c, struct thread *t)
 {
-	KASSERT(thread != curthread);
-	KASSERT(thread->t_state != S_RUN);
-
-	/*
-	 * If you add things to struct thread, be sure to clean them up
-	 * either here or in thread_exit(). (And not both...)
-	 */
-
-	/* Thread subsystem fields */
-	KASSERT(thread->t_proc == NULL);
-	if (thread->t_stack != NULL) {
-		kfree(thread->t_stack);
-	}
-	threadlistnode_cleanup(&thread->t_listnode);
-	thread_machdep_cleanup(&thread->t_machdep);
-
-	/* sheer paranoia */
-	thread->t_wchan_name = "DESTROYED";
-
-	kfree(thread->t_name);
-	kfree(thread);
+	seqlock_write_begin(&c->c_loadseq);
+	runqueue_doadd(c, t);
+	seqlock_write_end(&c->c_loadseq);
 }
 
 /*
- * Clean up zombies. (Zombies are threads that have exited but still
- * need to have thread_destroy called on them.)
- *
- * The list of zombies is per-cpu.
+ * Find the first EDF thread on the queue that still has budget this
+ * period, or NULL.
  */
 static
-void
-exorcise(void)
+struct thread *
+edfqueue_first_eligible(struct cpu *c)
 {
-	struct thread *z;
+	struct threadlistnode *tln;
 
-	while ((z = threadlist_remhead(&curcpu->c_zombies)) != NULL) {
-		KASSERT(z != curthread);
-		KASSERT(z->t_state == S_ZOMBIE);
-		thread_destroy(z);
+	for (tln = c->c_edfqueue.tl_head.tln_next;
+	     tln->tln_next != NULL; tln = tln->tln_next) {
+		if (tln->tln_self->t_edfleft > 0) {
+			return tln->tln_self;
+		}
 	}
+	return NULL;
 }
 
 /*
- * On panic, stop the thread system (as much as is reasonably
- * possible) to make sure we don't end up letting any other threads
- * run.
+ * Remove the next thread to run.
+ *
+ * First come EDF threads that have budget left, earliest deadline
+ * first. Then threads of the gang whose turn it is. Then the stride
+ * thread with the lowest pass, if that's lower
+ * than the MLFQ class's pass; otherwise the head of the
+ * highest-priority nonempty MLFQ level. EDF threads that have used up
+ * their budget only run if there's nothing else, so the cpu doesn't
+ * sit idle while they wait for their next period.
  */
-void
-thread_panic(void)
+static
+struct thread *
+runqueue_doremhead(struct cpu *c)
 {
-	/*
-	 * Kill off other CPUs.
-	 *
-	 * We could wait for them to stop, except that they might not.
-	 */
-	ipi_broadcast(IPI_PANIC);
+	struct thread *t;
+	uint32_t pass;
+	unsigned i;
 
-	/*
-	 * Drop runnable threads on the floor.
-	 *
-	 * Don't try to get the run queue lock; we might not be able
-	 * to.  Instead, blat the list structure by hand, and take the
-	 * risk that it might not be quite atomic.
-	 */
-	curcpu->c_runqueue.tl_count = 0;
-	curcpu->c_runqueue.tl_head.tln_next = NULL;
-	curcpu->c_runqueue.tl_tail.tln_prev = NULL;
+	KASSERT(spinlock_do_i_hold(&c->c_runqueue_lock));
 
-	/*
-	 * Ideally, we want to make sure sleeping threads don't wake
-	 * up and start running. However, there's no good way to track
-	 * down all the wchans floating around the system. Another
-	 * alternative would be to set a global flag to make the wchan
-	 * wakeup operations do nothing; but that would mean we
-	 * ourselves couldn't sleep to wait for an I/O completion
-	 * interrupt, and we'd like to be able to do that if the
-	 * system isn't that badly hosed.
-	 *
-	 * So, do nothing else here.
-	 *
-	 * This may prove inadequate in practice and further steps
-	 * might be needed. It may also be necessary to go through and
-	 * forcibly unlock all locks or the like...
-	 */
+	t = edfqueue_first_eligible(c);
+	if (t == NULL && c->c_runcount == c->c_edfqueue.tl_count) {
+		if (c->c_runcount == 0) {
+			return NULL;
+		}
+		/* Nothing else to run; let an over-budget one go */
+		t = c->c_edfqueue.tl_head.tln_next->tln_self;
+	}
+	if (t != NULL) {
+		threadlist_remove(&c->c_edfqueue, t);
+		t->t_runlevel = RUNQ_NONE;
+		c->c_runcount--;
+		return t;
+	}
+
+	t = gangqueue_pick(c);
+	if (t != NULL) {
+		threadlist_remove(&c->c_gangqueue, t);
+		t->t_runlevel = RUNQ_NONE;
+		c->c_runcount--;
+		return t;
+	}
+
+	t = NULL;
+	if (!threadlist_isempty(&c->c_stridequeue)) {
+		t = c->c_stridequeue.tl_head.tln_next->tln_self;
+		if (runqueue_mlfqcount(c) > 0 &&
+		    !pass_before(t->t_pass, c->c_tspass)) {
+			/* MLFQ class's turn */
+			t = NULL;
+		}
+	}
+
+	if (t != NULL) {
+		threadlist_remove(&c->c_stridequeue, t);
+		pass = t->t_pass;
+	}
+	else {
+		for (i=0; i<MLFQ_LEVELS; i++) {
+			t = threadlist_remhead(&c->c_runqueue[i]);
+			if (t != NULL) {
+				break;
+			}
+		}
+		KASSERT(t != NULL);
+		pass = c->c_tspass;
+	}
+
+	if (pass_before(c->c_vpass, pass)) {
+		c->c_vpass = pass;
+	}
+	t->t_runlevel = RUNQ_NONE;
+	c->c_runcount--;
+	return t;
+}
+
+static
+struct thread *
+runqueue_remhead(struct cpu *c)
+{
+	struct thread *t;
+
+	seqlock_write_begin(&c->c_loadseq);
+	t = runqueue_doremhead(c);
+	seqlock_write_end(&c->c_loadseq);
+	return t;
 }
 
 /*
- * At system shutdown, ask the other CPUs to switch off.
+ * Remove a particular thread from the run queue. Used for migration.
  */
+static
 void
-thread_shutdown(void)
+runqueue_remove(struct cpu *c, struct thread *t)
 {
-	/*
-	 * Stop the other CPUs.
-	 *
-	 * We should probably wait for them to stop and shut them off
-	 * on the system board.
-	 */
-	ipi_broadcast(IPI_OFFLINE);
+	KASSERT(spinlock_do_i_hold(&c->c_runqueue_lock));
+	KASSERT(t->t_runlevel != RUNQ_NONE);
+
+	seqlock_write_begin(&c->c_loadseq);
+	threadlist_remove(runqueue_list(c, t->t_runlevel), t);
+	t->t_runlevel = RUNQ_NONE;
+	c->c_runcount--;
+	seqlock_write_end(&c->c_loadseq);
 }
 
 /*
- * Thread system initialization.
+ * Snapshot of a cpu's run queue counts.
+ */
+struct cpuload {
+	unsigned cl_runcount;	/* Threads on all run queues */
+	unsigned cl_edf;	/* ...of which EDF threads */
+	unsigned cl_gang;	/* ...of which gang threads */
+};
+
+/*
+ * Read C's run queue counts without taking its run queue lock. The
+ * counts are updated together under c_loadseq, so the snapshot is
+ * consistent (if possibly a little stale by the time it's used),
+ * and, unlike the run queue lock, reading it doesn't slow down the
+ * cpu that owns the queues.
  */
+static
 void
-thread_bootstrap(void)
+cpu_getload(struct cpu *c, struct cpuload *cl)
 {
-	struct cpu *bootcpu;
-	struct thread *bootthread;
-
-	cpuarray_init(&allcpus);
-
-	/*
-	 * Create the cpu structure for the bootup CPU, the one we're
-	 * currently running on. Assume the hardware number is 0; that
-	 * might be updated later by mainbus-type code. This also
-	 * creates a thread structure for the first thread, the one
-	 * that's already implicitly running when the kernel is
-	 * started from the bootloader.
-	 */
-	bootcpu = cpu_create(0);
-	bootthread = bootcpu->c_curthread;
-
-	/*
-	 * Initializing curcpu and curthread is machine-dependent
-	 * because either of curcpu and curthread might be defined in
-	 * terms of the other.
-	 */
-	INIT_CURCPU(bootcpu, bootthread);
-
-	/*
-	 * Now make sure both t_cpu and c_curthread are set. This
-	 * might be partially redundant with INIT_CURCPU depending on
-	 * how things are defined.
-	 */
-	curthread->t_cpu = curcpu;
-	curcpu->c_curthread = curthread;
-
-	/* cpu_create() should have set t_proc. */
-	KASSERT(curthread->t_proc != NULL);
+	unsigned seq;
 
-	/* Done */
+	do {
+		seq = seqlock_read_begin(&c->c_loadseq);
+		cl->cl_runcount = c->c_runcount;
+		cl->cl_edf = c->c_edfqueue.tl_count;
+		cl->cl_gang = c->c_gangqueue.tl_count;
+	} while (seqlock_read_retry(&c->c_loadseq, seq));
 }
 
 /*
- * New CPUs come here once MD initialization is finished. curthread
- * and curcpu should already be initialized.
- *
- * Other than clearing thread_start_cpus() to continue, we don't need
- * to do anything. The startup thread can just exit; we only need it
- * to be able to get into thread_switch() properly.
+ * Stick a magic number on the bottom end of the stack. This will
+ * (sometimes) catch kernel stack overflows. Use thread_checkstack()
+ * to test this.
  */
+static
 void
-cpu_hatch(unsigned software_number)
+thread_checkstack_init(struct thread *thread)
 {
-	KASSERT(curcpu != NULL);
-	KASSERT(curthread != NULL);
-	KASSERT(curcpu->c_number == software_number);
-
-	spl0();
-
-	kprintf("cpu%u: %s\n", software_number, cpu_identify());
-
-	V(cpu_startup_sem);
-	thread_exit();
+	((uint32_t *)thread->t_stack)[0] = THREAD_STACK_MAGIC;
+	((uint32_t *)thread->t_stack)[1] = THREAD_STACK_MAGIC;
+	((uint32_t *)thread->t_stack)[2] = THREAD_STACK_MAGIC;
+	((uint32_t *)thread->t_stack)[3] = THREAD_STACK_MAGIC;
 }
 
 /*
- * Start up secondary cpus. Called from boot().
+ * Check the magic number we put on the bottom end of the stack in
+ * thread_checkstack_init. If these assertions go off, it most likely
+ * means you overflowed your stack at some point, which can cause all
+ * kinds of mysterious other things to happen.
+ *
+ * Note that when ->t_stack is NULL, which is the case if the stack
+ * cannot be freed (which in turn is the case if the stack is the boot
+ * stack, and the thread is the boot thread) this doesn't do anything.
  */
+static
 void
-thread_start_cpus(void)
+thread_checkstack(struct thread *thread)
 {
-	unsigned i;
+	if (thread->t_stack != NULL) {
+		KASSERT(((uint32_t*)thread->t_stack)[0] == THREAD_STACK_MAGIC);
+		KASSERT(((uint32_t*)thread->t_stack)[1] == THREAD_STACK_MAGIC);
+		KASSERT(((uint32_t*)thread->t_stack)[2] == THREAD_STACK_MAGIC);
+		KASSERT(((uint32_t*)thread->t_stack)[3] == THREAD_STACK_MAGIC);
+	}
+}
 
-	kprintf("cpu0: %s\n", cpu_identify());
+/*
+ * Set a thread's name, reusing its existing name buffer if the new
+ * name fits.
+ */
+static
+int
+thread_setname(struct thread *thread, const char *name)
+{
+	size_t len;
+	char *buf;
 
-	cpu_startup_sem = sem_create("cpu_hatch", 0);
-	mainbus_start_cpus();
-	
-	for (i=0; i<cpuarray_num(&allcpus) - 1; i++) {
-		P(cpu_startup_sem);
+	len = strlen(name) + 1;
+	if (len > thread->t_namesize) {
+		if (len < THREAD_NAMESIZE) {
+			len = THREAD_NAMESIZE;
+		}
+		buf = kmalloc(len);
+		if (buf == NULL) {
+			return ENOMEM;
+		}
+		if (thread->t_name != NULL) {
+			kfree(thread->t_name);
+		}
+		thread->t_name = buf;
+		thread->t_namesize = len;
 	}
-	sem_destroy(cpu_startup_sem);
-	cpu_startup_sem = NULL;
+	strcpy(thread->t_name, name);
+	return 0;
 }
 
 /*
- * Make a thread runnable.
- *
- * targetcpu might be curcpu; it might not be, too. 
+ * Initialize (or reinitialize, for a thread taken from the thread
+ * cache) everything in a thread except its name and stack.
  */
 static
 void
-thread_make_runnable(struct thread *target, bool already_have_lock)
+thread_initfields(struct thread *thread)
 {
-	struct cpu *targetcpu;
-	bool isidle;
-
-	/* Lock the run queue of the target thread's cpu. */
-	targetcpu = target->t_cpu;
+	thread->t_wchan_name = "NEW";
+	thread->t_state = S_READY;
 
-	if (already_have_lock) {
-		/* The target thread's cpu should be already locked. */
-		KASSERT(spinlock_do_i_hold(&targetcpu->c_runqueue_lock));
-	}
-	else {
-		spinlock_acquire(&targetcpu->c_runqueue_lock);
-	}
+	/* Thread subsystem fields */
+	thread_machdep_init(&thread->t_machdep);
+	threadlistnode_init(&thread->t_listnode, thread);
+	thread->t_context = NULL;
+	thread->t_cpu = NULL;
+	thread->t_proc = NULL;
+	thread->t_priority = MLFQ_TOPLEVEL;
+	thread->t_ticksleft = mlfq_quantum(MLFQ_TOPLEVEL);
+	thread->t_runlevel = RUNQ_NONE;
+	thread->t_tickets = 0;
+	thread->t_pass = 0;
+	thread->t_edfperiod = 0;
+	thread->t_edfbudget = 0;
+	thread->t_edfleft = 0;
+	thread->t_edfdeadline = 0;
+	thread->t_edfutil = 0;
+	thread->t_edfcpu = NULL;
+	thread->t_affinity = CPU_AFFINITY_ALL;
+	thread->t_gangcpu = NULL;
+	thread->t_lastcpu = NULL;
+	thread->t_lastran = 0;
+	thread->t_inherited = PRIO_NONE;
+	thread->t_heldlocks = NULL;
+	thread->t_blockedon = NULL;
+	thread->t_waitlevel = PRIO_NONE;
+	thread->t_wchan = NULL;
+	thread->t_wchankey = NULL;
+	thread->t_wchangen = 0;
+	callout_init(&thread->t_timeout, wchan_timeout, thread, 0);
+	thread->t_timedout = false;
+	thread->t_rcudepth = 0;
 
-	isidle = targetcpu->c_isidle;
-	threadlist_addtail(&targetcpu->c_runqueue, target);
-	if (isidle) {
-		/*
-		 * Other processor is idle; send interrupt to make
-		 * sure it unidles.
-		 */
-		ipi_send(targetcpu, IPI_UNIDLE);
-	}
+	/* Interrupt state fields */
+	thread->t_in_interrupt = false;
+	thread->t_curspl = IPL_HIGH;
+	thread->t_iplhigh_count = 1; /* corresponding to t_curspl */
 
-	if (!already_have_lock) {
-		spinlock_release(&targetcpu->c_runqueue_lock);
-	}
+	/* If you add to struct thread, be sure to initialize here */
 }
 
 /*
- * Create a new thread based on an existing one.
- *
- * The new thread has name NAME, and starts executing in function
- * ENTRYPOINT. DATA1 and DATA2 are passed to ENTRYPOINT.
- *
- * The new thread is created in the process P. If P is null, the
- * process is inherited from the caller. It will start on the same CPU
- * as the caller, unless the scheduler intervenes first.
+ * Create a thread. This is used both to create a first thread
+ * for each CPU and to create subsequent forked threads.
  */
-int
-thread_fork(const char *name,
-	    struct proc *proc,
-	    void (*entrypoint)(void *data1, unsigned long data2),
-	    void *data1, unsigned long data2)
+static
+struct thread *
+thread_create(const char *name)
 {
-	struct thread *newthread;
-	int result;
+	struct thread *thread;
 
-#ifdef UW
-	DEBUG(DB_THREADS,"Forking thread: %s\n",name);
-#endif // UW
+	DEBUGASSERT(name != NULL);
 
-	newthread = thread_create(name);
-	if (newthread == NULL) {
-		return ENOMEM;
+	thread = kmalloc(sizeof(*thread));
+	if (thread == NULL) {
+		return NULL;
 	}
 
-	/* Allocate a stack */
-	newthread->t_stack = kmalloc(STACK_SIZE);
-	if (newthread->t_stack == NULL) {
-		thread_destroy(newthread);
-		return ENOMEM;
+	thread->t_name = NULL;
+	thread->t_namesize = 0;
+	if (thread_setname(thread, name)) {
+		kfree(thread);
+		return NULL;
 	}
-	thread_checkstack_init(newthread);
+	thread->t_stack = NULL;
+	thread_initfields(thread);
 
-	/*
-	 * Now we clone various fields from the parent thread.
-	 */
+	return thread;
+}
 
-	/* Thread subsystem fields */
-	newthread->t_cpu = curthread->t_cpu;
+/*
+ * Access to the cpu array.
+ */
+unsigned
+cpu_count(void)
+{
+	return cpuarray_num(&allcpus);
+}
 
-	/* Attach the new thread to its process */
-	if (proc == NULL) {
-		proc = curthread->t_proc;
+struct cpu *
+cpu_get(unsigned num)
+{
+	return cpuarray_get(&allcpus, num);
+}
+
+/*
+ * Create a CPU structure. This is used for the bootup CPU and
+ * also for secondary CPUs.
+ *
+ * The hardware number (the number assigned by firmware or system
+ * board config or whatnot) is tracked separately because it is not
+ * necessarily anything sane or meaningful.
+ */
+struct cpu *
+cpu_create(unsigned hardware_number)
+{
+	struct cpu *c;
+	int result;
+	unsigned i;
+	char namebuf[16];
+
+	c = kmalloc(sizeof(*c));
+	if (c == NULL) {
+		panic("cpu_create: Out of memory\n");
 	}
-	result = proc_addthread(proc, newthread);
+	
+	c->c_self = c;
+	c->c_hardware_number = hardware_number;
+
+	c->c_curthread = NULL;
+	threadlist_init(&c->c_zombies);
+	c->c_hardclocks = 0;
+	c->c_migrating = NULL;
+	threadlist_init(&c->c_threadcache);
+	c->c_cachehits = 0;
+	c->c_cachemisses = 0;
+	c->c_tickless = false;
+	c->c_ticksskipped = 0;
+	for (i=0; i<CPUCOUNTER_COUNT; i++) {
+		c->c_counters[i] = 0;
+	}
+	c->c_workqueue = NULL;
+	c->c_callwheel = callwheel_create();
+	if (c->c_callwheel == NULL) {
+		panic("cpu_create: Out of memory\n");
+	}
+
+	c->c_isidle = false;
+	for (i=0; i<MLFQ_LEVELS; i++) {
+		threadlist_init(&c->c_runqueue[i]);
+	}
+	threadlist_init(&c->c_stridequeue);
+	threadlist_init(&c->c_edfqueue);
+	threadlist_init(&c->c_gangqueue);
+	c->c_edfutil = 0;
+	c->c_edfmisses = 0;
+	c->c_runcount = 0;
+	c->c_tspass = 0;
+	c->c_vpass = 0;
+	c->c_steals = 0;
+	seqlock_init(&c->c_loadseq);
+	c->c_rcuqs = 0;
+	c->c_rcusnap = 0;
+	spinlock_init(&c->c_runqueue_lock);
+
+	c->c_ipi_pending = 0;
+	c->c_numshootdown = 0;
+	c->c_shootdownsent = false;
+	c->c_shootdownseq = 0;
+	c->c_shootdowndone = 0;
+	c->c_shootdownipis = 0;
+	spinlock_init(&c->c_ipi_lock);
+
+	result = cpuarray_add(&allcpus, c, &c->c_number);
+	if (result != 0) {
+		panic("cpu_create: array_add: %s\n", strerror(result));
+	}
+
+	snprintf(namebuf, sizeof(namebuf), "<boot #%d>", c->c_number);
+	c->c_curthread = thread_create(namebuf);
+	if (c->c_curthread == NULL) {
+		panic("cpu_create: thread_create failed\n");
+	}
+	result = proc_addthread(kproc, c->c_curthread);
 	if (result) {
-		/* thread_destroy will clean up the stack */
-		thread_destroy(newthread);
-		return result;
+		panic("cpu_create: proc_addthread:: %s\n", strerror(result));
+	}
+
+	if (c->c_number == 0) {
+		/*
+		 * Leave c->c_curthread->t_stack NULL for the boot
+		 * cpu. This means we're using the boot stack, which
+		 * can't be freed. (Exercise: what would it take to
+		 * make it possible to free the boot stack?)
+		 */
+		/*c->c_curthread->t_stack = ... */
+	}
+	else {
+		c->c_curthread->t_stack = kmalloc(STACK_SIZE);
+		if (c->c_curthread->t_stack == NULL) {
+			panic("cpu_create: couldn't allocate stack");
+		}
+		thread_checkstack_init(c->c_curthread);
 	}
+	c->c_curthread->t_cpu = c;
 
 	/*
-	 * Because new threads come out holding the cpu runqueue lock
-	 * (see notes at bottom of thread_switch), we need to account
-	 * for the spllower() that will be done releasing it.
+	 * The idle thread. It is never on a run queue; thread_switch
+	 * goes to it directly when there's nothing else to run. Like
+	 * a forked thread it starts out holding the run queue lock.
 	 */
-	newthread->t_iplhigh_count++;
-
-	/* Set up the switchframe so entrypoint() gets called */
-	switchframe_init(newthread, entrypoint, data1, data2);
+	snprintf(namebuf, sizeof(namebuf), "<idle #%d>", c->c_number);
+	c->c_idlethread = thread_create(namebuf);
+	if (c->c_idlethread == NULL) {
+		panic("cpu_create: thread_create failed\n");
+	}
+	result = proc_addthread(kproc, c->c_idlethread);
+	if (result) {
+		panic("cpu_create: proc_addthread:: %s\n", strerror(result));
+	}
+	c->c_idlethread->t_stack = kmalloc(STACK_SIZE);
+	if (c->c_idlethread->t_stack == NULL) {
+		panic("cpu_create: couldn't allocate stack");
+	}
+	thread_checkstack_init(c->c_idlethread);
+	c->c_idlethread->t_cpu = c;
+	c->c_idlethread->t_iplhigh_count++;
+	switchframe_init(c->c_idlethread, thread_idle, NULL, 0);
 
-	/* Lock the current cpu's run queue and make the new thread runnable */
-	thread_make_runnable(newthread, false);
+	cpu_machdep_init(c);
 
-	return 0;
+	return c;
 }
 
 /*
- * High level, machine-independent context switch code.
+ * Destroy a thread.
  *
- * The current thread is queued appropriately and its state is changed
- * to NEWSTATE; another thread to run is selected and switched to.
+ * This function cannot be called in the victim thread's own context.
+ * Nor can it be called on a running thread.
  *
- * If NEWSTATE is S_SLEEP, the thread is queued on the wait channel
- * WC. Otherwise WC should be NULL.
+ * (Freeing the stack you're actually using to run is ... inadvisable.)
  */
 static
 void
-thread_switch(threadstate_t newstate, struct wchan *wc)
+thread_destroy(struct thread *thread)
 {
-	struct thread *cur, *next;
-	int spl;
+	KASSERT(thread != curthread);
+	KASSERT(thread->t_state != S_RUN);
 
-	DEBUGASSERT(curcpu->c_curthread == curthread);
-	DEBUGASSERT(curthread->t_cpu == curcpu->c_self);
+	/*
+	 * If you add things to struct thread, be sure to clean them up
+	 * either here or in thread_exit(). (And not both...)
+	 */
 
-	/* Explicitly disable interrupts on this processor */
-	spl = splhigh();
+	/* Thread subsystem fields */
+	KASSERT(thread->t_proc == NULL);
+	if (thread->t_stack != NULL) {
+		kfree(thread->t_stack);
+	}
+	threadlistnode_cleanup(&thread->t_listnode);
+	thread_machdep_cleanup(&thread->t_machdep);
 
-	cur = curthread;
+	/* sheer paranoia */
+	thread->t_wchan_name = "DESTROYED";
 
-	/*
-	 * If we're idle, return without doing anything. This happens
-	 * when the timer interrupt interrupts the idle loop.
-	 */
-	if (curcpu->c_isidle) {
-		splx(spl);
-		return;
+	kfree(thread->t_name);
+	kfree(thread);
+}
+
+/*
+ * Clean up zombies. (Zombies are threads that have exited but still
+ * need to have thread_destroy called on them.)
+ *
+ * Rather than destroying them outright, we keep up to
+ * THREAD_CACHE_MAX of them, stacks and all, in this cpu's thread
+ * cache for thread_fork to reuse.
+ *
+ * The list of zombies is per-cpu.
+ */
+static
+void
+exorcise(void)
+{
+	struct thread *z;
+
+	while ((z = threadlist_remhead(&curcpu->c_zombies)) != NULL) {
+		KASSERT(z != curthread);
+		KASSERT(z->t_state == S_ZOMBIE);
+		KASSERT(z->t_proc == NULL);
+		if (z->t_stack != NULL &&
+		    curcpu->c_threadcache.tl_count < THREAD_CACHE_MAX) {
+			threadlist_addhead(&curcpu->c_threadcache, z);
+		}
+		else {
+			thread_destroy(z);
+		}
 	}
+}
 
-	/* Check the stack guard band. */
-	thread_checkstack(cur);
+/*
+ * Get a thread with a stack for thread_fork, from this cpu's thread
+ * cache if possible and otherwise freshly allocated.
+ */
+static
+struct thread *
+thread_get(const char *name)
+{
+	struct thread *thread;
+	int spl;
 
-	/* Lock the run queue. */
-	spinlock_acquire(&curcpu->c_runqueue_lock);
+	/*
+	 * The cache is per-cpu and exorcise() can run from an
+	 * interrupt; stay on this cpu and keep interrupts off while
+	 * we look at it.
+	 */
+	spl = splhigh();
+	thread = threadlist_remhead(&curcpu->c_threadcache);
+	if (thread != NULL) {
+		curcpu->c_cachehits++;
+	}
+	else {
+		curcpu->c_cachemisses++;
+	}
+	splx(spl);
 
-	/* Micro-optimization: if nothing to do, just return */
-	if (newstate == S_READY && threadlist_isempty(&curcpu->c_runqueue)) {
-		spinlock_release(&curcpu->c_runqueue_lock);
-		splx(spl);
-		return;
+	if (thread != NULL) {
+		/* Don't keep the one we reuse if we can't name it */
+		if (thread_setname(thread, name)) {
+			thread_destroy(thread);
+			return NULL;
+		}
+		thread_initfields(thread);
+		return thread;
 	}
 
-	/* Put the thread in the right place. */
-	switch (newstate) {
-	    case S_RUN:
-		panic("Illegal S_RUN in thread_switch\n");
-	    case S_READY:
-		thread_make_runnable(cur, true /*have lock*/);
-		break;
-	    case S_SLEEP:
-		cur->t_wchan_name = wc->wc_name;
-		/*
-		 * Add the thread to the list in the wait channel, and
-		 * unlock same. To avoid a race with someone else
-		 * calling wchan_wake*, we must keep the wchan locked
-		 * from the point the caller of wchan_sleep locked it
-		 * until the thread is on the list.
-		 *
-		 * (We could for symmetry relock the channel before
-		 * returning from wchan_sleep, but we don't, for two
-		 * reasons. One is that the caller is unlikely to need
-		 * or want it locked and if it does can lock it itself
-		 * without racing. Exercise: what's the other?)
-		 */
-		threadlist_addtail(&wc->wc_threads, cur);
-		wchan_unlock(wc);
-		break;
-	    case S_ZOMBIE:
-		cur->t_wchan_name = "ZOMBIE";
-		threadlist_addtail(&curcpu->c_zombies, cur);
-		break;
+	thread = thread_create(name);
+	if (thread == NULL) {
+		return NULL;
 	}
-	cur->t_state = newstate;
+	thread->t_stack = kmalloc(STACK_SIZE);
+	if (thread->t_stack == NULL) {
+		thread_destroy(thread);
+		return NULL;
+	}
+	return thread;
+}
+
+/*
+ * On panic, stop the thread system (as much as is reasonably
+ * possible) to make sure we don't end up letting any other threads
+ * run.
+ */
+void
+thread_panic(void)
+{
+	unsigned i;
 
 	/*
-	 * Get the next thread. While there isn't one, call md_idle().
-	 * curcpu->c_isidle must be true when md_idle is
-	 * called. Unlock the runqueue while idling too, to make sure
-	 * things can be added to it.
-	 *
-	 * Note that we don't need to unlock the runqueue atomically
-	 * with idling; becoming unidle requires receiving an
-	 * interrupt (either a hardware interrupt or an interprocessor
-	 * interrupt from another cpu posting a wakeup) and idling
-	 * *is* atomic with respect to re-enabling interrupts.
+	 * Kill off other CPUs.
 	 *
-	 * Note that c_isidle becomes true briefly even if we don't go
-	 * idle. However, because one is supposed to hold the runqueue
-	 * lock to look at it, this should not be visible or matter.
+	 * We could wait for them to stop, except that they might not.
 	 */
-
-	/* The current cpu is now idle. */
-	curcpu->c_isidle = true;
-	do {
-		next = threadlist_remhead(&curcpu->c_runqueue);
-		if (next == NULL) {
-			spinlock_release(&curcpu->c_runqueue_lock);
-			cpu_idle();
-			spinlock_acquire(&curcpu->c_runqueue_lock);
-		}
-	} while (next == NULL);
-	curcpu->c_isidle = false;
+	ipi_broadcast(IPI_PANIC);
 
 	/*
-	 * Note that curcpu->c_curthread may be the same variable as
-	 * curthread and it may not be, depending on how curthread and
-	 * curcpu are defined by the MD code. We'll assign both and
-	 * assume the compiler will optimize one away if they're the
-	 * same.
+	 * Drop runnable threads on the floor.
+	 *
+	 * Don't try to get the run queue lock; we might not be able
+	 * to.  Instead, blat the list structure by hand, and take the
+	 * risk that it might not be quite atomic.
 	 */
-	curcpu->c_curthread = next;
-	curthread = next;
-
-	/* do the switch (in assembler in switch.S) */
-	switchframe_switch(&cur->t_context, &next->t_context);
+	for (i=0; i<MLFQ_LEVELS; i++) {
+		curcpu->c_runqueue[i].tl_count = 0;
+		curcpu->c_runqueue[i].tl_head.tln_next = NULL;
+		curcpu->c_runqueue[i].tl_tail.tln_prev = NULL;
+	}
+	curcpu->c_stridequeue.tl_count = 0;
+	curcpu->c_stridequeue.tl_head.tln_next = NULL;
+	curcpu->c_stridequeue.tl_tail.tln_prev = NULL;
+	curcpu->c_edfqueue.tl_count = 0;
+	curcpu->c_edfqueue.tl_head.tln_next = NULL;
+	curcpu->c_edfqueue.tl_tail.tln_prev = NULL;
+	curcpu->c_gangqueue.tl_count = 0;
+	curcpu->c_gangqueue.tl_head.tln_next = NULL;
+	curcpu->c_gangqueue.tl_tail.tln_prev = NULL;
+	curcpu->c_runcount = 0;
 
 	/*
-	 * When we get to this point we are either running in the next
-	 * thread, or have come back to the same thread again,
-	 * depending on how you look at it. That is,
-	 * switchframe_switch returns immediately in another thread
-	 * context, which in general will be executing here with a
-	 * different stack and different values in the local
-	 * variables. (Although new threads go to thread_startup
-	 * instead.) But, later on when the processor, or some
-	 * processor, comes back to the previous thread, it's also
-	 * executing here with the *same* value in the local
-	 * variables.
-	 *
-	 * The upshot, however, is as follows:
-	 *
-	 *    - The thread now currently running is "cur", not "next",
-	 *      because when we return from switchrame_switch on the
-	 *      same stack, we're back to the thread that
-	 *      switchframe_switch call switched away from, which is
-	 *      "cur".
-	 *
-	 *    - "cur" is _not_ the thread that just *called*
-	 *      switchframe_switch.
-	 *
-	 *    - If newstate is S_ZOMB we never get back here in that
-	 *      context at all.
-	 *
-	 *    - If the thread just chosen to run ("next") was a new
-	 *      thread, we don't get to this code again until
-	 *      *another* context switch happens, because when new
-	 *      threads return from switchframe_switch they teleport
-	 *      to thread_startup.
+	 * Ideally, we want to make sure sleeping threads don't wake
+	 * up and start running. However, there's no good way to track
+	 * down all the wchans floating around the system. Another
+	 * alternative would be to set a global flag to make the wchan
+	 * wakeup operations do nothing; but that would mean we
+	 * ourselves couldn't sleep to wait for an I/O completion
+	 * interrupt, and we'd like to be able to do that if the
+	 * system isn't that badly hosed.
 	 *
-	 *    - At this point the thread whose stack we're now on may
-	 *      have been migrated to another cpu since it last ran.
+	 * So, do nothing else here.
 	 *
-	 * The above is inherently confusing and will probably take a
-	 * while to get used to.
+	 * This may prove inadequate in practice and further steps
+	 * might be needed. It may also be necessary to go through and
+	 * forcibly unlock all locks or the like...
+	 */
+}
+
+/*
+ * At system shutdown, ask the other CPUs to switch off.
+ */
+void
+thread_shutdown(void)
+{
+	/*
+	 * Stop the other CPUs.
 	 *
-	 * However, the important part is that code placed here, after
-	 * the call to switchframe_switch, does not necessarily run on
-	 * every context switch. Thus any such code must be either
-	 * skippable on some switches or also called from
-	 * thread_startup.
+	 * We should probably wait for them to stop and shut them off
+	 * on the system board.
+	 */
+	ipi_broadcast(IPI_OFFLINE);
+}
+
+/*
+ * Thread system initialization.
+ */
+void
+thread_bootstrap(void)
+{
+	struct cpu *bootcpu;
+	struct thread *bootthread;
+
+	cpuarray_init(&allcpus);
+	sleepq_bootstrap();
+
+	/*
+	 * Create the cpu structure for the bootup CPU, the one we're
+	 * currently running on. Assume the hardware number is 0; that
+	 * might be updated later by mainbus-type code. This also
+	 * creates a thread structure for the first thread, the one
+	 * that's already implicitly running when the kernel is
+	 * started from the bootloader.
+	 */
+	bootcpu = cpu_create(0);
+	bootthread = bootcpu->c_curthread;
+
+	/*
+	 * Initializing curcpu and curthread is machine-dependent
+	 * because either of curcpu and curthread might be defined in
+	 * terms of the other.
+	 */
+	INIT_CURCPU(bootcpu, bootthread);
+
+	/*
+	 * Now make sure both t_cpu and c_curthread are set. This
+	 * might be partially redundant with INIT_CURCPU depending on
+	 * how things are defined.
 	 */
+	curthread->t_cpu = curcpu;
+	curcpu->c_curthread = curthread;
+
+	/* cpu_create() should have set t_proc. */
+	KASSERT(curthread->t_proc != NULL);
+
+	/* Done */
+}
+
+/*
+ * New CPUs come here once MD initialization is finished. curthread
+ * and curcpu should already be initialized.
+ *
+ * Other than clearing thread_start_cpus() to continue, we don't need
+ * to do anything. The startup thread can just exit; we only need it
+ * to be able to get into thread_switch() properly.
+ */
+void
+cpu_hatch(unsigned software_number)
+{
+	KASSERT(curcpu != NULL);
+	KASSERT(curthread != NULL);
+	KASSERT(curcpu->c_number == software_number);
+
+	spl0();
+
+	kprintf("cpu%u: %s\n", software_number, cpu_identify());
+
+	V(cpu_startup_sem);
+	thread_exit();
+}
+
+/*
+ * Start up secondary cpus. Called from boot().
+ */
+void
+thread_start_cpus(void)
+{
+	unsigned i;
+
+	kprintf("cpu0: %s\n", cpu_identify());
+
+	cpu_startup_sem = sem_create("cpu_hatch", 0);
+	mainbus_start_cpus();
+	
+	for (i=0; i<cpuarray_num(&allcpus) - 1; i++) {
+		P(cpu_startup_sem);
+	}
+	sem_destroy(cpu_startup_sem);
+	cpu_startup_sem = NULL;
+}
+
+/*
+ * Choose a cpu for a thread whose current cpu is outside its affinity
+ * mask: the allowed cpu with the fewest threads waiting. The counts
+ * are read without the run queue locks, so this is only a heuristic.
+ */
+static
+struct cpu *
+thread_pick_cpu(struct thread *t)
+{
+	struct cpu *c, *best;
+	struct cpuload cl;
+	unsigned i, numcpus, bestcount;
+
+	best = NULL;
+	bestcount = 0;
+	numcpus = cpuarray_num(&allcpus);
+	for (i=0; i<numcpus; i++) {
+		c = cpuarray_get(&allcpus, i);
+		if (!thread_cpu_allowed(t, c)) {
+			continue;
+		}
+		cpu_getload(c, &cl);
+		if (best == NULL || cl.cl_runcount < bestcount) {
+			best = c;
+			bestcount = cl.cl_runcount;
+		}
+	}
+	KASSERT(best != NULL);
+	return best;
+}
+
+/*
+ * Choose the cpu a thread that's about to become runnable should go
+ * to: its current one, unless its affinity mask doesn't allow that.
+ *
+ * A sleeper goes onto its wait channel, and the channel is unlocked,
+ * while its cpu is still switching away from it on its stack; the
+ * cpu's run queue lock is held until that's finished, that is, until
+ * the cpu is running on some other thread's stack. (If there's
+ * nothing else to run, that's the idle thread's; thread_switch never
+ * drops the lock to idle on the stack of the thread it's leaving.)
+ * Waking it on the same cpu waits that out by taking the lock. Before
+ * sending it anywhere else we must do the same, or another cpu could
+ * start running it while the old one is still on its stack.
+ */
+static
+struct cpu *
+thread_wakeup_cpu(struct thread *t)
+{
+	struct cpu *oldcpu;
+
+	oldcpu = t->t_cpu;
+	if (!thread_cpu_allowed(t, oldcpu)) {
+		spinlock_acquire(&oldcpu->c_runqueue_lock);
+		spinlock_release(&oldcpu->c_runqueue_lock);
+		t->t_cpu = thread_pick_cpu(t);
+	}
+	return t->t_cpu;
+}
+
+/*
+ * Make a thread runnable.
+ *
+ * targetcpu might be curcpu; it might not be, too. If the thread's
+ * affinity mask doesn't allow it on its current cpu, it is sent
+ * elsewhere; that can't happen when the caller already holds the
+ * lock, since it's holding a specific cpu's lock.
+ */
+static
+void
+thread_make_runnable(struct thread *target, bool already_have_lock)
+{
+	struct cpu *targetcpu;
+	bool isidle;
+
+	/* Lock the run queue of the target thread's cpu. */
+	if (already_have_lock) {
+		targetcpu = target->t_cpu;
+		/* The target thread's cpu should be already locked. */
+		KASSERT(spinlock_do_i_hold(&targetcpu->c_runqueue_lock));
+	}
+	else {
+		targetcpu = thread_wakeup_cpu(target);
+		spinlock_acquire(&targetcpu->c_runqueue_lock);
+	}
+
+	isidle = targetcpu->c_isidle;
+	runqueue_add(targetcpu, target);
+	if (isidle) {
+		/*
+		 * Other processor is idle; send interrupt to make
+		 * sure it unidles.
+		 */
+		ipi_send(targetcpu, IPI_UNIDLE);
+	}
+
+	if (!already_have_lock) {
+		spinlock_release(&targetcpu->c_runqueue_lock);
+	}
+}
+
+/*
+ * Make a list of threads, all headed for cpu TARGETCPU, runnable,
+ * taking the run queue lock and sending a wakeup IPI only once.
+ * The list is left empty.
+ */
+static
+void
+thread_make_runnable_batch(struct cpu *targetcpu, struct threadlist *batch)
+{
+	struct thread *target;
+	bool isidle;
+
+	spinlock_acquire(&targetcpu->c_runqueue_lock);
+	isidle = targetcpu->c_isidle;
+	while ((target = threadlist_remhead(batch)) != NULL) {
+		KASSERT(target->t_cpu == targetcpu);
+		runqueue_add(targetcpu, target);
+	}
+	if (isidle) {
+		ipi_send(targetcpu, IPI_UNIDLE);
+	}
+	spinlock_release(&targetcpu->c_runqueue_lock);
+}
+
+/*
+ * Create a new thread based on an existing one.
+ *
+ * The new thread has name NAME, and starts executing in function
+ * ENTRYPOINT. DATA1 and DATA2 are passed to ENTRYPOINT.
+ *
+ * The new thread is created in the process P. If P is null, the
+ * process is inherited from the caller. It will start on the same CPU
+ * as the caller, unless the scheduler intervenes first.
+ */
+int
+thread_fork(const char *name,
+	    struct proc *proc,
+	    void (*entrypoint)(void *data1, unsigned long data2),
+	    void *data1, unsigned long data2)
+{
+	struct thread *newthread;
+	int result;
+
+#ifdef UW
+	DEBUG(DB_THREADS,"Forking thread: %s\n",name);
+#endif // UW
+
+	/* Get a thread and stack, recycled if possible */
+	newthread = thread_get(name);
+	if (newthread == NULL) {
+		return ENOMEM;
+	}
+	thread_checkstack_init(newthread);
+
+	/*
+	 * Now we clone various fields from the parent thread.
+	 */
+
+	/* Thread subsystem fields */
+	newthread->t_cpu = curthread->t_cpu;
+	newthread->t_affinity = curthread->t_affinity;
+	newthread->t_tickets = curthread->t_tickets;
+
+	/* Attach the new thread to its process */
+	if (proc == NULL) {
+		proc = curthread->t_proc;
+	}
+	result = proc_addthread(proc, newthread);
+	if (result) {
+		/* thread_destroy will clean up the stack */
+		thread_destroy(newthread);
+		return result;
+	}
+
+	/*
+	 * Because new threads come out holding the cpu runqueue lock
+	 * (see notes at bottom of thread_switch), we need to account
+	 * for the spllower() that will be done releasing it.
+	 */
+	newthread->t_iplhigh_count++;
+
+	/* Set up the switchframe so entrypoint() gets called */
+	switchframe_init(newthread, entrypoint, data1, data2);
+
+	/* Lock the current cpu's run queue and make the new thread runnable */
+	thread_make_runnable(newthread, false);
+
+	return 0;
+}
+
+/*
+ * Finish moving a thread that thread_switch() took off this cpu
+ * because its affinity mask excludes us. This has to wait until it's
+ * completely switched out, that is, until we're running on some other
+ * thread's stack; see thread_switch.
+ */
+static
+void
+thread_finish_migration(void)
+{
+	struct thread *t;
+
+	t = curcpu->c_migrating;
+	if (t == NULL) {
+		return;
+	}
+	curcpu->c_migrating = NULL;
+
+	KASSERT(t != curthread);
+	KASSERT(t->t_state == S_READY);
+	thread_make_runnable(t, false);
+}
+
+/*
+ * High level, machine-independent context switch code.
+ *
+ * The current thread is queued appropriately and its state is changed
+ * to NEWSTATE; another thread to run is selected and switched to.
+ *
+ * If NEWSTATE is S_SLEEP, the thread is queued on the wait channel
+ * WC, which must be locked; the caller sets t_wchankey and
+ * t_wchan_name first. Otherwise WC should be NULL.
+ */
+static
+void
+thread_switch(threadstate_t newstate, struct wchan *wc)
+{
+	struct thread *cur, *next;
+	int spl;
+
+	DEBUGASSERT(curcpu->c_curthread == curthread);
+	DEBUGASSERT(curthread->t_cpu == curcpu->c_self);
+
+	/* Explicitly disable interrupts on this processor */
+	spl = splhigh();
+
+	cur = curthread;
+
+	/*
+	 * If we're idle, return without doing anything. This happens
+	 * when the timer interrupt interrupts the idle loop.
+	 */
+	if (curcpu->c_isidle) {
+		splx(spl);
+		return;
+	}
+
+	/* Check the stack guard band. */
+	thread_checkstack(cur);
+
+	/* Sleeping in an RCU read section would stall grace periods. */
+	KASSERT(cur->t_rcudepth == 0);
+	/* Having got here, this cpu is outside any read section. */
+	curcpu->c_rcuqs++;
+
+	/* Lock the run queue. */
+	spinlock_acquire(&curcpu->c_runqueue_lock);
+
+	/*
+	 * Micro-optimization: if nothing to do, just return. Not if
+	 * we're not supposed to be on this cpu any more, though; then
+	 * we have to get off it even if there's nothing else to run
+	 * (see below). Nor for the idle thread, which comes here
+	 * precisely to wait for something to do.
+	 */
+	if (newstate == S_READY && curcpu->c_runcount == 0 &&
+	    cur != curcpu->c_idlethread &&
+	    thread_cpu_allowed(cur, curcpu->c_self)) {
+		spinlock_release(&curcpu->c_runqueue_lock);
+		splx(spl);
+		return;
+	}
+
+	/* Put the thread in the right place. */
+	switch (newstate) {
+	    case S_RUN:
+		panic("Illegal S_RUN in thread_switch\n");
+	    case S_READY:
+		if (cur == curcpu->c_idlethread) {
+			/* Never queued; see thread_idle. */
+			break;
+		}
+		if (!thread_cpu_allowed(cur, curcpu->c_self)) {
+			/*
+			 * Our affinity mask no longer includes this
+			 * cpu. We can't put ourselves on another cpu's
+			 * run queue yet, because it might pick us up
+			 * before we've finished switching off this
+			 * stack. So leave a note, and whichever thread
+			 * we switch to will requeue us once it's
+			 * running. (There is always one; if the run
+			 * queue is empty, it's the idle thread.)
+			 */
+			KASSERT(curcpu->c_migrating == NULL);
+			curcpu->c_migrating = cur;
+			break;
+		}
+		thread_make_runnable(cur, true /*have lock*/);
+		break;
+	    case S_SLEEP:
+		/*
+		 * Add the thread to the list in the wait channel, and
+		 * unlock same. To avoid a race with someone else
+		 * calling wchan_wake*, we must keep the wchan locked
+		 * from the point the caller of wchan_sleep locked it
+		 * until the thread is on the list.
+		 *
+		 * (We could for symmetry relock the channel before
+		 * returning from wchan_sleep, but we don't, for two
+		 * reasons. One is that the caller is unlikely to need
+		 * or want it locked and if it does can lock it itself
+		 * without racing. Exercise: what's the other?)
+		 */
+		threadlist_addtail(&wc->wc_threads, cur);
+		cur->t_wchan = wc;
+		cur->t_wchangen = wc->wc_gen;
+		wchan_unlock(wc);
+		break;
+	    case S_ZOMBIE:
+		cur->t_wchan_name = "ZOMBIE";
+		threadlist_addtail(&curcpu->c_zombies, cur);
+		break;
+	}
+	cur->t_state = newstate;
+
+	/* Remember where and when we last ran, for migration. */
+	cur->t_lastcpu = curcpu->c_self;
+	cur->t_lastran = curcpu->c_hardclocks;
+
+	/*
+	 * Get the next thread. If there isn't one, switch to this
+	 * cpu's idle thread, which comes back here and, while there
+	 * still isn't one, calls md_idle(). Idling is only ever done
+	 * on the idle thread's own stack: the runqueue lock is dropped
+	 * while idling, and once it's dropped the thread whose stack
+	 * we're on can be woken up and run by another cpu (see
+	 * thread_wakeup_cpu). curcpu->c_isidle must be true when
+	 * md_idle is called. Unlock the runqueue while idling too, to
+	 * make sure things can be added to it.
+	 *
+	 * Note that we don't need to unlock the runqueue atomically
+	 * with idling; becoming unidle requires receiving an
+	 * interrupt (either a hardware interrupt or an interprocessor
+	 * interrupt from another cpu posting a wakeup) and idling
+	 * *is* atomic with respect to re-enabling interrupts.
+	 *
+	 * Note that c_isidle becomes true briefly even if we don't go
+	 * idle. However, because one is supposed to hold the runqueue
+	 * lock to look at it, this should not be visible or matter.
+	 *
+	 * Before actually idling, try to steal work from another cpu.
+	 * If that gets us something it lands on our run queue and we
+	 * go around again to pick it up.
+	 *
+	 * While idle we turn off hardclock; there's nothing for it to
+	 * do here, and whatever makes work for us will also send an
+	 * interrupt.
+	 */
+
+	/* The current cpu is now idle. */
+	curcpu->c_isidle = true;
+	do {
+		next = runqueue_remhead(curcpu->c_self);
+		if (next == NULL && cur != curcpu->c_idlethread) {
+			next = curcpu->c_idlethread;
+		}
+		else if (next == NULL) {
+			spinlock_release(&curcpu->c_runqueue_lock);
+			if (thread_steal() == 0) {
+				hardclock_stop();
+				cpu_idle();
+				hardclock_restart();
+			}
+			spinlock_acquire(&curcpu->c_runqueue_lock);
+		}
+	} while (next == NULL);
+	curcpu->c_isidle = false;
+
+	/*
+	 * Note that curcpu->c_curthread may be the same variable as
+	 * curthread and it may not be, depending on how curthread and
+	 * curcpu are defined by the MD code. We'll assign both and
+	 * assume the compiler will optimize one away if they're the
+	 * same.
+	 */
+	curcpu->c_curthread = next;
+	curthread = next;
+
+	/* do the switch (in assembler in switch.S) */
+	switchframe_switch(&cur->t_context, &next->t_context);
+
+	/*
+	 * When we get to this point we are either running in the next
+	 * thread, or have come back to the same thread again,
+	 * depending on how you look at it. That is,
+	 * switchframe_switch returns immediately in another thread
+	 * context, which in general will be executing here with a
+	 * different stack and different values in the local
+	 * variables. (Although new threads go to thread_startup
+	 * instead.) But, later on when the processor, or some
+	 * processor, comes back to the previous thread, it's also
+	 * executing here with the *same* value in the local
+	 * variables.
+	 *
+	 * The upshot, however, is as follows:
+	 *
+	 *    - The thread now currently running is "cur", not "next",
+	 *      because when we return from switchrame_switch on the
+	 *      same stack, we're back to the thread that
+	 *      switchframe_switch call switched away from, which is
+	 *      "cur".
+	 *
+	 *    - "cur" is _not_ the thread that just *called*
+	 *      switchframe_switch.
+	 *
+	 *    - If newstate is S_ZOMB we never get back here in that
+	 *      context at all.
+	 *
+	 *    - If the thread just chosen to run ("next") was a new
+	 *      thread, we don't get to this code again until
+	 *      *another* context switch happens, because when new
+	 *      threads return from switchframe_switch they teleport
+	 *      to thread_startup.
+	 *
+	 *    - At this point the thread whose stack we're now on may
+	 *      have been migrated to another cpu since it last ran.
+	 *
+	 * The above is inherently confusing and will probably take a
+	 * while to get used to.
+	 *
+	 * However, the important part is that code placed here, after
+	 * the call to switchframe_switch, does not necessarily run on
+	 * every context switch. Thus any such code must be either
+	 * skippable on some switches or also called from
+	 * thread_startup.
+	 */
+
+
+	/* Clear the wait channel and set the thread state. */
+	cur->t_wchan_name = NULL;
+	cur->t_state = S_RUN;
+
+	/* Unlock the run queue. */
+	spinlock_release(&curcpu->c_runqueue_lock);
+
+	/* Requeue the previous thread elsewhere, if needed. */
+	thread_finish_migration();
+
+	/* Activate our address space in the MMU. */
+	as_activate();
+
+	/* Clean up dead threads. */
+	exorcise();
+
+	/* Turn interrupts back on. */
+	splx(spl);
+}
+
+/*
+ * This function is where new threads start running. The arguments
+ * ENTRYPOINT, DATA1, and DATA2 are passed through from thread_fork.
+ *
+ * Because new code comes here from inside the middle of
+ * thread_switch, the beginning part of this function must match the
+ * tail of thread_switch.
+ */
+void
+thread_startup(void (*entrypoint)(void *data1, unsigned long data2),
+	       void *data1, unsigned long data2)
+{
+	struct thread *cur;
+
+	cur = curthread;
+
+	/* Clear the wait channel and set the thread state. */
+	cur->t_wchan_name = NULL;
+	cur->t_state = S_RUN;
+
+	/* Release the runqueue lock acquired in thread_switch. */
+	spinlock_release(&curcpu->c_runqueue_lock);
+
+	/* Requeue the previous thread elsewhere, if needed. */
+	thread_finish_migration();
+
+	/* Activate our address space in the MMU. */
+	as_activate();
+
+	/* Clean up dead threads. */
+	exorcise();
+
+	/* Enable interrupts. */
+	spl0();
+
+#if OPT_SYNCHPROBS
+	/* Yield a random number of times to get a good mix of threads. */
+	{
+		int i, n;
+		n = random()%161 + random()%161;
+		for (i=0; i<n; i++) {
+			thread_yield();
+		}
+	}
+#endif
+
+	/* Call the function. */
+	entrypoint(data1, data2);
+
+	/* Done. */
+	thread_exit();
+}
+
+/*
+ * Cause the current thread to exit.
+ *
+ * The parts of the thread structure we don't actually need to run
+ * should be cleaned up right away. The rest has to wait until
+ * thread_destroy is called from exorcise().
+ *
+ * Does not return.
+ */
+void
+thread_exit(void)
+{
+	struct thread *cur;
+
+	cur = curthread;
+
+#ifdef UW
+	/* threads for user processes should have detached from their process
+	   in sys__exit */
+	KASSERT(curproc == kproc || curproc == NULL);	
+	/* kernel threads don't go through sys__exit, so we detach them from kproc here */
+	if (curproc == kproc) {
+	  proc_remthread(cur);
+	}
+#else // UW
+	proc_remthread(cur);
+#endif // UW
+
+	/* Make sure we *are* detached (move this only if you're sure!) */
+	KASSERT(cur->t_proc == NULL);
+
+	/* Free up our EDF reservation, if any. */
+	thread_edf_release(cur);
+	cur->t_edfperiod = 0;
+	cur->t_edfcpu = NULL;
+
+	/* Check the stack guard band. */
+	thread_checkstack(cur);
+
+	/* Interrupts off on this processor */
+        splhigh();
+	thread_switch(S_ZOMBIE, NULL);
+	panic("The zombie walks!\n");
+}
+
+/*
+ * The body of each cpu's idle thread. thread_switch switches here
+ * when it has nothing else to run, and the idle thread goes straight
+ * back into thread_switch to wait for something.
+ */
+static
+void
+thread_idle(void *junk, unsigned long junk2)
+{
+	(void)junk;
+	(void)junk2;
+
+	while (1) {
+		thread_switch(S_READY, NULL);
+	}
+}
+
+/*
+ * Yield the cpu to another process, but stay runnable.
+ */
+void
+thread_yield(void)
+{
+	thread_switch(S_READY, NULL);
+}
+
+////////////////////////////////////////////////////////////
+
+/*
+ * Scheduler.
+ *
+ * This is called periodically from hardclock(). It should reshuffle
+ * the current CPU's run queue by job priority.
+ *
+ * The scheduler is a multi-level feedback queue. Most of the work
+ * happens elsewhere: thread_quantum_tick() demotes threads that use
+ * up their quantum, and the wakeup code promotes threads coming off a
+ * wait channel, so I/O-bound threads float to the top and CPU-bound
+ * ones sink. All that's left to do here is the periodic priority
+ * boost, which puts every thread on this cpu back at the top level so
+ * that nothing at the bottom starves behind a steady stream of
+ * interactive work.
+ */
+void
+schedule(void)
+{
+	struct cpu *c = curcpu->c_self;
+	struct thread *t;
+	unsigned i;
+
+	if ((c->c_hardclocks % MLFQ_BOOST_HARDCLOCKS) != 0) {
+		return;
+	}
+
+	spinlock_acquire(&c->c_runqueue_lock);
+	for (i=MLFQ_TOPLEVEL+1; i<MLFQ_LEVELS; i++) {
+		while ((t = threadlist_remhead(&c->c_runqueue[i])) != NULL) {
+			t->t_priority = MLFQ_TOPLEVEL;
+			t->t_ticksleft = mlfq_quantum(MLFQ_TOPLEVEL);
+			t->t_runlevel = MLFQ_TOPLEVEL;
+			threadlist_addtail(&c->c_runqueue[MLFQ_TOPLEVEL], t);
+		}
+	}
+	if (!c->c_isidle) {
+		curthread->t_priority = MLFQ_TOPLEVEL;
+		curthread->t_ticksleft = mlfq_quantum(MLFQ_TOPLEVEL);
+	}
+	spinlock_release(&c->c_runqueue_lock);
+}
+
+/*
+ * EDF bookkeeping for the threads on this cpu's EDF queue, once per
+ * hardclock: any whose deadline has passed start a new period, and
+ * since they were waiting to run, count a miss if they still had
+ * budget left.
+ */
+static
+void
+edf_tick(struct cpu *c)
+{
+	struct threadlist expired;
+	struct thread *t;
+
+	KASSERT(spinlock_do_i_hold(&c->c_runqueue_lock));
+
+	threadlist_init(&expired);
+	/* The EDF count dips meanwhile; keep cpu_getload from seeing it */
+	seqlock_write_begin(&c->c_loadseq);
+	while (!threadlist_isempty(&c->c_edfqueue)) {
+		t = c->c_edfqueue.tl_head.tln_next->tln_self;
+		if (time_before(c->c_hardclocks, t->t_edfdeadline)) {
+			break;
+		}
+		threadlist_remove(&c->c_edfqueue, t);
+		threadlist_addtail(&expired, t);
+	}
+	while ((t = threadlist_remhead(&expired)) != NULL) {
+		edf_update(c, t, true);
+		edfqueue_insert(c, t);
+	}
+	seqlock_write_end(&c->c_loadseq);
+	threadlist_cleanup(&expired);
+}
+
+/*
+ * Quantum accounting, called from hardclock() on every tick.
+ *
+ * An EDF thread is charged against its budget and runs until the
+ * budget is gone or an EDF thread with an earlier deadline and budget
+ * left is waiting. Other threads yield as soon as any EDF thread with
+ * budget is waiting, or when gang_preempt() says so. Gang threads
+ * aren't charged to any stride client.
+ *
+ * Otherwise, the tick is charged to the current thread's stride
+ * client: the thread itself if it's a stride thread, otherwise the
+ * MLFQ class. If the current thread has used up its quantum, demote
+ * it (if it's an MLFQ thread) and tell hardclock to yield; it will
+ * then go to the back of its new level, or wherever its pass puts it.
+ * Otherwise, an MLFQ thread also yields if something at a higher
+ * level is waiting.
+ */
+bool
+thread_quantum_tick(void)
+{
+	struct cpu *c = curcpu->c_self;
+	struct thread *cur = curthread;
+	struct thread *edfnext;
+	bool preempt, stride;
+	unsigned i, level;
+
+	/* If we're idle, the "current" thread isn't actually running. */
+	if (c->c_isidle) {
+		return false;
+	}
+
+	spinlock_acquire(&c->c_runqueue_lock);
+
+	edf_tick(c);
+	edfnext = edfqueue_first_eligible(c);
+
+	level = runqueue_level(c, cur);
+	if (level == RUNQ_EDF) {
+		if (cur->t_edfleft > 0) {
+			cur->t_edfleft--;
+		}
+		edf_update(c, cur, true);
+		preempt = cur->t_edfleft == 0 ||
+			(edfnext != NULL &&
+			 time_before(edfnext->t_edfdeadline,
+				     cur->t_edfdeadline));
+		spinlock_release(&c->c_runqueue_lock);
+		return preempt;
+	}
+	if (edfnext != NULL) {
+		spinlock_release(&c->c_runqueue_lock);
+		return true;
+	}
+
+	if (gang_preempt(c, cur, level)) {
+		spinlock_release(&c->c_runqueue_lock);
+		return true;
+	}
+	if (level == RUNQ_GANG) {
+		/*
+		 * A gang thread in its turn runs until the turn is
+		 * over, round-robin with any others of its gang here.
+		 */
+		KASSERT(cur->t_ticksleft > 0);
+		cur->t_ticksleft--;
+		if (cur->t_ticksleft == 0) {
+			cur->t_ticksleft = mlfq_quantum(MLFQ_TOPLEVEL);
+			preempt = gangqueue_find(c, cur->t_proc) != NULL;
+		}
+		else {
+			preempt = false;
+		}
+		spinlock_release(&c->c_runqueue_lock);
+		return preempt;
+	}
+
+	stride = level == RUNQ_STRIDE;
+	if (stride) {
+		cur->t_pass += STRIDE1 / cur->t_tickets;
+	}
+	else {
+		c->c_tspass += STRIDE1 / STRIDE_TSTICKETS;
+	}
+
+	KASSERT(cur->t_ticksleft > 0);
+	cur->t_ticksleft--;
+	if (cur->t_ticksleft == 0) {
+		if (stride) {
+			cur->t_ticksleft = STRIDE_QUANTUM;
+		}
+		else {
+			if (cur->t_priority < MLFQ_BOTTOMLEVEL) {
+				cur->t_priority++;
+			}
+			cur->t_ticksleft = mlfq_quantum(cur->t_priority);
+		}
+		spinlock_release(&c->c_runqueue_lock);
+		return true;
+	}
+
+	preempt = false;
+	if (!stride) {
+		for (i=MLFQ_TOPLEVEL; i<thread_priority(cur); i++) {
+			if (!threadlist_isempty(&c->c_runqueue[i])) {
+				preempt = true;
+				break;
+			}
+		}
+	}
+	spinlock_release(&c->c_runqueue_lock);
+	return preempt;
+}
+
+/*
+ * Scheduling priority, taking inheritance into account.
+ */
+unsigned
+thread_priority(const struct thread *t)
+{
+	return t->t_inherited < t->t_priority ?
+		t->t_inherited : t->t_priority;
+}
+
+/*
+ * Change a thread's inherited priority. If it's sitting on a run
+ * queue, move it to the queue for its new priority so the change
+ * takes effect right away.
+ */
+void
+thread_set_inherited(struct thread *t, unsigned level)
+{
+	struct cpu *c;
+
+	KASSERT(level <= PRIO_NONE);
+
+	/* t_cpu can change unless we hold its run queue lock */
+	while (1) {
+		c = t->t_cpu;
+		spinlock_acquire(&c->c_runqueue_lock);
+		if (t->t_cpu == c) {
+			break;
+		}
+		spinlock_release(&c->c_runqueue_lock);
+	}
+
+	t->t_inherited = level;
+	if (t->t_runlevel != RUNQ_NONE &&
+	    t->t_runlevel != runqueue_level(c, t)) {
+		runqueue_remove(c, t);
+		runqueue_add(c, t);
+	}
+	spinlock_release(&c->c_runqueue_lock);
+}
+
+/*
+ * Give a thread that's waking up from a wait channel a boost: move it
+ * up one level and give it a fresh quantum. Threads that mostly sleep
+ * thus stay near the top and get the cpu quickly when they wake.
+ *
+ * The thread is not on any run queue yet, so no locking is needed.
+ */
+static
+void
+thread_wakeup_boost(struct thread *target)
+{
+	if (target->t_priority > MLFQ_TOPLEVEL) {
+		target->t_priority--;
+	}
+	target->t_ticksleft = mlfq_quantum(target->t_priority);
+}
+
+/*
+ * Thread migration.
+ *
+ * Load balancing is pull-based: a cpu that runs out of work steals
+ * threads from the busiest other cpu right away, from the idle loop
+ * in thread_switch(), rather than waiting for a busy cpu to get
+ * around to pushing work at it.
+ *
+ * Migrating threads isn't free because of cache affinity; a thread's
+ * working cache set will end up having to be moved to the other CPU,
+ * which is fairly slow. The tradeoff between this performance loss
+ * and the performance loss due to underutilization of some CPUs is
+ * something that needs to be tuned and probably is workload-specific.
+ *
+ * For here and now, because we know we're running on System/161 and
+ * System/161 does not (yet) model such cache effects, we'll be very
+ * aggressive.
+ */
+
+/*
+ * How long, in hardclocks of cpu C, thread T has been off the cpu.
+ * If T didn't last run on C, it has no cache state there to lose, so
+ * treat it as having been gone forever.
+ */
+static
+unsigned
+thread_offcpu_age(struct thread *t, struct cpu *c)
+{
+	if (t->t_lastcpu != c) {
+		return (unsigned)-1;
+	}
+	return c->c_hardclocks - t->t_lastran;
+}
+
+/*
+ * Choose the best thread on VICTIM's run queue for SELF to steal, or
+ * NULL if there's nothing suitable. Looks at no more than STEAL_SCAN
+ * threads, starting from the lowest-priority end (the stride queue's
+ * highest pass, then the MLFQ levels from the bottom up).
+ *
+ * Threads whose affinity excludes SELF are never eligible. Threads
+ * that can't run on VICTIM at all are taken first. Otherwise we take
+ * the thread that has been off the cpu longest, since its cache state
+ * on VICTIM is the most likely to be gone already; threads that ran
+ * within the last CACHE_HOT_HARDCLOCKS are left where they are.
+ *
+ * Must hold VICTIM's run queue lock.
+ */
+static
+struct thread *
+runqueue_steal_candidate(struct cpu *victim, struct cpu *self)
+{
+	struct threadlistnode *tln;
+	struct thread *t, *best;
+	unsigned level, scanned, age, bestage;
+
+	KASSERT(spinlock_do_i_hold(&victim->c_runqueue_lock));
+
+	best = NULL;
+	bestage = 0;
+	scanned = 0;
+	for (level = RUNQ_STRIDE + 1; level-- > 0; ) {
+		for (tln = runqueue_list(victim, level)->tl_tail.tln_prev;
+		     tln->tln_prev != NULL && scanned < STEAL_SCAN;
+		     tln = tln->tln_prev) {
+			t = tln->tln_self;
+			scanned++;
+
+			/*
+			 * Ordinarily, the victim's curthread will not
+			 * appear on its run queue. However, it can
+			 * under the following circumstances:
+			 *   - it went to sleep;
+			 *   - the processor became idle, so it
+			 *     remained curthread;
+			 *   - it was reawakened, so it was put on the
+			 *     run queue;
+			 *   - and the processor hasn't fully unidled
+			 *     yet, so all these things are still true.
+			 *
+			 * Migrating such a thread would be disastrous,
+			 * since its context hasn't been saved yet
+			 * (Exercise: what would happen?) so leave it
+			 * alone.
+			 */
+			if (t == victim->c_curthread) {
+				continue;
+			}
+			if (!thread_cpu_allowed(t, self)) {
+				continue;
+			}
+			if (!thread_cpu_allowed(t, victim)) {
+				return t;
+			}
 
+			age = thread_offcpu_age(t, victim);
+			if (age < CACHE_HOT_HARDCLOCKS) {
+				continue;
+			}
+			if (best == NULL || age > bestage) {
+				best = t;
+				bestage = age;
+			}
+		}
+	}
+	return best;
+}
 
-	/* Clear the wait channel and set the thread state. */
-	cur->t_wchan_name = NULL;
-	cur->t_state = S_RUN;
+/*
+ * Steal work for the current cpu.
+ *
+ * The victim is the cpu with the most stealable threads waiting;
+ * EDF and gang threads stay where they were placed, so only stride
+ * and MLFQ threads count. We pick it from everyone's cpu_getload()
+ * snapshot without taking their locks; the counts may be a little
+ * stale, but the worst that happens is we pick a slightly worse
+ * victim or find nothing left to take once we lock it. This keeps
+ * idle cpus from hammering every run queue lock in the system. Only
+ * the victim's lock is taken, and at most STEAL_MAX threads (and no
+ * more than half the victim's stealable threads) are moved, so the
+ * lock is held for a bounded time.
+ *
+ * Which threads get taken is decided by runqueue_steal_candidate().
+ *
+ * Must be called with interrupts off and without holding our own run
+ * queue lock (holding two run queue locks at once could deadlock
+ * against another cpu stealing from us). Returns the number of threads
+ * moved onto our run queue.
+ */
+static
+unsigned
+thread_steal(void)
+{
+	struct cpu *self, *c, *victim;
+	struct threadlist stolen;
+	struct thread *t;
+	struct cpuload cl;
+	unsigned i, numcpus, count, best, to_steal, moved;
 
-	/* Unlock the run queue. */
-	spinlock_release(&curcpu->c_runqueue_lock);
+	KASSERT(curthread->t_curspl > 0);
 
-	/* Activate our address space in the MMU. */
-	as_activate();
+	self = curcpu->c_self;
+	numcpus = cpuarray_num(&allcpus);
 
-	/* Clean up dead threads. */
-	exorcise();
+	victim = NULL;
+	best = 0;
+	for (i=0; i<numcpus; i++) {
+		c = cpuarray_get(&allcpus, i);
+		if (c == self) {
+			continue;
+		}
+		cpu_getload(c, &cl);
+		count = cl.cl_runcount - cl.cl_edf - cl.cl_gang;
+		if (count > best) {
+			best = count;
+			victim = c;
+		}
+	}
+	if (victim == NULL) {
+		return 0;
+	}
 
-	/* Turn interrupts back on. */
-	splx(spl);
+	threadlist_init(&stolen);
+
+	spinlock_acquire(&victim->c_runqueue_lock);
+	to_steal = DIVROUNDUP(victim->c_runcount -
+			      victim->c_edfqueue.tl_count -
+			      victim->c_gangqueue.tl_count, 2);
+	if (to_steal > STEAL_MAX) {
+		to_steal = STEAL_MAX;
+	}
+	while (to_steal > 0) {
+		t = runqueue_steal_candidate(victim, self);
+		if (t == NULL) {
+			break;
+		}
+		runqueue_remove(victim, t);
+		t->t_cpu = self;
+		threadlist_addtail(&stolen, t);
+		to_steal--;
+	}
+	spinlock_release(&victim->c_runqueue_lock);
+
+	if (threadlist_isempty(&stolen)) {
+		threadlist_cleanup(&stolen);
+		return 0;
+	}
+
+	moved = 0;
+	spinlock_acquire(&self->c_runqueue_lock);
+	while ((t = threadlist_remhead(&stolen)) != NULL) {
+		DEBUG(DB_THREADS, "Stole thread %s: cpu %u -> %u\n",
+		      t->t_name, victim->c_number, self->c_number);
+		runqueue_add(self, t);
+		moved++;
+	}
+	self->c_steals += moved;
+	spinlock_release(&self->c_runqueue_lock);
+
+	threadlist_cleanup(&stolen);
+	return moved;
 }
 
 /*
- * This function is where new threads start running. The arguments
- * ENTRYPOINT, DATA1, and DATA2 are passed through from thread_fork.
- *
- * Because new code comes here from inside the middle of
- * thread_switch, the beginning part of this function must match the
- * tail of thread_switch.
+ * Set a thread's affinity mask.
  */
-void
-thread_startup(void (*entrypoint)(void *data1, unsigned long data2),
-	       void *data1, unsigned long data2)
+int
+thread_setaffinity(struct thread *t, uint32_t mask)
 {
-	struct thread *cur;
+	unsigned numcpus;
+	uint32_t online;
 
-	cur = curthread;
-
-	/* Clear the wait channel and set the thread state. */
-	cur->t_wchan_name = NULL;
-	cur->t_state = S_RUN;
+	numcpus = cpuarray_num(&allcpus);
+	online = (numcpus >= 32) ? CPU_AFFINITY_ALL :
+		((uint32_t)1 << numcpus) - 1;
+	if ((mask & online) == 0) {
+		return EINVAL;
+	}
 
-	/* Release the runqueue lock acquired in thread_switch. */
-	spinlock_release(&curcpu->c_runqueue_lock);
+	t->t_affinity = mask;
+	return 0;
+}
 
-	/* Activate our address space in the MMU. */
-	as_activate();
+/*
+ * Set a thread's stride tickets.
+ */
+int
+thread_settickets(struct thread *t, unsigned tickets)
+{
+	if (tickets > STRIDE_MAXTICKETS) {
+		return EINVAL;
+	}
+	t->t_tickets = tickets;
+	return 0;
+}
 
-	/* Clean up dead threads. */
-	exorcise();
+/*
+ * Make thread T a gang thread placed on cpu C, or an ordinary thread
+ * again if C is NULL. Like thread_setaffinity, this takes effect the
+ * next time T is queued.
+ */
+void
+thread_setgang(struct thread *t, struct cpu *c)
+{
+	t->t_gangcpu = c;
+}
 
-	/* Enable interrupts. */
-	spl0();
+/*
+ * Add process P to the gangs taking turns. EBUSY if there are
+ * already GANG_MAX of them.
+ */
+int
+thread_gang_register(struct proc *p)
+{
+	unsigned i;
 
-#if OPT_SYNCHPROBS
-	/* Yield a random number of times to get a good mix of threads. */
-	{
-		int i, n;
-		n = random()%161 + random()%161;
-		for (i=0; i<n; i++) {
-			thread_yield();
+	spinlock_acquire(&gang_lock);
+	for (i=0; i<gang_count; i++) {
+		if (gang_procs[i] == p) {
+			spinlock_release(&gang_lock);
+			return 0;
 		}
 	}
-#endif
+	if (gang_count == GANG_MAX) {
+		spinlock_release(&gang_lock);
+		return EBUSY;
+	}
+	if (gang_count == 0) {
+		/* Start the rotation with everyone else's turn. */
+		gang_turn = 1;
+		gang_nextslice = curcpu->c_hardclocks + GANG_SLICE;
+	}
+	else if (gang_turn == gang_count) {
+		/* Keep it everyone else's turn. */
+		gang_turn++;
+	}
+	gang_procs[gang_count++] = p;
+	spinlock_release(&gang_lock);
+	return 0;
+}
 
-	/* Call the function. */
-	entrypoint(data1, data2);
+/*
+ * Take process P out of the rotation.
+ */
+void
+thread_gang_unregister(struct proc *p)
+{
+	unsigned i, slot;
 
-	/* Done. */
-	thread_exit();
+	spinlock_acquire(&gang_lock);
+	for (slot=0; slot<gang_count; slot++) {
+		if (gang_procs[slot] == p) {
+			break;
+		}
+	}
+	if (slot == gang_count) {
+		spinlock_release(&gang_lock);
+		return;
+	}
+	gang_count--;
+	for (i=slot; i<gang_count; i++) {
+		gang_procs[i] = gang_procs[i+1];
+	}
+	if (gang_active == p) {
+		/* Hand the rest of the slice to everyone else. */
+		gang_active = NULL;
+		gang_turn = gang_count;
+	}
+	else if (slot < gang_turn) {
+		gang_turn--;
+	}
+	spinlock_release(&gang_lock);
 }
 
 /*
- * Cause the current thread to exit.
- *
- * The parts of the thread structure we don't actually need to run
- * should be cleaned up right away. The rest has to wait until
- * thread_destroy is called from exorcise().
- *
- * Does not return.
+ * Pass the turn to the next gang (or to everyone else) once the
+ * current slice is up. Called from hardclock() on every cpu; whichever
+ * gets there first does it. The cpus' hardclock counts track each
+ * other closely enough (tickless idle accounts for skipped ticks) that
+ * this is as good as a global clock. Busy cpus are sent IPI_GANG so
+ * they switch now rather than at their own next hardclock; idle ones
+ * have nothing to switch.
  */
 void
-thread_exit(void)
+thread_gang_tick(void)
 {
-	struct thread *cur;
+	struct cpu *self, *c;
+	unsigned i, numcpus;
 
-	cur = curthread;
+	self = curcpu->c_self;
 
-#ifdef UW
-	/* threads for user processes should have detached from their process
-	   in sys__exit */
-	KASSERT(curproc == kproc || curproc == NULL);	
-	/* kernel threads don't go through sys__exit, so we detach them from kproc here */
-	if (curproc == kproc) {
-	  proc_remthread(cur);
+	/* Peek first, so cpus don't fight over the lock every tick. */
+	if (gang_count == 0 ||
+	    time_before(self->c_hardclocks, gang_nextslice)) {
+		return;
 	}
-#else // UW
-	proc_remthread(cur);
-#endif // UW
 
-	/* Make sure we *are* detached (move this only if you're sure!) */
-	KASSERT(cur->t_proc == NULL);
+	spinlock_acquire(&gang_lock);
+	if (gang_count == 0 ||
+	    time_before(self->c_hardclocks, gang_nextslice)) {
+		spinlock_release(&gang_lock);
+		return;
+	}
+	gang_turn = (gang_turn + 1) % (gang_count + 1);
+	gang_active = gang_turn < gang_count ? gang_procs[gang_turn] : NULL;
+	gang_nextslice = self->c_hardclocks + GANG_SLICE;
+	gang_slices++;
+	spinlock_release(&gang_lock);
 
-	/* Check the stack guard band. */
-	thread_checkstack(cur);
+	numcpus = cpuarray_num(&allcpus);
+	for (i=0; i<numcpus; i++) {
+		c = cpuarray_get(&allcpus, i);
+		if (c != self && !c->c_isidle) {
+			ipi_send(c, IPI_GANG);
+		}
+	}
+}
 
-	/* Interrupts off on this processor */
-        splhigh();
-	thread_switch(S_ZOMBIE, NULL);
-	panic("The zombie walks!\n");
+/*
+ * On IPI_GANG: check whether the current thread should make way.
+ */
+static
+bool
+thread_gang_check(void)
+{
+	struct cpu *c = curcpu->c_self;
+	bool ret;
+
+	spinlock_acquire(&c->c_runqueue_lock);
+	ret = !c->c_isidle &&
+		gang_preempt(c, curthread, runqueue_level(c, curthread));
+	spinlock_release(&c->c_runqueue_lock);
+	return ret;
 }
 
 /*
- * Yield the cpu to another process, but stay runnable.
+ * Give back a thread's EDF reservation, if it has one.
  */
+static
 void
-thread_yield(void)
+thread_edf_release(struct thread *t)
 {
-	thread_switch(S_READY, NULL);
-}
+	struct cpu *c;
 
-////////////////////////////////////////////////////////////
+	c = t->t_edfcpu;
+	if (c == NULL) {
+		return;
+	}
+	spinlock_acquire(&c->c_runqueue_lock);
+	KASSERT(c->c_edfutil >= t->t_edfutil);
+	c->c_edfutil -= t->t_edfutil;
+	spinlock_release(&c->c_runqueue_lock);
+}
 
 /*
- * Scheduler.
- *
- * This is called periodically from hardclock(). It should reshuffle
- * the current CPU's run queue by job priority.
+ * Make the current thread an EDF thread, or stop it being one.
  */
-
-void
-schedule(void)
+int
+thread_setedf(unsigned period, unsigned budget)
 {
+	struct thread *cur = curthread;
+	struct cpu *c, *target;
+	unsigned i, numcpus, start, util, avail;
+
+	if (period == 0) {
+		util = 0;
+		target = NULL;
+	}
+	else {
+		if (budget == 0 || budget > period) {
+			return EINVAL;
+		}
+		util = DIVROUNDUP(budget * EDF_UTILSCALE, period);
+
+		/*
+		 * Admission control: find a cpu we're allowed on with
+		 * room for us, counting our own old reservation as
+		 * free. Only one run queue lock is held at a time, so
+		 * two threads racing for the last of a cpu's capacity
+		 * are sorted out by whoever locks it first.
+		 */
+		target = NULL;
+		numcpus = cpuarray_num(&allcpus);
+		start = curcpu->c_number;
+		for (i=0; i<numcpus && target == NULL; i++) {
+			c = cpuarray_get(&allcpus, (start + i) % numcpus);
+			if ((cur->t_affinity & ((uint32_t)1 << c->c_number))
+			    == 0) {
+				continue;
+			}
+			spinlock_acquire(&c->c_runqueue_lock);
+			avail = EDF_MAXUTIL - c->c_edfutil;
+			if (c == cur->t_edfcpu) {
+				avail += cur->t_edfutil;
+			}
+			if (util <= avail) {
+				c->c_edfutil += util;
+				target = c;
+			}
+			spinlock_release(&c->c_runqueue_lock);
+		}
+		if (target == NULL) {
+			return EBUSY;
+		}
+	}
+
+	thread_edf_release(cur);
+
 	/*
-	 * You can write this. If we do nothing, threads will run in
-	 * round-robin fashion.
+	 * Hardclock looks at these on whatever cpu we're on, under
+	 * that cpu's run queue lock (which also keeps us from moving).
 	 */
+	spinlock_acquire(&curcpu->c_runqueue_lock);
+	cur->t_edfcpu = target;
+	cur->t_edfutil = util;
+	cur->t_edfperiod = period;
+	cur->t_edfbudget = budget;
+	cur->t_edfleft = budget;
+	cur->t_edfdeadline = target == NULL ? 0 : target->c_hardclocks + period;
+	spinlock_release(&curcpu->c_runqueue_lock);
+
+	return 0;
 }
 
 /*
- * Thread migration.
- *
- * This is also called periodically from hardclock(). If the current
- * CPU is busy and other CPUs are idle, or less busy, it should move
- * threads across to those other other CPUs.
- *
- * Migrating threads isn't free because of cache affinity; a thread's
- * working cache set will end up having to be moved to the other CPU,
- * which is fairly slow. The tradeoff between this performance loss
- * and the performance loss due to underutilization of some CPUs is
- * something that needs to be tuned and probably is workload-specific.
+ * This is called periodically from hardclock(). Since idle cpus pull
+ * work themselves, all a busy cpu has to do is make sure cpus that
+ * are already asleep in cpu_idle() notice: if we have threads
+ * waiting, poke one idle cpu so it wakes up and steals some.
  *
- * For here and now, because we know we're running on System/161 and
- * System/161 does not (yet) model such cache effects, we'll be very
- * aggressive.
+ * The c_isidle flags are read without locking; a stale value at worst
+ * costs a spurious IPI or delays the poke until the next call.
  */
 void
 thread_consider_migration(void)
 {
-	unsigned my_count, total_count, one_share, to_send;
+	struct cpu *self, *c;
 	unsigned i, numcpus;
-	struct cpu *c;
-	struct threadlist victims;
-	struct thread *t;
 
-	my_count = total_count = 0;
-	numcpus = cpuarray_num(&allcpus);
-	for (i=0; i<numcpus; i++) {
-		c = cpuarray_get(&allcpus, i);
-		spinlock_acquire(&c->c_runqueue_lock);
-		total_count += c->c_runqueue.tl_count;
-		if (c == curcpu->c_self) {
-			my_count = c->c_runqueue.tl_count;
-		}
-		spinlock_release(&c->c_runqueue_lock);
-	}
-
-	one_share = DIVROUNDUP(total_count, numcpus);
-	if (my_count < one_share) {
+	self = curcpu->c_self;
+	if (self->c_runcount == 0) {
 		return;
 	}
 
-	to_send = my_count - one_share;
-	threadlist_init(&victims);
-	spinlock_acquire(&curcpu->c_runqueue_lock);
-	for (i=0; i<to_send; i++) {
-		t = threadlist_remtail(&curcpu->c_runqueue);
-		threadlist_addhead(&victims, t);
+	numcpus = cpuarray_num(&allcpus);
+	for (i=1; i<numcpus; i++) {
+		/* Start after ourselves, so we don't always poke cpu 0. */
+		c = cpuarray_get(&allcpus, (self->c_number + i) % numcpus);
+		if (c->c_isidle) {
+			ipi_send(c, IPI_UNIDLE);
+			return;
+		}
 	}
-	spinlock_release(&curcpu->c_runqueue_lock);
+}
 
-	for (i=0; i < numcpus && to_send > 0; i++) {
-		c = cpuarray_get(&allcpus, i);
-		if (c == curcpu->c_self) {
-			continue;
-		}
-		spinlock_acquire(&c->c_runqueue_lock);
-		while (c->c_runqueue.tl_count < one_share && to_send > 0) {
-			t = threadlist_remhead(&victims);
-			/*
-			 * Ordinarily, curthread will not appear on
-			 * the run queue. However, it can under the
-			 * following circumstances:
-			 *   - it went to sleep;
-			 *   - the processor became idle, so it
-			 *     remained curthread;
-			 *   - it was reawakened, so it was put on the
-			 *     run queue;
-			 *   - and the processor hasn't fully unidled
-			 *     yet, so all these things are still true.
-			 *
-			 * If the timer interrupt happens at (almost)
-			 * exactly the proper moment, we can come here
-			 * while things are in this state and see
-			 * curthread. However, *migrating* curthread
-			 * can cause bad things to happen (Exercise:
-			 * Why? And what?) so shuffle it to the end of
-			 * the list and decrement to_send in order to
-			 * skip it. Then it goes back on our own run
-			 * queue below.
-			 */
-			if (t == curthread) {
-				threadlist_addtail(&victims, t);
-				to_send--;
-				continue;
-			}
+/*
+ * Print per-cpu scheduler statistics: the length of each MLFQ level's
+ * run queue. The counts are snapshotted under the run queue lock and
+ * printed afterwards, since kprintf may sleep.
+ */
+void
+thread_printstats(void)
+{
+	unsigned counts[MLFQ_LEVELS];
+	unsigned i, j, numcpus, steals, hits, misses, skipped, stridecount;
+	unsigned edfcount, edfutil, edfmisses, gangcount;
+	bool isidle;
+	struct cpu *c;
 
-			t->t_cpu = c;
-			threadlist_addtail(&c->c_runqueue, t);
-			DEBUG(DB_THREADS,
-			      "Migrated thread %s: cpu %u -> %u",
-			      t->t_name, curcpu->c_number, c->c_number);
-			to_send--;
-			if (c->c_isidle) {
-				/*
-				 * Other processor is idle; send
-				 * interrupt to make sure it unidles.
-				 */
-				ipi_send(c, IPI_UNIDLE);
-			}
+	numcpus = cpuarray_num(&allcpus);
+	for (i=0; i<numcpus; i++) {
+		c = cpuarray_get(&allcpus, i);
+		spinlock_acquire(&c->c_runqueue_lock);
+		isidle = c->c_isidle;
+		for (j=0; j<MLFQ_LEVELS; j++) {
+			counts[j] = c->c_runqueue[j].tl_count;
 		}
+		stridecount = c->c_stridequeue.tl_count;
+		edfcount = c->c_edfqueue.tl_count;
+		gangcount = c->c_gangqueue.tl_count;
+		edfutil = c->c_edfutil;
+		edfmisses = c->c_edfmisses;
+		steals = c->c_steals;
 		spinlock_release(&c->c_runqueue_lock);
-	}
 
-	/*
-	 * Because the code above isn't atomic, the thread counts may have
-	 * changed while we were working and we may end up with leftovers.
-	 * Don't panic; just put them back on our own run queue.
-	 */
-	if (!threadlist_isempty(&victims)) {
-		spinlock_acquire(&curcpu->c_runqueue_lock);
-		while ((t = threadlist_remhead(&victims)) != NULL) {
-			threadlist_addtail(&curcpu->c_runqueue, t);
+		/* These belong to c; reading them unlocked is good enough */
+		hits = c->c_cachehits;
+		misses = c->c_cachemisses;
+		skipped = c->c_ticksskipped;
+
+		kprintf("cpu%u: %s, run queue lengths:", c->c_number,
+			isidle ? "idle" : "busy");
+		for (j=0; j<MLFQ_LEVELS; j++) {
+			kprintf(" L%u=%u", j, counts[j]);
 		}
-		spinlock_release(&curcpu->c_runqueue_lock);
+		kprintf(" stride=%u edf=%u gang=%u", stridecount, edfcount,
+			gangcount);
+		kprintf("\n");
+		kprintf("cpu%u: %u threads stolen\n", c->c_number, steals);
+		kprintf("cpu%u: thread cache %u hits, %u misses, %u cached\n",
+			c->c_number, hits, misses, c->c_threadcache.tl_count);
+		kprintf("cpu%u: %u hardclocks, %u skipped while idle\n",
+			c->c_number, c->c_hardclocks, skipped);
+		kprintf("cpu%u: EDF %u/%u reserved, %u deadline misses\n",
+			c->c_number, edfutil, EDF_UTILSCALE, edfmisses);
+		kprintf("cpu%u: %u TLB shootdowns in %u IPIs\n",
+			c->c_number, c->c_shootdownseq, c->c_shootdownipis);
 	}
-
-	KASSERT(threadlist_isempty(&victims));
-	threadlist_cleanup(&victims);
+	kprintf("%u gangs, %u gang turns taken\n", gang_count, gang_slices);
 }
 
 ////////////////////////////////////////////////////////////
@@ -963,6 +2577,17 @@ thread_consider_migration(void)
  * Wait channel functions
  */
 
+static
+void
+wchan_init(struct wchan *wc, const char *name)
+{
+	spinlock_init(&wc->wc_lock);
+	threadlist_init(&wc->wc_threads);
+	wc->wc_gen = 0;
+	wc->wc_ntimed = 0;
+	wc->wc_name = name;
+}
+
 /*
  * Create a wait channel. NAME is a symbolic string name for it.
  * This is what's displayed by ps -alx in Unix.
@@ -980,9 +2605,7 @@ wchan_create(const char *name)
 	if (wc == NULL) {
 		return NULL;
 	}
-	spinlock_init(&wc->wc_lock);
-	threadlist_init(&wc->wc_threads);
-	wc->wc_name = name;
+	wchan_init(wc, name);
 	return wc;
 }
 
@@ -993,6 +2616,18 @@ wchan_create(const char *name)
 void
 wchan_destroy(struct wchan *wc)
 {
+	/*
+	 * A timed sleeper that has been woken may still have its
+	 * timeout pointing here; let it finish with us.
+	 */
+	spinlock_acquire(&wc->wc_lock);
+	while (wc->wc_ntimed > 0) {
+		spinlock_release(&wc->wc_lock);
+		thread_yield();
+		spinlock_acquire(&wc->wc_lock);
+	}
+	spinlock_release(&wc->wc_lock);
+
 	spinlock_cleanup(&wc->wc_lock);
 	threadlist_cleanup(&wc->wc_threads);
 	kfree(wc);
@@ -1014,31 +2649,132 @@ wchan_unlock(struct wchan *wc)
 }
 
 /*
- * Yield the cpu to another process, and go to sleep, on the specified
- * wait channel WC. Calling wakeup on the channel will make the thread
- * runnable again. The channel must be locked, and will be *unlocked*
- * upon return.
+ * Go to sleep on WC waiting for KEY; NAME is what to show as the
+ * thread's wait channel. The channel must be locked, and will be
+ * *unlocked* upon return.
  */
+static
 void
-wchan_sleep(struct wchan *wc)
+wchan_dosleep(struct wchan *wc, const void *key, const char *name)
+{
+	struct thread *cur = curthread;
+
+	/* may not sleep in an interrupt handler */
+	KASSERT(!cur->t_in_interrupt);
+	KASSERT(spinlock_do_i_hold(&wc->wc_lock));
+
+	cur->t_wchankey = key;
+	cur->t_wchan_name = name;
+	thread_switch(S_SLEEP, wc);
+}
+
+/*
+ * Sleep on WC waiting for KEY, for at most TICKS hardclocks. Like
+ * wchan_dosleep, the channel must be locked and is unlocked on
+ * return. Returns ETIMEDOUT if the time ran out before anyone woke
+ * us.
+ *
+ * The timeout is a callout on this cpu's wheel. While it's pending
+ * wc_ntimed keeps the channel from being destroyed under it; we drop
+ * that only after callout_stop has made sure it's finished.
+ */
+static
+int
+wchan_dotimedsleep(struct wchan *wc, const void *key, const char *name,
+		   unsigned ticks)
 {
+	struct thread *cur = curthread;
+
 	/* may not sleep in an interrupt handler */
-	KASSERT(!curthread->t_in_interrupt);
+	KASSERT(!cur->t_in_interrupt);
+	KASSERT(spinlock_do_i_hold(&wc->wc_lock));
+
+	if (ticks == 0) {
+		wchan_unlock(wc);
+		return ETIMEDOUT;
+	}
 
+	wc->wc_ntimed++;
+	cur->t_timedout = false;
+	/* We hold a spinlock, so we can't move cpus before sleeping. */
+	callout_schedule(&cur->t_timeout, ticks);
+
+	cur->t_wchankey = key;
+	cur->t_wchan_name = name;
 	thread_switch(S_SLEEP, wc);
+
+	callout_stop(&cur->t_timeout);
+	spinlock_acquire(&wc->wc_lock);
+	KASSERT(wc->wc_ntimed > 0);
+	wc->wc_ntimed--;
+	cur->t_wchan = NULL;
+	spinlock_release(&wc->wc_lock);
+
+	return cur->t_timedout ? ETIMEDOUT : 0;
 }
 
 /*
- * Wake up one thread sleeping on a wait channel.
+ * Timeout for timed sleeps. Runs from the hardclock path. If the
+ * thread is still on the channel it slept on, take it off and wake
+ * it; otherwise someone already did.
  */
+static
 void
-wchan_wakeone(struct wchan *wc)
+wchan_timeout(void *data1, unsigned long data2)
+{
+	struct thread *target = data1;
+	struct wchan *wc;
+
+	(void)data2;
+
+	/*
+	 * t_wchan can only go from the channel to NULL until the
+	 * thread has stopped this callout, and the channel can't go
+	 * away before then either.
+	 */
+	wc = target->t_wchan;
+	if (wc == NULL) {
+		return;
+	}
+
+	spinlock_acquire(&wc->wc_lock);
+	if (target->t_wchan != wc || target->t_wchangen != wc->wc_gen) {
+		/* Woken already. */
+		spinlock_release(&wc->wc_lock);
+		return;
+	}
+	threadlist_remove(&wc->wc_threads, target);
+	target->t_wchan = NULL;
+	target->t_timedout = true;
+	spinlock_release(&wc->wc_lock);
+
+	thread_wakeup_boost(target);
+	thread_make_runnable(target, false);
+}
+
+/*
+ * Wake up the first thread sleeping on WC for KEY. Returns false if
+ * there was nobody to wake.
+ */
+static
+bool
+wchan_dowakeone(struct wchan *wc, const void *key)
 {
+	struct threadlistnode *tln;
 	struct thread *target;
 
 	/* Lock the channel and grab a thread from it */
 	spinlock_acquire(&wc->wc_lock);
-	target = threadlist_remhead(&wc->wc_threads);
+	target = NULL;
+	for (tln = wc->wc_threads.tl_head.tln_next;
+	     tln->tln_next != NULL; tln = tln->tln_next) {
+		if (tln->tln_self->t_wchankey == key) {
+			target = tln->tln_self;
+			threadlist_remove(&wc->wc_threads, target);
+			target->t_wchan = NULL;
+			break;
+		}
+	}
 	/*
 	 * Nobody else can wake up this thread now, so we don't need
 	 * to hang onto the lock.
@@ -1047,30 +2783,57 @@ wchan_wakeone(struct wchan *wc)
 
 	if (target == NULL) {
 		/* Nobody was sleeping. */
-		return;
+		return false;
 	}
 
+	thread_wakeup_boost(target);
 	thread_make_runnable(target, false);
+	return true;
 }
 
 /*
- * Wake up all threads sleeping on a wait channel.
+ * Wake up all threads sleeping on WC for KEY.
  */
+static
 void
-wchan_wakeall(struct wchan *wc)
+wchan_dowakeall(struct wchan *wc, const void *key)
 {
 	struct thread *target;
-	struct threadlist list;
+	struct threadlist list, batch;
+	struct threadlistnode *tln, *next;
+	struct cpu *targetcpu;
 
 	threadlist_init(&list);
 
 	/*
-	 * Lock the channel and grab all the threads, moving them to a
-	 * private list.
+	 * Lock the channel and move the threads to a private list.
 	 */
 	spinlock_acquire(&wc->wc_lock);
-	while ((target = threadlist_remhead(&wc->wc_threads)) != NULL) {
-		threadlist_addtail(&list, target);
+	if (key == wc) {
+		/*
+		 * A channel of its own: everyone on it is waiting for
+		 * KEY, so take them all in one go, and tell pending
+		 * timeouts they're gone by bumping the generation.
+		 */
+		threadlist_splice(&list, &wc->wc_threads);
+		wc->wc_gen++;
+	}
+	else {
+		/*
+		 * A shared sleep queue: pick out the threads waiting
+		 * for KEY one at a time. Clearing t_wchan tells their
+		 * timeouts they're gone.
+		 */
+		for (tln = wc->wc_threads.tl_head.tln_next;
+		     tln->tln_next != NULL; tln = next) {
+			next = tln->tln_next;
+			target = tln->tln_self;
+			if (target->t_wchankey == key) {
+				threadlist_remove(&wc->wc_threads, target);
+				target->t_wchan = NULL;
+				threadlist_addtail(&list, target);
+			}
+		}
 	}
 	/*
 	 * Nobody else can wake up these threads now, so we don't need
@@ -1078,18 +2841,84 @@ wchan_wakeall(struct wchan *wc)
 	 */
 	spinlock_release(&wc->wc_lock);
 
+	if (threadlist_isempty(&list)) {
+		threadlist_cleanup(&list);
+		return;
+	}
+
+	/* Decide where each thread is going. */
+	THREADLIST_FORALL(target, list) {
+		thread_wakeup_boost(target);
+		(void)thread_wakeup_cpu(target);
+	}
+
 	/*
-	 * We could conceivably sort by cpu first to cause fewer lock
-	 * ops and fewer IPIs, but for now at least don't bother. Just
-	 * make each thread runnable.
+	 * Then hand them over one cpu at a time, so each run queue
+	 * lock is taken (and each idle cpu is poked) only once. The
+	 * number of cpus is small, so rescanning the list for each
+	 * isn't a problem.
 	 */
-	while ((target = threadlist_remhead(&list)) != NULL) {
-		thread_make_runnable(target, false);
+	threadlist_init(&batch);
+	while (!threadlist_isempty(&list)) {
+		targetcpu = list.tl_head.tln_next->tln_self->t_cpu;
+		tln = list.tl_head.tln_next;
+		while (tln->tln_next != NULL) {
+			next = tln->tln_next;
+			if (tln->tln_self->t_cpu == targetcpu) {
+				threadlist_remove(&list, tln->tln_self);
+				threadlist_addtail(&batch, tln->tln_self);
+			}
+			tln = next;
+		}
+		thread_make_runnable_batch(targetcpu, &batch);
 	}
 
+	threadlist_cleanup(&batch);
 	threadlist_cleanup(&list);
 }
 
+/*
+ * Yield the cpu to another process, and go to sleep, on the specified
+ * wait channel WC. Calling wakeup on the channel will make the thread
+ * runnable again. The channel must be locked, and will be *unlocked*
+ * upon return.
+ */
+void
+wchan_sleep(struct wchan *wc)
+{
+	wchan_dosleep(wc, wc, wc->wc_name);
+}
+
+/*
+ * Sleep on a wait channel for at most TICKS hardclocks. Like
+ * wchan_sleep, the channel must be locked and is unlocked on return.
+ * Returns ETIMEDOUT if the time ran out before anyone woke us.
+ */
+int
+wchan_timedsleep(struct wchan *wc, unsigned ticks)
+{
+	return wchan_dotimedsleep(wc, wc, wc->wc_name, ticks);
+}
+
+/*
+ * Wake up one thread sleeping on a wait channel. Returns false if
+ * there was nobody to wake.
+ */
+bool
+wchan_wakeone(struct wchan *wc)
+{
+	return wchan_dowakeone(wc, wc);
+}
+
+/*
+ * Wake up all threads sleeping on a wait channel.
+ */
+void
+wchan_wakeall(struct wchan *wc)
+{
+	wchan_dowakeall(wc, wc);
+}
+
 /*
  * Return nonzero if there are no threads sleeping on the channel.
  * This is meant to be used only for diagnostic purposes.
@@ -1108,6 +2937,75 @@ wchan_isempty(struct wchan *wc)
 
 ////////////////////////////////////////////////////////////
 
+/*
+ * Sleep queues.
+ *
+ * These are wait channels that live in a fixed table instead of
+ * being allocated, named by the address of whatever is being waited
+ * for. Objects whose addresses hash to the same slot share its lock
+ * and list; a thread's t_wchankey says which object it's waiting
+ * for, so wakeups only take the right threads.
+ */
+
+static
+void
+sleepq_bootstrap(void)
+{
+	unsigned i;
+
+	for (i=0; i<SLEEPQ_SIZE; i++) {
+		wchan_init(&sleepq_table[i], "sleepq");
+	}
+}
+
+static
+struct wchan *
+sleepq_hash(const void *key)
+{
+	uintptr_t k = (uintptr_t)key;
+
+	/* Sync objects are kmalloc'd, so the low bits don't say much */
+	return &sleepq_table[((k >> 4) ^ (k >> 11)) & (SLEEPQ_SIZE - 1)];
+}
+
+void
+sleepq_lock(const void *key)
+{
+	wchan_lock(sleepq_hash(key));
+}
+
+void
+sleepq_unlock(const void *key)
+{
+	wchan_unlock(sleepq_hash(key));
+}
+
+void
+sleepq_sleep(const void *key, const char *name)
+{
+	wchan_dosleep(sleepq_hash(key), key, name);
+}
+
+int
+sleepq_timedsleep(const void *key, const char *name, unsigned ticks)
+{
+	return wchan_dotimedsleep(sleepq_hash(key), key, name, ticks);
+}
+
+bool
+sleepq_wakeone(const void *key)
+{
+	return wchan_dowakeone(sleepq_hash(key), key);
+}
+
+void
+sleepq_wakeall(const void *key)
+{
+	wchan_dowakeall(sleepq_hash(key), key);
+}
+
+////////////////////////////////////////////////////////////
+
 /*
  * Machine-independent IPI handling
  */
@@ -1140,8 +3038,12 @@ ipi_broadcast(int code)
 	}
 }
 
+/*
+ * Add MAPPING to TARGET's shootdown queue. Doesn't interrupt TARGET;
+ * that happens in ipi_tlbshootdown_flush.
+ */
 void
-ipi_tlbshootdown(struct cpu *target, const struct tlbshootdown *mapping)
+ipi_tlbshootdown_queue(struct cpu *target, const struct tlbshootdown *mapping)
 {
 	int n;
 
@@ -1151,22 +3053,138 @@ ipi_tlbshootdown(struct cpu *target, const struct tlbshootdown *mapping)
 	if (n == TLBSHOOTDOWN_MAX) {
 		target->c_numshootdown = TLBSHOOTDOWN_ALL;
 	}
-	else {
+	else if (n != TLBSHOOTDOWN_ALL) {
 		target->c_shootdown[n] = *mapping;
 		target->c_numshootdown = n+1;
 	}
-
+	target->c_shootdownseq++;
 	target->c_ipi_pending |= (uint32_t)1 << IPI_TLBSHOOTDOWN;
-	mainbus_send_ipi(target);
 
 	spinlock_release(&target->c_ipi_lock);
 }
 
+/*
+ * Invalidate the shootdowns queued on C, and tell whoever is waiting.
+ * Called with C's IPI lock held, on C.
+ */
+static
+void
+ipi_tlbshootdown_run(struct cpu *c)
+{
+	int i;
+
+	KASSERT(spinlock_do_i_hold(&c->c_ipi_lock));
+
+	if (c->c_numshootdown == TLBSHOOTDOWN_ALL) {
+		vm_tlbshootdown_all();
+	}
+	else {
+		for (i=0; i<c->c_numshootdown; i++) {
+			vm_tlbshootdown(&c->c_shootdown[i]);
+		}
+	}
+	c->c_numshootdown = 0;
+	c->c_shootdownsent = false;
+	c->c_shootdowndone = c->c_shootdownseq;
+	c->c_ipi_pending &= ~((uint32_t)1 << IPI_TLBSHOOTDOWN);
+}
+
+/*
+ * Process our own queued shootdowns, if any. Used while spinning for
+ * other cpus, which might in turn be spinning waiting for us with
+ * interrupts off.
+ */
+static
+void
+ipi_tlbshootdown_poll(void)
+{
+	struct cpu *self;
+
+	self = curcpu->c_self;
+	spinlock_acquire(&self->c_ipi_lock);
+	if (self->c_ipi_pending & ((uint32_t)1 << IPI_TLBSHOOTDOWN)) {
+		ipi_tlbshootdown_run(self);
+	}
+	spinlock_release(&self->c_ipi_lock);
+}
+
+/*
+ * Send C an IPI if it has shootdowns queued that no IPI has been sent
+ * for yet, and return how far its queue has to get before everything
+ * queued so far has been invalidated.
+ */
+static
+unsigned
+ipi_tlbshootdown_send(struct cpu *c)
+{
+	unsigned seq;
+
+	spinlock_acquire(&c->c_ipi_lock);
+	if ((c->c_ipi_pending & ((uint32_t)1 << IPI_TLBSHOOTDOWN))
+	    && !c->c_shootdownsent) {
+		c->c_shootdownsent = true;
+		c->c_shootdownipis++;
+		mainbus_send_ipi(c);
+	}
+	seq = c->c_shootdownseq;
+	spinlock_release(&c->c_ipi_lock);
+
+	return seq;
+}
+
+/*
+ * Send one IPI to each cpu with unsent shootdowns queued, and if WAIT
+ * is set, wait until all cpus have caught up with what was queued
+ * before the call. Shootdowns queued on this cpu are done directly.
+ */
+void
+ipi_tlbshootdown_flush(bool wait)
+{
+	unsigned i, num, seq;
+	struct cpu *c, *self;
+
+	num = cpuarray_num(&allcpus);
+	self = curcpu->c_self;
+	ipi_tlbshootdown_poll();
+	for (i=0; i<num; i++) {
+		c = cpuarray_get(&allcpus, i);
+		if (c != self) {
+			ipi_tlbshootdown_send(c);
+		}
+	}
+
+	if (!wait) {
+		return;
+	}
+
+	for (i=0; i<num; i++) {
+		c = cpuarray_get(&allcpus, i);
+		if (c == self) {
+			continue;
+		}
+		/*
+		 * Sending again is a no-op unless someone else queued
+		 * more after C emptied its queue and hasn't flushed yet.
+		 */
+		seq = ipi_tlbshootdown_send(c);
+		while ((int)(seq - c->c_shootdowndone) > 0) {
+			ipi_tlbshootdown_poll();
+		}
+	}
+}
+
+void
+ipi_tlbshootdown(struct cpu *target, const struct tlbshootdown *mapping)
+{
+	ipi_tlbshootdown_queue(target, mapping);
+	ipi_tlbshootdown_flush(false);
+}
+
 void
 interprocessor_interrupt(void)
 {
 	uint32_t bits;
-	int i;
+	bool gangyield = false;
 
 	spinlock_acquire(&curcpu->c_ipi_lock);
 	bits = curcpu->c_ipi_pending;
@@ -1193,17 +3211,22 @@ interprocessor_interrupt(void)
 		 */
 	}
 	if (bits & (1U << IPI_TLBSHOOTDOWN)) {
-		if (curcpu->c_numshootdown == TLBSHOOTDOWN_ALL) {
-			vm_tlbshootdown_all();
-		}
-		else {
-			for (i=0; i<curcpu->c_numshootdown; i++) {
-				vm_tlbshootdown(&curcpu->c_shootdown[i]);
-			}
-		}
-		curcpu->c_numshootdown = 0;
+		ipi_tlbshootdown_run(curcpu->c_self);
 	}
 
 	curcpu->c_ipi_pending = 0;
 	spinlock_release(&curcpu->c_ipi_lock);
+
+	/*
+	 * This takes the run queue lock, which is held while sending
+	 * IPIs (and so taking c_ipi_lock); do it without c_ipi_lock.
+	 */
+	if (bits & (1U << IPI_GANG)) {
+		gangyield = thread_gang_check();
+	}
+
+	/* Like hardclock, switch on the way out of the interrupt. */
+	if (gangyield && curthread->t_rcudepth == 0) {
+		thread_yield();
+	}
 }
@@ -238,3 +238,33 @@ threadlist_remove(struct threadlist *tl, struct thread *t)
 	DEBUGASSERT(tl->tl_count > 0);
 	tl->tl_count--;
 }
+
+void
+threadlist_splice(struct threadlist *dst, struct threadlist *src)
+{
+	struct threadlistnode *first, *last;
+
+	DEBUGASSERT(dst != NULL);
+	DEBUGASSERT(src != NULL);
+	DEBUGASSERT(dst != src);
+
+	if (src->tl_head.tln_next == &src->tl_tail) {
+		/* nothing to move */
+		return;
+	}
+	first = src->tl_head.tln_next;
+	last = src->tl_tail.tln_prev;
+
+	/* Unhook the chain from src */
+	src->tl_head.tln_next = &src->tl_tail;
+	src->tl_tail.tln_prev = &src->tl_head;
+
+	/* and hook it in at the end of dst */
+	first->tln_prev = dst->tl_tail.tln_prev;
+	last->tln_next = &dst->tl_tail;
+	first->tln_prev->tln_next = first;
+	dst->tl_tail.tln_prev = last;
+
+	dst->tl_count += src->tl_count;
+	src->tl_count = 0;
+}
@@ -0,0 +1,331 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Deferred work queues.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <cpu.h>
+#include <spinlock.h>
+#include <wchan.h>
+#include <thread.h>
+#include <current.h>
+#include <synch.h>
+#include <workqueue.h>
+
+/*
+ * One per cpu, hung off c_workqueue.
+ */
+struct workqueue {
+	struct cpu *wq_cpu;		/* The cpu we serve */
+	struct wchan *wq_wchan;		/* Worker sleeps here */
+	struct spinlock wq_lock;	/* Protects the rest */
+	struct work *wq_head;		/* Pending items, oldest first */
+	struct work *wq_tail;
+	unsigned wq_items;		/* Items run */
+	unsigned wq_batches;		/* Batches taken */
+};
+
+/*
+ * Run one batch of work. Each item's pending flag is cleared just
+ * before it runs, so the function can requeue it.
+ */
+static
+void
+workqueue_runbatch(struct workqueue *wq, struct work *batch)
+{
+	struct work *w, *next;
+	void (*func)(void *, unsigned long);
+	void *data1;
+	unsigned long data2;
+
+	for (w = batch; w != NULL; w = next) {
+		next = w->w_next;
+		func = w->w_func;
+		data1 = w->w_data1;
+		data2 = w->w_data2;
+
+		spinlock_acquire(&wq->wq_lock);
+		KASSERT(w->w_pending);
+		w->w_next = NULL;
+		w->w_pending = false;
+		wq->wq_items++;
+		spinlock_release(&wq->wq_lock);
+
+		if (w->w_kmalloced) {
+			kfree(w);
+		}
+		func(data1, data2);
+	}
+}
+
+/*
+ * Worker thread main loop.
+ */
+static
+void
+workqueue_worker(void *data1, unsigned long data2)
+{
+	struct workqueue *wq = data1;
+	struct work *batch;
+	int result;
+
+	(void)data2;
+
+	/* Pin ourselves to our cpu, and get there. */
+	result = thread_setaffinity(curthread,
+				    (uint32_t)1 << wq->wq_cpu->c_number);
+	KASSERT(result == 0);
+	while (curcpu->c_self != wq->wq_cpu) {
+		thread_yield();
+	}
+
+	while (1) {
+		spinlock_acquire(&wq->wq_lock);
+		while (wq->wq_head == NULL) {
+			/*
+			 * Lock the channel before letting go of the
+			 * queue so a wakeup can't slip in between.
+			 */
+			wchan_lock(wq->wq_wchan);
+			spinlock_release(&wq->wq_lock);
+			wchan_sleep(wq->wq_wchan);
+			spinlock_acquire(&wq->wq_lock);
+		}
+		batch = wq->wq_head;
+		wq->wq_head = wq->wq_tail = NULL;
+		wq->wq_batches++;
+		spinlock_release(&wq->wq_lock);
+
+		workqueue_runbatch(wq, batch);
+	}
+}
+
+/*
+ * Set up a queue and start a worker for each cpu.
+ */
+void
+workqueue_bootstrap(void)
+{
+	struct workqueue *wq;
+	struct cpu *c;
+	char name[16];
+	unsigned i, numcpus;
+	int result;
+
+	numcpus = cpu_count();
+	for (i=0; i<numcpus; i++) {
+		c = cpu_get(i);
+		KASSERT(c->c_workqueue == NULL);
+
+		wq = kmalloc(sizeof(*wq));
+		if (wq == NULL) {
+			panic("workqueue_bootstrap: Out of memory\n");
+		}
+		wq->wq_cpu = c;
+		wq->wq_wchan = wchan_create("workqueue");
+		if (wq->wq_wchan == NULL) {
+			panic("workqueue_bootstrap: Out of memory\n");
+		}
+		spinlock_init(&wq->wq_lock);
+		wq->wq_head = wq->wq_tail = NULL;
+		wq->wq_items = 0;
+		wq->wq_batches = 0;
+
+		snprintf(name, sizeof(name), "worker%u", c->c_number);
+		result = thread_fork(name, NULL, workqueue_worker, wq, 0);
+		if (result) {
+			panic("workqueue_bootstrap: thread_fork: %s\n",
+			      strerror(result));
+		}
+
+		c->c_workqueue = wq;
+	}
+}
+
+void
+work_init(struct work *w,
+	  void (*func)(void *data1, unsigned long data2),
+	  void *data1, unsigned long data2)
+{
+	w->w_func = func;
+	w->w_data1 = data1;
+	w->w_data2 = data2;
+	w->w_next = NULL;
+	w->w_pending = false;
+	w->w_kmalloced = false;
+}
+
+bool
+work_queue_on(struct cpu *c, struct work *w)
+{
+	struct workqueue *wq;
+	bool wasempty;
+	void (*func)(void *, unsigned long);
+	void *data1;
+	unsigned long data2;
+
+	wq = c->c_workqueue;
+	if (wq == NULL) {
+		/*
+		 * Too early in boot; just do it, disposing of the
+		 * item first as workqueue_runbatch does.
+		 */
+		func = w->w_func;
+		data1 = w->w_data1;
+		data2 = w->w_data2;
+		w->w_pending = false;
+		if (w->w_kmalloced) {
+			kfree(w);
+		}
+		func(data1, data2);
+		return true;
+	}
+
+	spinlock_acquire(&wq->wq_lock);
+	if (w->w_pending) {
+		spinlock_release(&wq->wq_lock);
+		return false;
+	}
+	w->w_pending = true;
+	w->w_next = NULL;
+	wasempty = (wq->wq_head == NULL);
+	if (wasempty) {
+		wq->wq_head = w;
+	}
+	else {
+		wq->wq_tail->w_next = w;
+	}
+	wq->wq_tail = w;
+	spinlock_release(&wq->wq_lock);
+
+	/*
+	 * Only the first item of a batch needs to wake the worker;
+	 * if the queue was already nonempty it's awake or about to be.
+	 */
+	if (wasempty) {
+		wchan_wakeone(wq->wq_wchan);
+	}
+	return true;
+}
+
+bool
+work_queue(struct work *w)
+{
+	return work_queue_on(curcpu->c_self, w);
+}
+
+void
+work_defer(void (*func)(void *data1, unsigned long data2),
+	   void *data1, unsigned long data2)
+{
+	struct work *w;
+
+	KASSERT(curthread->t_in_interrupt == false);
+
+	w = kmalloc(sizeof(*w));
+	if (w == NULL) {
+		func(data1, data2);
+		return;
+	}
+	work_init(w, func, data1, data2);
+	w->w_kmalloced = true;
+	work_queue(w);
+}
+
+/*
+ * Work function for workqueue_flush.
+ */
+static
+void
+workqueue_flushdone(void *data1, unsigned long data2)
+{
+	struct semaphore *sem = data1;
+
+	(void)data2;
+	V(sem);
+}
+
+void
+workqueue_flush(void)
+{
+	struct semaphore *sem;
+	struct work *marks;
+	struct cpu *c;
+	unsigned i, numcpus;
+
+	numcpus = cpu_count();
+	sem = sem_create("workqueue_flush", 0);
+	marks = kmalloc(numcpus * sizeof(*marks));
+	if (sem == NULL || marks == NULL) {
+		panic("workqueue_flush: Out of memory\n");
+	}
+
+	/*
+	 * Each queue runs in order, so once a marker queued behind
+	 * everything else has run, everything before it has too.
+	 */
+	for (i=0; i<numcpus; i++) {
+		c = cpu_get(i);
+		work_init(&marks[i], workqueue_flushdone, sem, 0);
+		work_queue_on(c, &marks[i]);
+	}
+	for (i=0; i<numcpus; i++) {
+		P(sem);
+	}
+
+	kfree(marks);
+	sem_destroy(sem);
+}
+
+void
+workqueue_printstats(void)
+{
+	struct workqueue *wq;
+	struct cpu *c;
+	unsigned i, numcpus, items, batches;
+
+	numcpus = cpu_count();
+	for (i=0; i<numcpus; i++) {
+		c = cpu_get(i);
+		wq = c->c_workqueue;
+		if (wq == NULL) {
+			continue;
+		}
+		spinlock_acquire(&wq->wq_lock);
+		items = wq->wq_items;
+		batches = wq->wq_batches;
+		spinlock_release(&wq->wq_lock);
+
+		kprintf("cpu%u: %u work items run in %u batches\n",
+			c->c_number, items, batches);
+	}
+}
@@ -37,8 +37,8 @@
 #include <types.h>
 #include <kern/errno.h>
 #include <lib.h>
-#include <array.h>
 #include <synch.h>
+#include <rcu.h>
 #include <vfs.h>
 #include <fs.h>
 #include <vnode.h>
@@ -82,23 +82,98 @@ struct knowndev {
 	struct fs *kd_fs;
 };
 
-DECLARRAY(knowndev);
-DEFARRAY(knowndev, /*no inline*/);
+/*
+ * The table of known devices.
+ *
+ * Lookups by name read it under rcu_read_lock, without vfs_biglock.
+ * Changes are made holding vfs_biglock: a new device goes into a free
+ * slot before kt_num is raised to cover it, and a full table is
+ * replaced by a bigger copy, the old one being freed after an RCU
+ * grace period. Knowndevs are never freed and their names never
+ * change, so a reader can go on using one it found. kd_fs changes on
+ * mount and unmount, though, so looking at the filesystem still
+ * takes vfs_biglock.
+ */
+struct knowndevtab {
+	struct rcu_head kt_rcu;		/* For freeing; must be first */
+	unsigned kt_num;		/* Slots in use */
+	unsigned kt_max;		/* Slots allocated */
+	struct knowndev **kt_devs;	/* The slots, just past the struct */
+};
+
+#define KNOWNDEVS_INIT	8		/* Initial number of slots */
 
-static struct knowndevarray *knowndevs;
+static struct knowndevtab *knowndevs;
 
 /* The big lock for all FS ops. Remove for filesystem assignment. */
 static struct lock *vfs_biglock;
 static unsigned vfs_biglock_depth;
 
 
+static
+struct knowndevtab *
+knowndevtab_create(unsigned max)
+{
+	struct knowndevtab *kt;
+
+	kt = kmalloc(sizeof(*kt) + max * sizeof(struct knowndev *));
+	if (kt == NULL) {
+		return NULL;
+	}
+	kt->kt_num = 0;
+	kt->kt_max = max;
+	kt->kt_devs = (struct knowndev **)(kt + 1);
+	return kt;
+}
+
+static
+void
+knowndevtab_free(struct rcu_head *rh)
+{
+	kfree((struct knowndevtab *)rh);
+}
+
+/*
+ * Add KD to the table, growing it if need be. Hands back the slot
+ * number in INDEX_RET.
+ */
+static
+int
+knowndevtab_add(struct knowndev *kd, unsigned *index_ret)
+{
+	struct knowndevtab *kt, *newkt;
+	unsigned i;
+
+	KASSERT(vfs_biglock_do_i_hold());
+
+	kt = knowndevs;
+	if (kt->kt_num == kt->kt_max) {
+		newkt = knowndevtab_create(kt->kt_max * 2);
+		if (newkt == NULL) {
+			return ENOMEM;
+		}
+		for (i=0; i<kt->kt_num; i++) {
+			newkt->kt_devs[i] = kt->kt_devs[i];
+		}
+		newkt->kt_num = kt->kt_num;
+		rcu_assign(knowndevs, newkt);
+		call_rcu(&kt->kt_rcu, knowndevtab_free);
+		kt = newkt;
+	}
+
+	*index_ret = kt->kt_num;
+	kt->kt_devs[kt->kt_num] = kd;
+	rcu_assign(kt->kt_num, kt->kt_num + 1);
+	return 0;
+}
+
 /*
  * Setup function
  */
 void
 vfs_bootstrap(void)
 {
-	knowndevs = knowndevarray_create();
+	knowndevs = knowndevtab_create(KNOWNDEVS_INIT);
 	if (knowndevs==NULL) {
 		panic("vfs: Could not create knowndevs array\n");
 	}
@@ -156,9 +231,9 @@ vfs_sync(void)
 
 	vfs_biglock_acquire();
 
-	num = knowndevarray_num(knowndevs);
+	num = knowndevs->kt_num;
 	for (i=0; i<num; i++) {
-		dev = knowndevarray_get(knowndevs, i);
+		dev = knowndevs->kt_devs[i];
 		if (dev->kd_fs != NULL) {
 			/*result =*/ FSOP_SYNC(dev->kd_fs);
 		}
@@ -172,82 +247,95 @@ vfs_sync(void)
 /*
  * Given a device name (lhd0, emu0, somevolname, null, etc.), hand
  * back an appropriate vnode.
+ *
+ * If DEVNAME names a device with a mounted filesystem, or names the
+ * filesystem's volume, that's the root of the filesystem. If it
+ * names a mountable device with nothing mounted, that's ENXIO.
+ * Otherwise, if it names a device (a raw device, or one that isn't
+ * mountable and has no filesystem), it's the device itself.
+ *
+ * The device names are searched without locking. Filesystems can
+ * come and go, though, so the cases that involve one are handled
+ * under vfs_biglock.
  */
 int
 vfs_getroot(const char *devname, struct vnode **result)
 {
-	struct knowndev *kd;
+	struct knowndevtab *kt;
+	struct knowndev *kd, *found;
+	const char *volname;
+	bool raw;
 	unsigned i, num;
+	int ret;
 
-	KASSERT(vfs_biglock_do_i_hold());
-
-	num = knowndevarray_num(knowndevs);
+	found = NULL;
+	raw = false;
+	rcu_read_lock();
+	kt = rcu_deref(knowndevs);
+	num = rcu_deref(kt->kt_num);
 	for (i=0; i<num; i++) {
-		kd = knowndevarray_get(knowndevs, i);
-
-		/*
-		 * If this device has a mounted filesystem, and
-		 * DEVNAME names either the filesystem or the device,
-		 * return the root of the filesystem.
-		 *
-		 * If it has no mounted filesystem, it's mountable,
-		 * and DEVNAME names the device, return ENXIO.
-		 */
-
-		if (kd->kd_fs!=NULL) {
-			const char *volname;
-			volname = FSOP_GETVOLNAME(kd->kd_fs);
-
-			if (!strcmp(kd->kd_name, devname) ||
-			    (volname!=NULL && !strcmp(volname, devname))) {
-				*result = FSOP_GETROOT(kd->kd_fs);
-				return 0;
-			}
-		}
-		else {
-			if (kd->kd_rawname!=NULL &&
-			    !strcmp(kd->kd_name, devname)) {
-				return ENXIO;
-			}
-		}
-
-		/*
-		 * If DEVNAME names the device, and we get here, it
-		 * must have no fs and not be mountable. In this case,
-		 * we return the device itself.
-		 */
+		kd = kt->kt_devs[i];
 		if (!strcmp(kd->kd_name, devname)) {
-			KASSERT(kd->kd_fs==NULL);
-			KASSERT(kd->kd_rawname==NULL);
-			KASSERT(kd->kd_device != NULL);
-			VOP_INCREF(kd->kd_vnode);
-			*result = kd->kd_vnode;
-			return 0;
+			found = kd;
+			break;
 		}
-
-		/*
-		 * If the device has a rawname and DEVNAME names that,
-		 * return the device itself.
-		 */
 		if (kd->kd_rawname!=NULL && !strcmp(kd->kd_rawname, devname)) {
-			KASSERT(kd->kd_device != NULL);
-			VOP_INCREF(kd->kd_vnode);
-			*result = kd->kd_vnode;
-			return 0;
+			found = kd;
+			raw = true;
+			break;
 		}
+	}
+	rcu_read_unlock();
 
-		/*
-		 * If none of the above tests matched, we didn't name
-		 * any of the names of this device, so go on to the
-		 * next one. 
-		 */
+	/*
+	 * A raw device, or a device that isn't mountable and has no
+	 * filesystem (which can't change): return the device itself.
+	 * Its vnode lives as long as the knowndev does.
+	 */
+	if (found != NULL &&
+	    (raw || (found->kd_rawname == NULL && found->kd_fs == NULL))) {
+		KASSERT(found->kd_device != NULL);
+		VOP_INCREF(found->kd_vnode);
+		*result = found->kd_vnode;
+		return 0;
+	}
+
+	vfs_biglock_acquire();
+
+	if (found != NULL) {
+		if (found->kd_fs != NULL) {
+			*result = FSOP_GETROOT(found->kd_fs);
+			ret = 0;
+		}
+		else {
+			/* Mountable, with nothing mounted */
+			KASSERT(found->kd_rawname != NULL);
+			ret = ENXIO;
+		}
+		vfs_biglock_release();
+		return ret;
 	}
 
 	/*
-	 * If we got here, the device specified by devname doesn't exist.
+	 * Not a device name; maybe it's a volume name.
 	 */
+	ret = ENODEV;
+	num = knowndevs->kt_num;
+	for (i=0; i<num; i++) {
+		kd = knowndevs->kt_devs[i];
+		if (kd->kd_fs == NULL) {
+			continue;
+		}
+		volname = FSOP_GETVOLNAME(kd->kd_fs);
+		if (volname!=NULL && !strcmp(volname, devname)) {
+			*result = FSOP_GETROOT(kd->kd_fs);
+			ret = 0;
+			break;
+		}
+	}
 
-	return ENODEV;
+	vfs_biglock_release();
+	return ret;
 }
 
 /*
@@ -256,29 +344,32 @@ vfs_getroot(const char *devname, struct vnode **result)
 const char *
 vfs_getdevname(struct fs *fs)
 {
+	struct knowndevtab *kt;
 	struct knowndev *kd;
+	const char *name;
 	unsigned i, num;
 
 	KASSERT(fs != NULL);
 
-	KASSERT(vfs_biglock_do_i_hold());
-
-	num = knowndevarray_num(knowndevs);
+	/*
+	 * This needs no lock: as long as the guy calling us holds a
+	 * reference to the fs, the fs cannot go away, kd_fs can't
+	 * change to or from it, and knowndevs are never freed.
+	 */
+	name = NULL;
+	rcu_read_lock();
+	kt = rcu_deref(knowndevs);
+	num = rcu_deref(kt->kt_num);
 	for (i=0; i<num; i++) {
-		kd = knowndevarray_get(knowndevs, i);
-
+		kd = kt->kt_devs[i];
 		if (kd->kd_fs == fs) {
-			/*
-			 * This is not a race condition: as long as the
-			 * guy calling us holds a reference to the fs,
-			 * the fs cannot go away, and the device can't
-			 * go away until the fs goes away.
-			 */
-			return kd->kd_name;
+			name = kd->kd_name;
+			break;
 		}
 	}
+	rcu_read_unlock();
 
-	return NULL;
+	return name;
 }
 
 /*
@@ -340,9 +431,9 @@ badnames(const char *n1, const char *n2, const char *n3)
 
 	KASSERT(vfs_biglock_do_i_hold());
 
-	num = knowndevarray_num(knowndevs);
+	num = knowndevs->kt_num;
 	for (i=0; i<num; i++) {
-		kd = knowndevarray_get(knowndevs, i);
+		kd = knowndevs->kt_devs[i];
 
 		if (kd->kd_fs) {
 			volname = FSOP_GETVOLNAME(kd->kd_fs);
@@ -416,7 +507,7 @@ vfs_doadd(const char *dname, int mountable, struct device *dev, struct fs *fs)
 		return EEXIST;
 	}
 
-	result = knowndevarray_add(knowndevs, kd, &index);
+	result = knowndevtab_add(kd, &index);
 
 	if (result == 0 && dev != NULL) {
 		/* use index+1 as the device number, so 0 is reserved */
@@ -470,7 +561,7 @@ vfs_addfs(const char *devname, struct fs *fs)
 
 /*
  * Look for a mountable device named DEVNAME.
- * Should already hold knowndevs_lock.
+ * Should already hold vfs_biglock.
  */
 static
 int
@@ -482,9 +573,9 @@ findmount(const char *devname, struct knowndev **result)
 
 	KASSERT(vfs_biglock_do_i_hold());
 
-	num = knowndevarray_num(knowndevs);
+	num = knowndevs->kt_num;
 	for (i=0; !found && i<num; i++) {
-		dev = knowndevarray_get(knowndevs, i);
+		dev = knowndevs->kt_devs[i];
 		if (dev->kd_rawname==NULL) {
 			/* not mountable/unmountable */
 			continue;
@@ -605,9 +696,9 @@ vfs_unmountall(void)
 
 	vfs_biglock_acquire();
 
-	num = knowndevarray_num(knowndevs);
+	num = knowndevs->kt_num;
 	for (i=0; i<num; i++) {
-		dev = knowndevarray_get(knowndevs, i);
+		dev = knowndevs->kt_devs[i];
 		if (dev->kd_rawname == NULL) {
 			/* not mountable/unmountable */
 			continue;
@@ -14,10 +14,10 @@
 #include <lib.h>
 #include <synch.h>
 #include <spl.h>
+#include <cpucounter.h>
 #include <uw-vmstats.h>
 
-/* Counters for tracking statistics */
-static unsigned int stats_counts[VMSTAT_COUNT];
+/* Counters for tracking statistics are per-cpu; see cpucounter.h */
 
 struct spinlock stats_lock = SPINLOCK_INITIALIZER;
 
@@ -38,12 +38,12 @@ static const char *stats_names[] = {
 
 /* ---------------------------------------------------------------------- */
 /* Assumes vmstat_init has already been called */
+/* The counters are per-cpu, so this doesn't need stats_lock. */
 void
 vmstats_inc(unsigned int index)
 {
-    spinlock_acquire(&stats_lock);
-      _vmstats_inc(index);
-    spinlock_release(&stats_lock);
+  KASSERT(index < VMSTAT_COUNT);
+  cpucounter_inc(CPUCOUNTER_VMSTATS + index);
 }
 
 /* ---------------------------------------------------------------------- */
@@ -65,7 +65,7 @@ void
 _vmstats_inc(unsigned int index)
 {
   KASSERT(index < VMSTAT_COUNT);
-  stats_counts[index]++;
+  cpucounter_inc(CPUCOUNTER_VMSTATS + index);
 }
 
 /* ---------------------------------------------------------------------- */
@@ -81,7 +81,7 @@ _vmstats_init(void)
   }
 
   for (i=0; i<VMSTAT_COUNT; i++) {
-    stats_counts[i] = 0;
+    cpucounter_reset(CPUCOUNTER_VMSTATS + i);
   }
 
 }
@@ -102,6 +102,12 @@ vmstats_print(void)
   int tlb_faults = 0;
   int elf_plus_swap_reads = 0;
   int disk_reads = 0;
+  unsigned int stats_counts[VMSTAT_COUNT];
+
+  /* Add up the per-cpu counts once, so the checks below agree */
+  for (i=0; i<VMSTAT_COUNT; i++) {
+    stats_counts[i] = cpucounter_read(CPUCOUNTER_VMSTATS + i);
+  }
 
   kprintf("VMSTATS:\n");
   for (i=0; i<VMSTAT_COUNT; i++) {
@@ -153,7 +153,15 @@ int readlink(const char *path, char *buf, size_t buflen);
 int dup2(int filehandle, int newhandle);
 int pipe(int filehandles[2]);
 time_t __time(time_t *seconds, unsigned long *nanoseconds);
+int __settime(const time_t *seconds, const unsigned long *nanoseconds);
 int __getcwd(char *buf, size_t buflen);
+int sched_setaffinity(pid_t pid, unsigned mask);	/* pid 0 is self */
+int sched_settickets(pid_t pid, int tickets);		/* 0: default class */
+int sched_setedf(int period_ms, int budget_ms);		/* calling thread */
+int sched_setgang(pid_t pid, int on);			/* pid 0 is self */
+int nanosleep(const struct timespec *req, struct timespec *rem);
+int futex_wait(volatile int *addr, int val, const struct timespec *timeout);
+int futex_wake(volatile int *addr, int count);		/* returns # woken */
 /* stat - see sys/stat.h */
 /* lstat - see sys/stat.h */
 
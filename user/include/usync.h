@@ -0,0 +1,87 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _USYNC_H_
+#define _USYNC_H_
+
+#include <kern/time.h>
+
+/*
+ * Mutexes and condition variables for user programs, built on
+ * futex_wait and futex_wake. Taking a free mutex and releasing one
+ * nobody is waiting for are done entirely at user level; only
+ * blocking and waking somebody up make system calls.
+ *
+ * The objects must be in memory shared by all their users, and must
+ * be initialized (or statically set to the INITIALIZER value) before
+ * use.
+ *
+ *    umutex_lock       take the mutex, sleeping until it's free.
+ *    umutex_trylock    take it if it's free; returns 0 on success,
+ *                      EBUSY if it's held.
+ *    umutex_unlock     release it.
+ *
+ *    ucond_wait        release the mutex, sleep until signalled,
+ *                      and take the mutex again. As with any
+ *                      condition variable, wake-ups may be spurious,
+ *                      so recheck the condition in a loop.
+ *    ucond_timedwait   same, but give up after TIMEOUT (relative)
+ *                      and return ETIMEDOUT. Returns 0 otherwise.
+ *    ucond_signal      wake one waiter.
+ *    ucond_broadcast   wake all waiters.
+ *
+ * Signalling a condition variable nobody is waiting on doesn't trap
+ * either.
+ */
+
+struct umutex {
+	volatile int um_state;		/* 0 free, 1 held, 2 held and wanted */
+};
+
+struct ucond {
+	volatile int uc_seq;		/* bumped by every signal */
+	volatile int uc_waiters;	/* threads in ucond_wait */
+};
+
+#define UMUTEX_INITIALIZER	{ 0 }
+#define UCOND_INITIALIZER	{ 0, 0 }
+
+void umutex_init(struct umutex *m);
+void umutex_lock(struct umutex *m);
+int umutex_trylock(struct umutex *m);
+void umutex_unlock(struct umutex *m);
+
+void ucond_init(struct ucond *c);
+void ucond_wait(struct ucond *c, struct umutex *m);
+int ucond_timedwait(struct ucond *c, struct umutex *m,
+		    const struct timespec *timeout);
+void ucond_signal(struct ucond *c);
+void ucond_broadcast(struct ucond *c);
+
+#endif /* _USYNC_H_ */
@@ -0,0 +1,223 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <unistd.h>
+#include <errno.h>
+#include <usync.h>
+
+/*
+ * User-level mutexes and condition variables. See usync.h.
+ *
+ * The mutex is the three-state futex lock: 0 is free, 1 is held with
+ * nobody waiting, and 2 is held with (possibly) somebody waiting.
+ * Only an unlock from state 2 calls futex_wake, and a locker only
+ * sleeps after setting state 2, so a waiter can't be missed.
+ *
+ * A condition variable is a sequence number. Waiters note it before
+ * letting go of the mutex and sleep only if it hasn't moved since, so
+ * a signal between the two isn't lost.
+ */
+
+/* Big enough to wake everyone in futex_wake. */
+#define UCOND_WAKEALL	0x7fffffff
+
+/*
+ * Atomic operations, using LL/SC like the kernel's spinlocks.
+ */
+
+/* If *P is OLD, make it NEW. Returns what *P was. */
+static
+int
+usync_cas(volatile int *p, int old, int new)
+{
+	int x, y;
+
+	__asm volatile(
+		".set push;"		/* save assembler mode */
+		".set mips32;"		/* allow MIPS32 instructions */
+		".set noreorder;"	/* we fill the delay slots */
+		"1: ll %0, 0(%2);"	/*   x = *p */
+		"bne %0, %3, 2f;"	/*   if (x != old) give up */
+		" move %1, %4;"		/*   y = new (delay slot) */
+		"sc %1, 0(%2);"		/*   *p = y; y = success? */
+		"beqz %1, 1b;"		/*   if the store failed, retry */
+		" nop;"
+		"2: .set pop"		/* restore assembler mode */
+		: "=&r" (x), "=&r" (y)
+		: "r" (p), "r" (old), "r" (new)
+		: "memory");
+	return x;
+}
+
+/* Set *P to NEW. Returns what it was. */
+static
+int
+usync_exchange(volatile int *p, int new)
+{
+	int x, y;
+
+	do {
+		__asm volatile(
+			".set push;"		/* save assembler mode */
+			".set mips32;"		/* allow MIPS32 instructions */
+			".set volatile;"	/* avoid unwanted optimization */
+			"ll %0, 0(%2);"		/*   x = *p */
+			"move %1, %3;"		/*   y = new */
+			"sc %1, 0(%2);"		/*   *p = y; y = success? */
+			".set pop"		/* restore assembler mode */
+			: "=&r" (x), "=&r" (y) : "r" (p), "r" (new)
+			: "memory");
+	} while (y == 0);
+	return x;
+}
+
+/* Add DELTA to *P. */
+static
+void
+usync_add(volatile int *p, int delta)
+{
+	int x, y;
+
+	do {
+		__asm volatile(
+			".set push;"		/* save assembler mode */
+			".set mips32;"		/* allow MIPS32 instructions */
+			".set volatile;"	/* avoid unwanted optimization */
+			"ll %0, 0(%2);"		/*   x = *p */
+			"addu %1, %0, %3;"	/*   y = x + delta */
+			"sc %1, 0(%2);"		/*   *p = y; y = success? */
+			".set pop"		/* restore assembler mode */
+			: "=&r" (x), "=&r" (y) : "r" (p), "r" (delta)
+			: "memory");
+	} while (y == 0);
+}
+
+////////////////////////////////////////////////////////////
+// mutex
+
+void
+umutex_init(struct umutex *m)
+{
+	m->um_state = 0;
+}
+
+/*
+ * Slow path: mark the mutex wanted and sleep until we get it. We
+ * can't tell whether anyone else is still waiting, so once we've
+ * been asleep we always take it in state 2.
+ */
+static
+void
+umutex_lock_contended(struct umutex *m)
+{
+	while (usync_exchange(&m->um_state, 2) != 0) {
+		futex_wait(&m->um_state, 2, NULL);
+	}
+}
+
+void
+umutex_lock(struct umutex *m)
+{
+	if (usync_cas(&m->um_state, 0, 1) == 0) {
+		return;
+	}
+	umutex_lock_contended(m);
+}
+
+int
+umutex_trylock(struct umutex *m)
+{
+	if (usync_cas(&m->um_state, 0, 1) == 0) {
+		return 0;
+	}
+	return EBUSY;
+}
+
+void
+umutex_unlock(struct umutex *m)
+{
+	if (usync_exchange(&m->um_state, 0) == 2) {
+		futex_wake(&m->um_state, 1);
+	}
+}
+
+////////////////////////////////////////////////////////////
+// condition variable
+
+void
+ucond_init(struct ucond *c)
+{
+	c->uc_seq = 0;
+	c->uc_waiters = 0;
+}
+
+int
+ucond_timedwait(struct ucond *c, struct umutex *m,
+		const struct timespec *timeout)
+{
+	int seq;
+	int result;
+
+	usync_add(&c->uc_waiters, 1);
+	seq = c->uc_seq;
+	umutex_unlock(m);
+
+	result = 0;
+	if (futex_wait(&c->uc_seq, seq, timeout) < 0 && errno == ETIMEDOUT) {
+		result = ETIMEDOUT;
+	}
+
+	usync_add(&c->uc_waiters, -1);
+	umutex_lock_contended(m);
+	return result;
+}
+
+void
+ucond_wait(struct ucond *c, struct umutex *m)
+{
+	ucond_timedwait(c, m, NULL);
+}
+
+void
+ucond_signal(struct ucond *c)
+{
+	usync_add(&c->uc_seq, 1);
+	if (c->uc_waiters > 0) {
+		futex_wake(&c->uc_seq, 1);
+	}
+}
+
+void
+ucond_broadcast(struct ucond *c)
+{
+	usync_add(&c->uc_seq, 1);
+	if (c->uc_waiters > 0) {
+		futex_wake(&c->uc_seq, UCOND_WAKEALL);
+	}
+}
@@ -0,0 +1,178 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+/*
+ * futexbench.c
+ *	Check futex_wait/futex_wake and the usync mutex and condition
+ *	variable, and time their fast paths against a system call.
+ *
+ * Processes don't share memory and there are no user threads, so
+ * nobody can actually contend here; what this measures is how much
+ * the uncontended operations cost (they should not trap) next to a
+ * futex_wake that does, and how long a timed futex_wait oversleeps.
+ */
+
+#include <unistd.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <err.h>
+#include <usync.h>
+
+#define NOPS		100000	/* iterations per timing loop */
+#define NSYSCALLS	10000	/* iterations when each one traps */
+#define TIMEOUT_MS	50	/* for the timed waits */
+
+static volatile int word;
+static struct umutex mutex = UMUTEX_INITIALIZER;
+static struct ucond cond = UCOND_INITIALIZER;
+
+/*
+ * Current time in nanoseconds.
+ */
+static
+unsigned long long
+now(void)
+{
+	time_t secs;
+	unsigned long nsecs;
+
+	__time(&secs, &nsecs);
+	return (unsigned long long)secs * 1000000000 + nsecs;
+}
+
+static
+void
+report(const char *what, unsigned long long start, unsigned n)
+{
+	printf("futexbench: %-28s %6llu ns/op\n", what,
+	       (now() - start) / n);
+}
+
+/*
+ * Check the error cases and that timeouts time out.
+ */
+static
+void
+check(void)
+{
+	struct timespec ts;
+	unsigned long long start, ms;
+	int result;
+
+	word = 1;
+	result = futex_wait(&word, 0, NULL);
+	if (result != -1 || errno != EAGAIN) {
+		errx(1, "futex_wait on a changed word: got %d (%s)",
+		     result, strerror(errno));
+	}
+
+	result = futex_wait((volatile int *)((char *)&word + 1), 1, NULL);
+	if (result != -1 || errno != EINVAL) {
+		errx(1, "futex_wait on a misaligned word: got %d (%s)",
+		     result, strerror(errno));
+	}
+
+	result = futex_wake(&word, 1);
+	if (result != 0) {
+		errx(1, "futex_wake with no waiters woke %d", result);
+	}
+
+	ts.tv_sec = 0;
+	ts.tv_nsec = TIMEOUT_MS * 1000000;
+	start = now();
+	result = futex_wait(&word, 1, &ts);
+	ms = (now() - start) / 1000000;
+	if (result != -1 || errno != ETIMEDOUT) {
+		errx(1, "timed futex_wait: got %d (%s)",
+		     result, strerror(errno));
+	}
+	if (ms < TIMEOUT_MS) {
+		errx(1, "timed futex_wait returned after %llu ms, "
+		     "wanted %d", ms, TIMEOUT_MS);
+	}
+	printf("futexbench: %d ms futex_wait took %llu ms\n",
+	       TIMEOUT_MS, ms);
+
+	umutex_lock(&mutex);
+	if (umutex_trylock(&mutex) != EBUSY) {
+		errx(1, "umutex_trylock got a held mutex");
+	}
+	result = ucond_timedwait(&cond, &mutex, &ts);
+	if (result != ETIMEDOUT) {
+		errx(1, "ucond_timedwait: got %d", result);
+	}
+	if (umutex_trylock(&mutex) != EBUSY) {
+		errx(1, "ucond_timedwait returned without the mutex");
+	}
+	umutex_unlock(&mutex);
+	if (umutex_trylock(&mutex) != 0) {
+		errx(1, "umutex_trylock failed on a free mutex");
+	}
+	umutex_unlock(&mutex);
+}
+
+int
+main(void)
+{
+	unsigned long long start;
+	unsigned i;
+
+	check();
+
+	start = now();
+	for (i=0; i<NOPS; i++) {
+		umutex_lock(&mutex);
+		umutex_unlock(&mutex);
+	}
+	report("umutex lock+unlock", start, NOPS);
+
+	start = now();
+	for (i=0; i<NOPS; i++) {
+		ucond_signal(&cond);
+	}
+	report("ucond_signal, no waiters", start, NOPS);
+
+	start = now();
+	for (i=0; i<NSYSCALLS; i++) {
+		futex_wake(&word, 1);
+	}
+	report("futex_wake (system call)", start, NSYSCALLS);
+
+	start = now();
+	for (i=0; i<NSYSCALLS; i++) {
+		futex_wait(&word, 0, NULL);
+	}
+	report("futex_wait, value changed", start, NSYSCALLS);
+
+	printf("futexbench: passed\n");
+	return 0;
+}
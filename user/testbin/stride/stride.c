@@ -0,0 +1,154 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+/*
+ * stride.c
+ *	Check that the stride scheduler splits the cpu in proportion to
+ *	tickets.
+ *
+ * Everything is pinned to cpu 0 so the processes actually compete.
+ * The parent first measures how fast the spin loop goes with the cpu
+ * to itself. Then it forks one hog per entry in tickets[], each of
+ * which joins the stride class, spins for RUNSECS, and exits with the
+ * percentage of that rate it managed. The parent checks each share
+ * against its fraction of the total tickets.
+ */
+
+#include <unistd.h>
+#include <stdio.h>
+#include <time.h>
+#include <err.h>
+
+#define NHOGS		3
+#define RUNSECS		5	/* length of each measurement */
+#define STARTDELAY	2	/* seconds to get all hogs forked */
+#define TOLERANCE	5	/* allowed error, in percentage points */
+
+static const int tickets[NHOGS] = { 100, 200, 300 };
+
+/*
+ * Current time in milliseconds.
+ */
+static
+unsigned long long
+now(void)
+{
+	time_t secs;
+	unsigned long nsecs;
+
+	__time(&secs, &nsecs);
+	return (unsigned long long)secs * 1000 + nsecs / 1000000;
+}
+
+/*
+ * Wait (spinning, so as to compete for the cpu) until START, then
+ * count loop iterations for RUNSECS.
+ */
+static
+unsigned long long
+spin(unsigned long long start)
+{
+	unsigned long long count, end;
+	volatile int i;
+
+	while (now() < start) {
+		/* nothing */
+	}
+
+	end = start + RUNSECS * 1000;
+	count = 0;
+	while (now() < end) {
+		for (i=0; i<1000; i++) {
+			/* nothing */
+		}
+		count++;
+	}
+	return count;
+}
+
+int
+main(void)
+{
+	unsigned long long base, start, count;
+	int pids[NHOGS], status, i, total, expected, share, failures;
+
+	if (sched_setaffinity(0, 1)) {
+		err(1, "sched_setaffinity");
+	}
+
+	printf("stride: measuring the cpu alone for %d seconds...\n",
+	       RUNSECS);
+	base = spin(now());
+	if (base == 0) {
+		errx(1, "Spin loop too slow to measure");
+	}
+
+	total = 0;
+	for (i=0; i<NHOGS; i++) {
+		total += tickets[i];
+	}
+
+	start = now() + STARTDELAY * 1000;
+	for (i=0; i<NHOGS; i++) {
+		pids[i] = fork();
+		if (pids[i] < 0) {
+			err(1, "fork");
+		}
+		if (pids[i] == 0) {
+			if (sched_settickets(0, tickets[i])) {
+				err(1, "sched_settickets");
+			}
+			count = spin(start);
+			_exit((int)(count * 100 / base));
+		}
+	}
+
+	failures = 0;
+	for (i=0; i<NHOGS; i++) {
+		if (waitpid(pids[i], &status, 0) < 0) {
+			err(1, "waitpid");
+		}
+		share = WEXITSTATUS(status);
+		expected = tickets[i] * 100 / total;
+		printf("stride: %d tickets: %d%% of the cpu (expected %d%%)\n",
+		       tickets[i], share, expected);
+		if (share < expected - TOLERANCE ||
+		    share > expected + TOLERANCE) {
+			failures++;
+		}
+	}
+
+	if (failures > 0) {
+		errx(1, "FAILED: %d of %d shares off by more than %d%%",
+		     failures, NHOGS, TOLERANCE);
+	}
+	printf("stride: passed\n");
+	return 0;
+}